@@ -0,0 +1,28 @@
+#ifndef BLE_MIDI_PACKER_H
+#define BLE_MIDI_PACKER_H
+
+#include "stdint.h"
+
+// Largest payload a single notification can carry (247 byte MTU less the ATT header)
+#define BLE_MIDI_PACKET_MAX			244
+// Smallest payload every central supports (default 23 byte MTU)
+#define BLE_MIDI_PACKET_MIN			20
+
+// Builds one BLE-MIDI packet from short MIDI messages. Has no dependencies on
+// Arduino or the BLE stack so it can be built and exercised on the host
+typedef struct
+{
+	uint8_t buffer[BLE_MIDI_PACKET_MAX];
+	uint16_t length;
+	uint16_t limit;				// Payload size for the current connection
+	uint8_t runningStatus;		// 0 when the next message must carry its status
+	uint8_t messages;
+} BleMidiPacker;
+
+void bleMidiPacker_Begin(BleMidiPacker* packer, uint16_t limit);
+bool bleMidiPacker_Add(BleMidiPacker* packer, uint16_t timeMs, uint8_t status, uint8_t data1, uint8_t data2);
+bool bleMidiPacker_AddSysex(BleMidiPacker* packer, uint16_t timeMs, const uint8_t* bytes, uint8_t length);
+uint8_t bleMidiPacker_DataLength(uint8_t status);
+uint8_t bleMidiPacker_Status(uint8_t type, uint8_t channel);
+
+#endif // BLE_MIDI_PACKER_H
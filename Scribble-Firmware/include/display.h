@@ -5,6 +5,7 @@
 #include <Fonts/FreeSansBold18pt7b.h>
 #include <Fonts/FreeSansBold24pt7b.h>
 #include <Fonts/FreeSansBold12pt7b.h>
+#include "text_render.h"
 
 // LCD parameters
 #define LCD_WIDTH		320
@@ -27,6 +28,17 @@
 
 #define CIRCLE_INDICATOR_SIZE			12
 #define CIRCLE_INDIACTOR_X_OFFSET	6
+#define MIDI_INDICATOR_X				((LCD_WIDTH/2) - (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET))
+#define WIRELESS_INDICATOR_X			((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET))
+#define INDICATOR_Y						((INFO_BAR_HEIGHT)/2)
+#define INDICATOR_SPRITE_SIZE			(2*CIRCLE_INDICATOR_SIZE + 1)
+
+// Beat indicator shown in place of the tempo for MIDI_CLOCK_DISPLAY_INDICATOR
+#define BEAT_SPRITE_SIZE				32
+#define BEAT_SPRITE_X_OFFSET			BPM_X_OFFSET
+#define BEAT_SPRITE_Y_OFFSET			((INFO_BAR_HEIGHT)/2 - BEAT_SPRITE_SIZE/2)
+#define BEAT_DOWNBEAT_RADIUS			14
+#define BEAT_QUARTER_RADIUS			8
 
 #define PRESET_NUM_FONT			FreeSansBold18pt7b
 #define BPM_FONT					FreeSansBold18pt7b
@@ -43,6 +55,49 @@
 #define CLOCK_START_COLOUR			0x07e0	// Green
 #define CLOCK_STOP_COLOUR			0xfcc0	// Orange
 
+// Beat indicator states, one pre-rendered sprite each
+typedef enum
+{
+	BeatOff,
+	BeatQuarter,
+	BeatDownbeat,
+	NUM_BEAT_TYPES
+} BeatType;
+
+// Indicator circle states, pre-rendered for light and dark mode at boot
+typedef enum
+{
+	IndicatorMidiOff,
+	IndicatorMidiOn,
+	IndicatorBleOff,
+	IndicatorBleOn,
+	IndicatorWifiOff,
+	IndicatorWifiOn,
+	IndicatorWifiAp,				// Outline with a dot in the middle
+	IndicatorNoneOff,
+	IndicatorNoneOn,
+	NUM_INDICATOR_SPRITES
+} IndicatorSprite;
+
+typedef enum
+{
+	LayoutPresetName,
+	LayoutSecondaryText,
+	LayoutPresetNumber,
+	NUM_LAYOUT_FONTS
+} LayoutFont;
+
+// Cursor position and bounding box of a measured string
+typedef struct
+{
+	int16_t cursorX;
+	int16_t cursorY;
+	int16_t boundsX;
+	int16_t boundsY;
+	uint16_t w;
+	uint16_t h;
+} TextLayout;
+
 void display_Init();
 void display_SetBrightness(uint8_t value);
 void display_ConfigureNewDeviceScreen();
@@ -50,9 +105,15 @@ void display_DrawMainScreen();
 void display_DrawPresetNumber(uint16_t	 presetNumber);
 void display_DrawBpm(float value);
 void display_SetBpmDrawColour(uint16_t colour);
+void display_DrawBeatIndicator(uint8_t type);
 void display_DrawMainText(const char* text, const char* secondaryText);
+void display_DrawPresetText(uint16_t presetIndex);
+uint8_t display_GetPresetText(uint16_t presetIndex, TextLine* lines, uint16_t* background);
+void display_UpdateLayoutCache(uint16_t presetIndex);
+void display_BuildLayoutCache();
 void display_DrawMidiIndicator(bool active);
 void display_DrawWirelessIndicator(uint8_t type, uint8_t state);
+uint32_t display_Flush();
 
 
 #endif // DISPLAY_H
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef DISPLAY_TASK_H
+#define DISPLAY_TASK_H
+
+#include "stdint.h"
+
+// Draw commands accepted by the render task
+// Only the newest command of each type is kept, so redraws never back up
+typedef enum
+{
+	DisplayCmdMainScreen,
+	DisplayCmdPreset,
+	DisplayCmdBpm,
+	DisplayCmdMidiIndicator,
+	DisplayCmdWirelessIndicator,
+	DisplayCmdLayout,				// Re-measure edited presets, which accumulate rather than replace
+	NUM_DISPLAY_COMMANDS
+} DisplayCommandType;
+
+typedef struct
+{
+	uint16_t value;				// Preset index or indicator state
+	uint8_t param;					// Wireless type for the wireless indicator
+	float bpm;
+	uint32_t postedAt;			// micros() of the oldest coalesced request's event
+} DisplayCommand;
+
+typedef struct
+{
+	uint32_t posted;				// Requests received
+	uint32_t coalesced;			// Requests that replaced a stale pending one
+	uint32_t rendered;			// Commands actually drawn
+	uint32_t renderUsLast;		// Time spent drawing the command into the framebuffer
+	uint32_t renderUsMax;
+	uint32_t latencyUsMax;		// Event to flushed pixels
+} DisplayCommandStats;
+
+// Beat events are queued rather than coalesced so no flash is ever skipped
+// Sized for several beats of backlog at the fastest tempo
+#define DISPLAY_BEAT_QUEUE_LENGTH		16
+
+typedef struct
+{
+	uint8_t type;					// BeatType
+	uint32_t tickTime;			// micros() of the sync24 tick that produced it
+} BeatEvent;
+
+typedef struct
+{
+	DisplayCommandStats commands[NUM_DISPLAY_COMMANDS];
+	uint8_t queueDepth;			// Pending command types at the start of the last batch
+	uint8_t queueDepthPeak;
+	uint32_t flushUsLast;
+	uint32_t flushUsMax;
+	uint32_t beatsRendered;
+	uint32_t beatsDropped;		// Beat queue was full
+	uint32_t beatLatencyUsLast;	// Clock tick to flushed sprite
+	uint32_t beatLatencyUsMax;
+} DisplayTaskStats;
+
+void display_TaskInit();
+void display_Task(void* parameter);
+
+// eventTime is the micros() timestamp of the event that caused the redraw
+// Latency is measured from there to flushed pixels. 0 uses the time of posting
+void display_QueueMainScreen();
+void display_QueuePreset(uint16_t presetIndex);
+void display_QueueBpm(float bpm, uint32_t eventTime = 0);
+void display_QueueMidiIndicator(bool active, uint32_t eventTime = 0);
+void display_QueueWirelessIndicator(uint8_t type, uint8_t state, uint32_t eventTime = 0);
+void display_QueueBeat(uint8_t type, uint32_t tickTime);
+void display_QueueLayout(uint16_t presetIndex);
+
+const DisplayTaskStats* display_GetTaskStats();
+
+#endif // DISPLAY_TASK_H
@@ -0,0 +1,44 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "Adafruit_GFX.h"
+#include "display.h"
+
+class Adafruit_SPITFT;
+
+// Maximum number of separate regions tracked between flushes.
+// Once full, new regions are merged into the closest existing one
+#define FRAMEBUFFER_MAX_DIRTY_RECTS		8
+
+typedef struct
+{
+	int16_t x;
+	int16_t y;
+	int16_t w;
+	int16_t h;
+} DisplayRect;
+
+typedef struct
+{
+	uint32_t frames;				// Number of flushes that pushed at least one rectangle
+	uint32_t bytesLastFrame;		// Pixel bytes pushed by the last flush
+	uint8_t rectsLastFrame;		// Address windows opened by the last flush
+	uint32_t bytesPeakFrame;		// Largest single flush seen
+	uint64_t bytesTotal;			// Running total of pixel bytes pushed
+	uint32_t pixelsMarked;		// Running total of pixels marked dirty, before merging
+} FramebufferStats;
+
+// Off-screen RGB565 copy of the whole panel (in rotated coordinates)
+// All display drawing is composed here and pushed by framebuffer_Flush()
+// It is always held in full, 320 x 172 x 2 = 110,080 bytes of internal RAM, with or without
+// the DMA strips (see lcd_dma.h for the display's whole RAM budget)
+#define FRAMEBUFFER_BYTES					(LCD_WIDTH * LCD_HEIGHT * 2)
+extern GFXcanvas16 framebuffer;
+
+void framebuffer_Init();
+void framebuffer_MarkDirty(int16_t x, int16_t y, int16_t w, int16_t h);
+void framebuffer_MarkAllDirty();
+uint32_t framebuffer_Flush(Adafruit_SPITFT* target);
+const FramebufferStats* framebuffer_GetStats();
+
+#endif // FRAMEBUFFER_H
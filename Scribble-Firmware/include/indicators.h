@@ -0,0 +1,24 @@
+#ifndef INDICATORS_H
+#define INDICATORS_H
+
+#include "stdint.h"
+
+// Indicator events. Each is a bit in the indicator event group
+#define INDICATOR_EVENT_MIDI_RX			(1 << 0)	// MIDI received, turn the MIDI indicator on
+#define INDICATOR_EVENT_MIDI_OFF			(1 << 1)	// MIDI indicator hold time expired
+#define INDICATOR_EVENT_BLE				(1 << 2)	// BLE connection state changed
+#define INDICATOR_EVENT_WIFI				(1 << 3)	// WiFi connection state changed
+#define INDICATOR_EVENT_CLOCK_CHANGE	(1 << 4)	// Tempo changed
+#define INDICATOR_EVENT_CLOCK_START		(1 << 5)
+#define INDICATOR_EVENT_CLOCK_STOP		(1 << 6)
+#define INDICATOR_NUM_EVENTS				7
+#define INDICATOR_EVENT_ALL				((1 << INDICATOR_NUM_EVENTS) - 1)
+
+// Connection flags owned by the ESP32 manager are checked at this rate
+#define INDICATOR_LINK_POLL_MS			100
+
+void indicator_Init();
+void indicator_Signal(uint32_t events);
+void indicatorTask(void* parameter);
+
+#endif // INDICATORS_H
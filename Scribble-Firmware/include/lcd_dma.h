@@ -0,0 +1,42 @@
+#ifndef LCD_DMA_H
+#define LCD_DMA_H
+
+#include "stdint.h"
+
+class Adafruit_ST7789;
+
+// Panel writes are streamed through two strip buffers so one can be filled
+// while the other is being sent. Each strip holds this many full-width lines
+// 8 lines is 5KB a strip, and a strip still takes ~1ms on the wire, far longer than refilling it
+//
+// RAM budget: the strips are copied out of the full-screen framebuffer, they do not replace it.
+// With DMA the display holds 110,080 bytes of framebuffer plus 10,240 bytes of strips,
+// 120,320 bytes in all, and needs LCD_DMA_HEAP_RESERVE more left free to take the strips at all.
+// The blocking driver holds the framebuffer alone. "displayHeap" in the render profile reports both
+#define LCD_DMA_STRIP_LINES		8
+#define LCD_DMA_SPI_CLOCK			40000000
+// DMA capable internal RAM that must be left free once the strips are taken. BLE and WiFi
+// are already up by then but keep allocating buffers as connections come and go.
+// Below this the panel stays on the blocking driver, which needs no RAM of its own
+#define LCD_DMA_HEAP_RESERVE		(48 * 1024)
+
+// Heap as seen by the display, in bytes
+typedef struct
+{
+	uint32_t stripBytes;					// Held by the DMA strips, 0 on the blocking driver
+	uint32_t dmaFreeAtInit;				// DMA capable RAM free before the strips were taken
+	uint32_t internalFree;
+	uint32_t internalMinFree;			// Lowest since boot
+	uint32_t dmaFree;
+	uint32_t dmaMinFree;
+	uint32_t dmaLargestBlock;
+} LcdDmaHeapStats;
+
+bool lcdDma_Init(Adafruit_ST7789* lcd);
+bool lcdDma_IsActive();
+void lcdDma_SendCommand(uint8_t command, const uint8_t* data, uint8_t length);
+uint32_t lcdDma_PushRect(const uint16_t* buffer, uint16_t stride, int16_t x, int16_t y, int16_t w, int16_t h);
+void lcdDma_Wait();
+void lcdDma_GetHeapStats(LcdDmaHeapStats* stats);
+
+#endif // LCD_DMA_H
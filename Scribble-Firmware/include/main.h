@@ -53,7 +53,7 @@ typedef struct
 {
 	// MIDI interface to send the message on
 	// Bit maskng is used to preserve memory and allow multiple interfaces
-	// Bit 0 = USBD, Bit 1 = BLE, Bit 2 = WiFi, Bit 3 = Serial1
+	// Bit n = MidiInterfaceType n: Bit 0 = USBD, Bit 1 = BLE, Bit 2 = Serial1
 	uint8_t midiInterface;		
 	uint8_t status;
 	uint8_t data1;
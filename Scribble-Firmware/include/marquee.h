@@ -0,0 +1,24 @@
+#ifndef MARQUEE_H
+#define MARQUEE_H
+
+#include "stdint.h"
+#include "text_render.h"
+
+// Preset names too wide for the panel scroll sideways in a loop
+#define MARQUEE_STEP_PIXELS		2
+#define MARQUEE_STEP_MS				30
+#define MARQUEE_HOLD_MS				1500		// Pause with the start of the name showing
+#define MARQUEE_GAP_PIXELS			80			// Space between the end of the name and its repeat
+#define MARQUEE_MAX_TEXT			16+1		// Matches Preset::name
+
+// Returned by marquee_MsUntilStep() when nothing is scrolling
+#define MARQUEE_IDLE					UINT32_MAX
+
+bool marquee_Fits(const char* text, const GFXfont* font);
+void marquee_Start(const TextLine* line, uint16_t background, uint32_t now);
+void marquee_Stop();
+bool marquee_IsActive();
+uint32_t marquee_MsUntilStep(uint32_t now);
+bool marquee_Step(uint32_t now);
+
+#endif // MARQUEE_H
@@ -0,0 +1,30 @@
+#ifndef MIDI_ACTIONS_H
+#define MIDI_ACTIONS_H
+
+#include "stdint.h"
+
+// What an incoming CC or PC does, looked up by channel and number
+typedef enum
+{
+	MidiActionNone,
+	MidiActionPresetUp,
+	MidiActionPresetDown,
+	MidiActionGoToPreset,		// CC value or PC number is the preset
+	MidiActionGlobalCustom,		// Send the global custom stack
+	MidiActionPresetCustom,		// Send the current preset's custom stack
+	NUM_MIDI_ACTIONS
+} MidiAction;
+
+typedef struct
+{
+	uint32_t builds;
+	uint32_t dispatched;			// Messages that mapped to an action
+	uint32_t ignored;
+} MidiActionsStats;
+
+void midiActions_Build();
+void midiActions_ControlChange(uint8_t channel, uint8_t number, uint8_t value);
+void midiActions_ProgramChange(uint8_t channel, uint8_t number);
+const MidiActionsStats* midiActions_GetStats();
+
+#endif // MIDI_ACTIONS_H
@@ -7,8 +7,6 @@
 #define MIDI_CLOCK_EVENT_CHANGE	1
 #define MIDI_CLOCK_EVENT_START	2
 #define MIDI_CLOCK_EVENT_STOP		3
-#define MIDI_CLOCK_INDICATOR_ON	10
-#define MIDI_CLOCK_INDICATOR_OFF	11
 
 void clock_Init();
 void clock_Task(void* parameter);
@@ -23,6 +21,5 @@ void clock_SetTempo();
 extern uint8_t bleConnected;
 extern uint8_t newBleEvent;
 extern uint8_t midiReceived;
-extern uint8_t newClockEvent;
 
 #endif // CLOCK_H
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef MIDI_FILTER_H
+#define MIDI_FILTER_H
+
+#include "stdint.h"
+
+// Message types a thru route can let through, one bit each in MidiFilterSettings.types
+typedef enum
+{
+	MidiFilterNoteOff,
+	MidiFilterNoteOn,
+	MidiFilterPolyPressure,
+	MidiFilterControlChange,
+	MidiFilterProgramChange,
+	MidiFilterChannelPressure,
+	MidiFilterPitchBend,
+	MidiFilterSysex,
+	MidiFilterSystemCommon,		// MTC quarter frame, song position, song select, tune request
+	MidiFilterClock,
+	MidiFilterTransport,			// Start, continue and stop
+	MidiFilterActiveSensing,
+	MidiFilterReset,
+	NUM_MIDI_FILTER_TYPES
+} MidiFilterType;
+
+#define MIDI_FILTER_ALL_TYPES			((1 << NUM_MIDI_FILTER_TYPES) - 1)
+#define MIDI_FILTER_ALL_CHANNELS		0xFFFF
+
+// A route's filter as stored in the settings
+typedef struct
+{
+	uint16_t types;				// Bit n = MidiFilterType n
+	uint16_t channels;			// Bit n = channel n+1, channel messages only
+	uint8_t remap[16];			// Outgoing channel (0-15) for each incoming channel
+} MidiFilterSettings;
+
+// The same filter compiled for the forwarding path: one bit per status byte, so a
+// message is checked with a single lookup whatever its type and channel.
+// Like the BLE packer it has no Arduino dependencies so it can be built on the host
+typedef struct
+{
+	uint32_t statusPass[8];
+	uint8_t remap[16];
+	bool passAll;				// Lets everything through unchanged
+} MidiFilter;
+
+void midiFilter_Default(MidiFilterSettings* settings);
+void midiFilter_Compile(MidiFilter* filter, const MidiFilterSettings* settings);
+uint8_t midiFilter_TypeOf(uint8_t status);
+
+// Check a status byte against the filter, remapping its channel if it passes
+static inline bool midiFilter_Apply(const MidiFilter* filter, uint8_t* status)
+{
+	uint8_t byte = *status;
+	if(((filter->statusPass[byte >> 5] >> (byte & 0x1F)) & 1) == 0)
+		return false;
+	if(byte < 0xF0)
+		*status = (byte & 0xF0) | filter->remap[byte & 0x0F];
+	return true;
+}
+
+#endif // MIDI_FILTER_H
@@ -0,0 +1,47 @@
+#ifndef MIDI_JOURNAL_H
+#define MIDI_JOURNAL_H
+
+#include "stdint.h"
+
+// Records kept, a power of two. Older records are overwritten
+#define MIDI_JOURNAL_LENGTH			256
+// Bytes per record in the Device API report
+#define MIDI_JOURNAL_RECORD_BYTES	9
+
+typedef enum
+{
+	MidiJournalIn,					// Received. Route is the thru destination mask
+	MidiJournalQueued,			// Put on an interface's output ring. Route is the ring depth after queueing
+	MidiJournalDropped,			// Output ring full
+	MidiJournalStackQueued,		// Compiled stack queued. Data 1 is its length in bytes
+	MidiJournalSent,				// Handed to the transport by the interface's sender task
+	MidiJournalBlePacket,		// BLE packet notified. Data 1 is the number of messages in it
+	MidiJournalEcho,				// Received and dropped by the loop breaker. Route as for MidiJournalIn
+	NUM_MIDI_JOURNAL_EVENTS
+} MidiJournalEvent;
+
+typedef struct
+{
+	uint32_t timeUs;
+	uint8_t event;
+	uint8_t interface;
+	uint8_t route;
+	uint8_t status;
+	uint8_t data1;
+	uint8_t data2;
+} MidiJournalEntry;
+
+typedef struct
+{
+	uint32_t recorded;
+	uint32_t skipped;				// Not recorded while a report was being sent
+} MidiJournalStats;
+
+void midiJournal_Reset();
+void midiJournal_Record(uint8_t event, uint8_t interface, uint8_t route, uint8_t status, uint8_t data1, uint8_t data2);
+void midiJournal_Freeze(bool freeze);
+uint16_t midiJournal_GetCount();
+void midiJournal_PackRecord(uint16_t index, uint8_t* bytes);
+const MidiJournalStats* midiJournal_GetStats();
+
+#endif // MIDI_JOURNAL_H
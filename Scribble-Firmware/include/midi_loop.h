@@ -0,0 +1,36 @@
+#ifndef MIDI_LOOP_H
+#define MIDI_LOOP_H
+
+#include "stdint.h"
+#include "midi_filter.h"
+
+// Echoes can only be caught on the messages the MIDI handler hands to the firmware: control
+// change, program change and SysEx. Anything else is passed through by the handler without
+// the firmware seeing it, so a loop of notes, clock or other types is neither detected nor broken
+#define MIDI_LOOP_COVERED_TYPES		((1 << MidiFilterControlChange) | (1 << MidiFilterProgramChange) | (1 << MidiFilterSysex))
+
+// Fingerprints kept per interface of what was recently sent out on it, a power of two
+#define MIDI_LOOP_RING_LENGTH			16
+// A message coming back in on an interface this soon after going out of it is taken as an echo
+#define MIDI_LOOP_ECHO_WINDOW_MS		50
+// This many echoes on one interface inside the storm window is a loop, and its thru is
+// suspended for the hold time so the library stops feeding it
+#define MIDI_LOOP_STORM_ECHOES		8
+#define MIDI_LOOP_STORM_WINDOW_MS	500
+#define MIDI_LOOP_SUSPEND_MS			10000
+
+typedef struct
+{
+	uint32_t echoes;				// Messages dropped as echoes
+	uint32_t suspensions;		// Times thru from the interface was suspended
+} MidiLoopStats;
+
+void midiLoop_Init();
+uint32_t midiLoop_Fingerprint(uint8_t status, uint8_t data1, uint8_t data2);
+uint32_t midiLoop_FingerprintSysex(const uint8_t* data, unsigned length);
+void midiLoop_Record(uint8_t mask, uint32_t fingerprint);
+bool midiLoop_IsEcho(uint8_t interface, uint32_t fingerprint);
+uint8_t midiLoop_TakeWarning();
+const MidiLoopStats* midiLoop_GetStats(uint8_t interface);
+
+#endif // MIDI_LOOP_H
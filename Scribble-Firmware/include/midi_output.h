@@ -0,0 +1,109 @@
+#ifndef MIDI_OUTPUT_H
+#define MIDI_OUTPUT_H
+
+#include "stdint.h"
+#include "main.h"
+
+// One transmit ring per interface, WiFi RTP included when it is built in
+#ifdef USE_WIFI_RTP_MIDI
+#define NUM_MIDI_OUTPUTS					(MidiWiFiRTP + 1)
+#else
+#define NUM_MIDI_OUTPUTS					NUM_MIDI_INTERFACES
+#endif
+
+// Messages each ring holds before new ones are dropped
+#define MIDI_OUTPUT_RING_LENGTH			64
+// Realtime messages (clock, start, stop) have their own ring and are sent first
+#define MIDI_OUTPUT_REALTIME_LENGTH		16
+// Compiled message stacks each ring holds, see midi_stacks.h
+#define MIDI_OUTPUT_STACK_LENGTH			4
+// Longest compiled stack: a switch's global and preset stacks of three byte messages
+#define MIDI_OUTPUT_STACK_BYTES			(2 * NUM_SWITCH_MESSAGES * 3)
+// SysEx passed through a chunk at a time. The chunks a ring holds are the most one
+// destination can fall behind before it is cut out of the stream
+#define MIDI_OUTPUT_SYSEX_CHUNK_BYTES	32
+#define MIDI_OUTPUT_SYSEX_LENGTH			8
+// A destination left inside a SysEx for this long is closed with F7
+#define MIDI_OUTPUT_SYSEX_TIMEOUT_MS		500
+// Distinct channel and CC pairs one ring can hold back while coalescing
+#define MIDI_OUTPUT_COALESCE_SLOTS		32
+// Coalescing windows are kept in their own file, like the thru filters, so the global settings keep their size
+#define MIDI_OUTPUT_COALESCE_FILE		"/coalesce.txt"
+
+typedef struct
+{
+	uint8_t type;					// midi::MidiType
+	uint8_t channel;
+	uint8_t data1;
+	uint8_t data2;
+	bool thru;						// Forwarded, already noted by the loop breaker when it came in
+} MidiOutputMessage;
+
+// Complete messages with their status bytes, queued as one and sent in order
+typedef struct
+{
+	uint8_t length;
+	uint8_t bytes[MIDI_OUTPUT_STACK_BYTES];
+} MidiOutputStack;
+
+// Raw SysEx bytes, F0 and F7 included where the chunk starts or ends a message
+typedef struct
+{
+	uint8_t length;
+	uint8_t bytes[MIDI_OUTPUT_SYSEX_CHUNK_BYTES];
+} MidiOutputSysexChunk;
+
+typedef struct
+{
+	uint32_t sent;
+	uint32_t overflows;			// Messages or stacks dropped because the ring was full
+	uint32_t realtimeOverflows;
+	uint8_t highWater;			// Most messages waiting at once
+	uint8_t realtimeHighWater;
+	uint32_t sendUsMax;			// Longest single transmit
+	uint32_t sysexChunks;
+	uint32_t sysexOverflows;	// Chunks that did not fit, cutting this destination out of the stream
+	uint32_t sysexTimeouts;		// Streams closed because the rest never arrived
+	uint32_t ccCoalesced;		// CCs replaced by a newer value before they were sent
+} MidiOutputStats;
+
+// BLE output packs everything queued within one connection interval into one notification
+typedef struct
+{
+	uint32_t packets;
+	uint32_t messages;
+	uint8_t maxMessages;			// Most messages carried by one packet
+	uint32_t latencyUsTotal;	// Time from a packet's first message to its notification
+	uint32_t latencyUsMax;
+} BleMidiOutputStats;
+
+// Serial1 output writes its own bytes so it can use running status and slip realtime bytes into messages
+// Both only happen while no MIDI handler thru reaches the port, see midiOutput_SerialTask()
+typedef struct
+{
+	uint32_t bytes;
+	uint32_t statusBytesSaved;		// Status bytes left out under running status
+	uint32_t realtimeInserted;		// Realtime bytes sent between the bytes of another message, with the port to ourselves
+	uint32_t wireUsLastSecond;		// Wire time used during the last full second
+	uint32_t wireUsPeak;				// Most wire time used in any one second
+	uint8_t runningStatusActive;
+	uint8_t runningStatusBlockers;	// Sources whose unfiltered thru reaches Serial1, which turns running status off
+} SerialMidiOutputStats;
+
+void midiOutput_Init();
+void midiOutput_Task(void* parameter);
+void midiOutput_BleTask(void* parameter);
+void midiOutput_SerialTask(void* parameter);
+bool midiOutput_Send(uint8_t interface, midi::MidiType type, uint8_t channel, uint8_t data1, uint8_t data2);
+bool midiOutput_SendThru(uint8_t interface, midi::MidiType type, uint8_t channel, uint8_t data1, uint8_t data2);
+bool midiOutput_SendStack(uint8_t interface, const MidiOutputStack* stack);
+bool midiOutput_SendSysexChunk(uint8_t interface, const MidiOutputSysexChunk* chunk);
+uint16_t midiOutput_GetSysexQueuedBytes(uint8_t interface);
+void midiOutput_SetCoalesceWindow(uint8_t interface, uint16_t windowMs);
+void midiOutput_SaveCoalesceWindows();
+uint16_t midiOutput_GetCoalesceWindow(uint8_t interface);
+const MidiOutputStats* midiOutput_GetStats(uint8_t interface);
+const BleMidiOutputStats* midiOutput_GetBleStats();
+const SerialMidiOutputStats* midiOutput_GetSerialStats();
+
+#endif // MIDI_OUTPUT_H
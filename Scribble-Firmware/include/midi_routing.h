@@ -0,0 +1,55 @@
+#ifndef MIDI_ROUTING_H
+#define MIDI_ROUTING_H
+
+#include "stdint.h"
+#include "main.h"
+#include "midi_filter.h"
+
+// Destination masks use bit n for MidiInterfaceType n, covering the
+// NUM_MIDI_INTERFACES interfaces the settings have slots for
+#define MIDI_ROUTE_ALL				((1 << NUM_MIDI_INTERFACES) - 1)
+
+// Thru filters are kept in their own file so adding them left the global settings,
+// and the presets the boot check would format away with them, as they were
+#define MIDI_ROUTING_FILTERS_FILE	"/filters.txt"
+// A filtered route is taken away from the MIDI handler's thru, so it can only carry what the handler
+// hands to the firmware. Filters letting through anything else are refused, see midiRouting_SetFilter()
+#define MIDI_ROUTING_FILTERABLE_TYPES	((1 << MidiFilterControlChange) | (1 << MidiFilterProgramChange) | (1 << MidiFilterSysex))
+
+// Messages the device generates itself, each with its own destination set
+typedef enum
+{
+	MidiRouteClock,				// Clock, start and stop from the internal clock
+	NUM_MIDI_ROUTE_CLASSES
+} MidiRouteClass;
+
+typedef struct
+{
+	uint32_t compiles;
+	uint32_t linkChanges;
+	uint8_t linkMask;				// Interfaces currently able to send
+	uint8_t suspendMask;			// Sources whose thru is held off by the loop breaker
+	uint32_t filtered;			// Messages forwarded through a route filter
+	uint32_t filterDropped;		// Messages a route filter kept back
+	uint32_t filterRefused;		// Filters refused for letting through types a filtered route can't carry
+	uint16_t refusedRoutes;		// Bit source * NUM_MIDI_INTERFACES + destination, routes whose last filter was refused
+} MidiRoutingStats;
+
+// Per route filters, [source][destination]. Compiled into the route tables by midiRouting_Compile()
+extern MidiFilterSettings thruFilters[NUM_MIDI_INTERFACES][NUM_MIDI_INTERFACES];
+
+void midiRouting_Init();
+bool midiRouting_SetFilter(uint8_t source, uint8_t destination, const MidiFilterSettings* settings);
+void midiRouting_SaveFilters();
+void midiRouting_Compile();
+void midiRouting_PollLinks();
+void midiRouting_SuspendThru(uint8_t source, uint32_t durationMs);
+uint8_t midiRouting_GetThruMask(uint8_t source);
+uint8_t midiRouting_GetFilteredMask(uint8_t source, uint8_t status);
+void midiRouting_Forward(uint8_t source, uint8_t status, uint8_t data1, uint8_t data2);
+uint8_t midiRouting_GetClassMask(uint8_t routeClass);
+uint8_t midiRouting_GetLiveMask(uint8_t mask);
+void midiRouting_Send(uint8_t mask, midi::MidiType type, uint8_t channel, uint8_t data1, uint8_t data2);
+const MidiRoutingStats* midiRouting_GetStats();
+
+#endif // MIDI_ROUTING_H
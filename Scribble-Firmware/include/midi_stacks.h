@@ -0,0 +1,32 @@
+#ifndef MIDI_STACKS_H
+#define MIDI_STACKS_H
+
+#include "stdint.h"
+#include "main.h"
+#include "midi_output.h"
+
+// Message stacks of the current preset, each compiled into one byte buffer per interface
+typedef enum
+{
+	MidiStackSwitchPress,									// One per switch, global stack then preset stack
+	MidiStackSwitchHold = MidiStackSwitchPress + 2,	// One per switch, global stack then preset stack
+	MidiStackPreset = MidiStackSwitchHold + 2,		// PC bank output then the preset messages
+	MidiStackGlobalCustom,
+	MidiStackPresetCustom,
+	NUM_MIDI_STACKS
+} MidiStackId;
+
+typedef struct
+{
+	uint32_t compiles;
+	uint32_t sends;
+	uint8_t bytesPeak;			// Longest buffer compiled for any interface
+} MidiStacksStats;
+
+void midiStacks_Init();
+void midiStacks_Compile();
+void midiStacks_QueueCompile(bool sendPreset);
+void midiStacks_Send(uint8_t stack);
+const MidiStacksStats* midiStacks_GetStats();
+
+#endif // MIDI_STACKS_H
@@ -0,0 +1,35 @@
+#ifndef MIDI_SYSEX_H
+#define MIDI_SYSEX_H
+
+#include "stdint.h"
+
+// Device API frames arrive as F0 <manufacturer ID> <payload> F7
+#define SYSEX_MANUFACTURER_ID				{0x00, 0x21, 0x19}
+#define SYSEX_MANUFACTURER_ID_LENGTH		3
+
+// Frames are assembled into runs of adjacent blocks from one preallocated pool
+#define SYSEX_BLOCK_SIZE						512
+#define SYSEX_POOL_BLOCKS						16
+// Completed frames waiting for the Device API parser
+#define SYSEX_FRAME_QUEUE_LENGTH			4
+
+typedef struct
+{
+	uint32_t frames;				// Complete Device API frames handed to the parser
+	uint32_t bytes;
+	uint32_t foreign;				// SysEx for someone else
+	uint32_t dropped;				// No room in the pool or the frame queue
+	uint32_t abandoned;			// Frames cut short by a new F0
+	uint8_t blocksPeak;			// Most blocks in use at once
+	uint32_t streams;				// SysEx passed through filtered routes
+	uint32_t streamChunks;
+	uint32_t streamCutoffs;		// Destinations dropped from a stream for falling behind
+	uint32_t streamBytesPeak;	// Most RAM held by one stream: its pending chunk and what its destinations have queued
+} MidiSysexStats;
+
+void midiSysex_Init();
+void midiSysex_Receive(uint8_t interface, const uint8_t* data, unsigned length);
+void midiSysex_Process();
+const MidiSysexStats* midiSysex_GetStats();
+
+#endif // MIDI_SYSEX_H
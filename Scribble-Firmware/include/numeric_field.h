@@ -0,0 +1,47 @@
+#ifndef NUMERIC_FIELD_H
+#define NUMERIC_FIELD_H
+
+#include "Adafruit_GFX.h"
+
+// Longest string a field can show, e.g. "2000ms"
+#define NUMERIC_FIELD_MAX_CHARS		8
+
+typedef struct
+{
+	char c;
+	int16_t x;						// Cell left edge and width
+	int16_t w;
+	int16_t cursorX;				// Where the glyph is drawn from
+	int16_t inkX1;					// Pixels the glyph covers. Empty for blank glyphs
+	int16_t inkX2;
+	int16_t inkY1;
+	int16_t inkY2;
+} NumericCell;
+
+// A short text readout laid out in cells, with every digit in a cell of the
+// same width, so a new value only has to repaint the cells that changed
+typedef struct
+{
+	int16_t x;						// Area cleared when the whole field is repainted
+	int16_t y;
+	int16_t w;
+	int16_t h;
+	int16_t cursorX;				// Baseline start of the first cell
+	int16_t cursorY;
+	const GFXfont* font;
+	uint8_t digitAdvance;		// Widest digit in the font
+	uint8_t valid;					// Cleared when something else has drawn over the field
+	uint16_t colour;
+	uint16_t background;
+	uint8_t numCells;
+	NumericCell cells[NUMERIC_FIELD_MAX_CHARS];
+	uint32_t fullRepaints;
+	uint32_t cellRepaints;
+} NumericField;
+
+void numericField_Init(	NumericField* field, int16_t x, int16_t y, int16_t w, int16_t h,
+								int16_t cursorX, int16_t cursorY, const GFXfont* font);
+void numericField_Invalidate(NumericField* field);
+uint8_t numericField_Draw(NumericField* field, const char* text, uint16_t colour, uint16_t background);
+
+#endif // NUMERIC_FIELD_H
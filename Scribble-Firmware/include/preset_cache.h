@@ -0,0 +1,31 @@
+#ifndef PRESET_CACHE_H
+#define PRESET_CACHE_H
+
+#include "stdint.h"
+
+// The current preset and its neighbours either side
+#define PRESET_CACHE_SLOTS			3
+// Run-length entries per cached main area. Frames that need more are not cached
+#define PRESET_CACHE_RUNS			4096
+// Distinct colours per cached main area
+#define PRESET_CACHE_COLOURS		4
+
+typedef struct
+{
+	uint32_t hits;					// Preset switches served from the cache
+	uint32_t misses;				// Preset switches drawn from scratch
+	uint32_t renders;				// Frames rendered into the cache
+	uint32_t rejected;			// Frames too complex to cache or overhanging the main area
+	uint32_t invalidations;
+	uint32_t renderUsLast;
+	uint32_t renderUsMax;
+	uint16_t runsPeak;			// Most run entries used by a cached frame
+} PresetCacheStats;
+
+void presetCache_Init();
+void presetCache_Invalidate();
+bool presetCache_Blit(uint16_t presetIndex);
+bool presetCache_Work();
+const PresetCacheStats* presetCache_GetStats();
+
+#endif // PRESET_CACHE_H
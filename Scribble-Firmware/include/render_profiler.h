@@ -0,0 +1,57 @@
+#ifndef RENDER_PROFILER_H
+#define RENDER_PROFILER_H
+
+#include "stdint.h"
+
+// Instrumented display functions. Times are inclusive, so display_DrawMainScreen
+// also covers the indicator and text draws it makes
+typedef enum
+{
+	ProfileDrawMainScreen,
+	ProfileDrawPresetNumber,
+	ProfileDrawPresetText,
+	ProfileDrawMainText,
+	ProfileDrawBpm,
+	ProfileDrawBeatIndicator,
+	ProfileDrawMidiIndicator,
+	ProfileDrawWirelessIndicator,
+	ProfileFlush,
+	ProfileMarqueeStep,
+	NUM_PROFILE_POINTS
+} ProfilePoint;
+
+// What caused the draw. Set by the render task for each command it handles
+typedef enum
+{
+	ProfileCtxOther,				// Full redraws, settings screens and mixed batches
+	ProfileCtxPresetChange,
+	ProfileCtxClock,
+	ProfileCtxIndicator,
+	NUM_PROFILE_CONTEXTS
+} ProfileContext;
+
+typedef struct
+{
+	uint32_t calls;
+	uint32_t totalUs;
+	uint32_t maxUs;
+	uint32_t pixels;				// Pixels marked dirty, or pushed for ProfileFlush
+	uint32_t maxPixels;
+} ProfileEntry;
+
+typedef struct
+{
+	uint32_t startUs;
+	uint32_t startPixels;
+} ProfileMark;
+
+void renderProfiler_Reset();
+void renderProfiler_SetContext(uint8_t context);
+ProfileMark renderProfiler_Begin();
+void renderProfiler_End(uint8_t point, const ProfileMark* mark);
+void renderProfiler_Record(uint8_t point, uint32_t elapsedUs, uint32_t pixels);
+const ProfileEntry* renderProfiler_GetEntry(uint8_t context, uint8_t point);
+const char* renderProfiler_GetPointName(uint8_t point);
+const char* renderProfiler_GetContextName(uint8_t context);
+
+#endif // RENDER_PROFILER_H
@@ -0,0 +1,21 @@
+#ifndef SERIAL_MIDI_ENCODER_H
+#define SERIAL_MIDI_ENCODER_H
+
+#include "stdint.h"
+
+// Longest encoded short message
+#define SERIAL_MIDI_MAX_BYTES		3
+
+// Turns short MIDI messages into wire bytes for a 5-pin/TRS port. Like the BLE
+// packer it has no Arduino dependencies so it can be built on the host
+typedef struct
+{
+	uint8_t runningStatus;		// 0 when the next message must carry its status
+	uint32_t statusBytesSaved;
+} SerialMidiEncoder;
+
+void serialMidiEncoder_Reset(SerialMidiEncoder* encoder);
+uint8_t serialMidiEncoder_Encode(SerialMidiEncoder* encoder, uint8_t status, uint8_t data1, uint8_t data2,
+											bool useRunningStatus, uint8_t* bytes);
+
+#endif // SERIAL_MIDI_ENCODER_H
@@ -5,4 +5,10 @@
 #define INDICATOR_TASK_PRIORITY (tskIDLE_PRIORITY  + 30)
 #define MIDI_CLOCK_TASK_PRIORITY (tskIDLE_PRIORITY  + 15)
 #define DEVICE_API_TASK_PRIORITY (tskIDLE_PRIORITY  + 20)
+// Above the clock task so queued clock bytes leave as soon as they are produced
+#define MIDI_OUTPUT_TASK_PRIORITY (tskIDLE_PRIORITY  + 18)
+// Just below the output tasks, so a preset change's stacks are rebuilt as soon as the MIDI input that caused it returns
+#define MIDI_STACKS_TASK_PRIORITY (tskIDLE_PRIORITY  + 17)
+// Same level as the Arduino loop and uClock tasks so long SPI flushes time-slice with them
+#define DISPLAY_TASK_PRIORITY (tskIDLE_PRIORITY  + 1)
 #endif // TASK_PRIORITIES_H
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef TEXT_RENDER_H
+#define TEXT_RENDER_H
+
+#include "Adafruit_GFX.h"
+
+// Glyphs placed per call, enough for a preset name and secondary text
+#define TEXT_RENDER_MAX_GLYPHS		40
+
+// A string to draw, positioned the same way as Adafruit_GFX setCursor()/print()
+typedef struct
+{
+	const char* text;
+	const GFXfont* font;
+	int16_t cursorX;
+	int16_t cursorY;
+	uint16_t colour;
+} TextLine;
+
+// Receives one finished row of a region rendered by textRender_Rows()
+typedef void (*TextRowHandler)(int16_t row, const uint16_t* pixels, int16_t w, void* context);
+
+void textRender_Fill(	int16_t x, int16_t y, int16_t w, int16_t h, uint16_t background,
+							const TextLine* lines, uint8_t numLines);
+bool textRender_Rows(	int16_t x, int16_t y, int16_t w, int16_t h, uint16_t background,
+							const TextLine* lines, uint8_t numLines, TextRowHandler handler, void* context);
+void textRender_Strip(	int16_t x, int16_t y, int16_t w, int16_t h, uint16_t background,
+							const TextLine* lines, uint8_t numLines);
+
+#endif // TEXT_RENDER_H
@@ -236,6 +236,37 @@ void esp32Settings_SavePresets()
 	ESP_LOGI(SETTINGS_TAG, "Wrote %d bytes to presets file (expected %d).", len, presetSize*numPresets);
 }
 
+// Reads a settings file only if it is exactly the expected size
+// Returns false if it is missing or the size does not match, leaving the data untouched
+bool esp32Settings_ReadFile(const char* path, void* data, size_t size)
+{
+	if (!LittleFS.exists(path))
+	{
+		ESP_LOGI(SETTINGS_TAG, "%s not found.", path);
+		return false;
+	}
+
+	File settingsFile = LittleFS.open(path, "r");
+	size_t fileSize = settingsFile.size();
+	if (fileSize != size)
+	{
+		ESP_LOGI(SETTINGS_TAG, "%s size %d does not match (expected %d).", path, fileSize, size);
+		settingsFile.close();
+		return false;
+	}
+	settingsFile.read((uint8_t *)data, size);
+	settingsFile.close();
+	return true;
+}
+
+void esp32Settings_SaveFile(const char* path, const void* data, size_t size)
+{
+	ESP_LOGI(SETTINGS_TAG, "Saving %s.", path);
+	File settingsFile = LittleFS.open(path, "w");
+	size_t len = settingsFile.write((const uint8_t *)data, size);
+	settingsFile.close();
+	ESP_LOGI(SETTINGS_TAG, "Wrote %d bytes to %s (expected %d).", len, path, size);
+}
 
 void esp32Settings_ListDir(fs::FS &fs, const char *dirname, uint8_t levels)
 {
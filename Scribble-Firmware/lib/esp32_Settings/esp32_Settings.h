@@ -18,4 +18,8 @@ void esp32Settings_SaveGlobalSettings();
 void esp32Settings_ReadPresets();
 void esp32Settings_SavePresets();
 
+// Settings kept in a file of their own, outside the global settings size check
+bool esp32Settings_ReadFile(const char* path, void* data, size_t size);
+void esp32Settings_SaveFile(const char* path, const void* data, size_t size);
+
 #endif // ESP32_SETTINGS_H
\ No newline at end of file
@@ -0,0 +1,176 @@
+// Host-side checks for the BLE-MIDI packer (src/ble_midi_packer.cpp)
+// Builds packets the way the BLE sender task does and compares them byte for byte
+// against the BLE-MIDI packet format. Exits non-zero if anything differs
+//
+//	ble_midi_packer_test
+
+#include <stdio.h>
+#include <string.h>
+#include "ble_midi_packer.h"
+
+uint32_t failures = 0;
+
+// Compare a packet against the bytes expected, printing both on a mismatch
+static void expectPacket(const char* name, const BleMidiPacker* packer, const uint8_t* expected, uint16_t length)
+{
+	if(packer->length == length && memcmp(packer->buffer, expected, length) == 0)
+	{
+		printf("pass  %s\n", name);
+		return;
+	}
+
+	failures++;
+	printf("FAIL  %s\n      expected", name);
+	for(uint16_t i=0; i<length; i++)
+		printf(" %02x", expected[i]);
+	printf("\n      got     ");
+	for(uint16_t i=0; i<packer->length; i++)
+		printf(" %02x", packer->buffer[i]);
+	printf("\n");
+}
+
+static void expectTrue(const char* name, bool condition)
+{
+	if(condition)
+	{
+		printf("pass  %s\n", name);
+		return;
+	}
+	failures++;
+	printf("FAIL  %s\n", name);
+}
+
+// Header carries bits 7-12 of the time, each message's timestamp byte bits 0-6
+static void testHeader()
+{
+	BleMidiPacker packer;
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MIN);
+	bleMidiPacker_Add(&packer, 0x1234, 0x90, 60, 100);
+	const uint8_t expected[] = {0xA4, 0xB4, 0x90, 0x3C, 0x64};
+	expectPacket("header and timestamp bytes", &packer, expected, sizeof(expected));
+	expectTrue("header counts one message", packer.messages == 1);
+
+	// Data bytes are masked to 7 bits
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MIN);
+	bleMidiPacker_Add(&packer, 0, 0xC3, 0xFF, 0xFF);
+	const uint8_t masked[] = {0x80, 0x80, 0xC3, 0x7F};
+	expectPacket("one data byte for a PC, masked to 7 bits", &packer, masked, sizeof(masked));
+}
+
+// A realtime message between two CCs on the same channel leaves running status alone
+static void testRunningStatusAcrossRealtime()
+{
+	BleMidiPacker packer;
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MAX);
+	bleMidiPacker_Add(&packer, 1, 0xB0, 7, 1);
+	bleMidiPacker_Add(&packer, 2, 0xF8, 0, 0);
+	bleMidiPacker_Add(&packer, 3, 0xB0, 7, 2);
+	bleMidiPacker_Add(&packer, 4, 0xB1, 7, 3);
+	const uint8_t expected[] = {0x80, 0x81, 0xB0, 0x07, 0x01,
+											0x82, 0xF8,
+											0x83, 0x07, 0x02,
+											0x84, 0xB1, 0x07, 0x03};
+	expectPacket("running status across interleaved realtime", &packer, expected, sizeof(expected));
+}
+
+// System common messages cancel running status, the next channel message carries its status
+static void testSystemCommonCancels()
+{
+	BleMidiPacker packer;
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MAX);
+	bleMidiPacker_Add(&packer, 0, 0xB0, 1, 1);
+	bleMidiPacker_Add(&packer, 0, 0xF2, 0x10, 0x20);
+	bleMidiPacker_Add(&packer, 0, 0xB0, 1, 2);
+	bleMidiPacker_Add(&packer, 0, 0xF6, 0, 0);
+	bleMidiPacker_Add(&packer, 0, 0xB0, 1, 3);
+	const uint8_t expected[] = {0x80, 0x80, 0xB0, 0x01, 0x01,
+											0x80, 0xF2, 0x10, 0x20,
+											0x80, 0xB0, 0x01, 0x02,
+											0x80, 0xF6,
+											0x80, 0xB0, 0x01, 0x03};
+	expectPacket("system common cancels running status", &packer, expected, sizeof(expected));
+}
+
+// A SysEx split across packets: the second packet carries on straight after its header,
+// F0 and F7 each get a timestamp byte, and running status is gone afterwards
+static void testSysexContinuation()
+{
+	BleMidiPacker packer;
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MIN);
+	bleMidiPacker_Add(&packer, 5, 0xB0, 1, 1);
+	const uint8_t start[] = {0xF0, 0x7D, 0x01};
+	expectTrue("SysEx start fits", bleMidiPacker_AddSysex(&packer, 5, start, sizeof(start)));
+	const uint8_t first[] = {0x80, 0x85, 0xB0, 0x01, 0x01, 0x85, 0xF0, 0x7D, 0x01};
+	expectPacket("SysEx start packet", &packer, first, sizeof(first));
+
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MIN);
+	const uint8_t end[] = {0x02, 0x03, 0xF7};
+	expectTrue("SysEx end fits", bleMidiPacker_AddSysex(&packer, 0x86, end, sizeof(end)));
+	bleMidiPacker_Add(&packer, 0x86, 0xB0, 1, 2);
+	const uint8_t second[] = {0x81, 0x02, 0x03, 0x86, 0xF7, 0x86, 0xB0, 0x01, 0x02};
+	expectPacket("SysEx continuation packet", &packer, second, sizeof(second));
+}
+
+// The timestamp is 13 bits. Crossing 0x1FFF wraps the header to zero, and inside one
+// packet the low byte drops below the previous one, which is how a receiver sees the rollover
+static void testTimestampRollover()
+{
+	BleMidiPacker packer;
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MIN);
+	bleMidiPacker_Add(&packer, 0x1FFF, 0xF8, 0, 0);
+	bleMidiPacker_Add(&packer, 0x2000, 0xF8, 0, 0);
+	const uint8_t sameHeader[] = {0xBF, 0xFF, 0xF8, 0x80, 0xF8};
+	expectPacket("rollover inside a packet", &packer, sameHeader, sizeof(sameHeader));
+
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MIN);
+	bleMidiPacker_Add(&packer, 0x2001, 0xF8, 0, 0);
+	const uint8_t wrapped[] = {0x80, 0x81, 0xF8};
+	expectPacket("header wraps after 13 bits", &packer, wrapped, sizeof(wrapped));
+}
+
+// A message or SysEx that does not fit is refused and the packet is left as it was
+static void testLimit()
+{
+	BleMidiPacker packer;
+	bleMidiPacker_Begin(&packer, 1);
+	expectTrue("limit raised to the minimum payload", packer.limit == BLE_MIDI_PACKET_MIN);
+	bleMidiPacker_Begin(&packer, 1000);
+	expectTrue("limit capped at the maximum payload", packer.limit == BLE_MIDI_PACKET_MAX);
+
+	// The first note takes 5 bytes, each running status note after it 3
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MIN);
+	uint8_t added = 0;
+	while(bleMidiPacker_Add(&packer, 0, 0x90, added, 100))
+		added++;
+	expectTrue("exactly six notes fill a 20 byte packet", added == 6 && packer.length == 20 && packer.messages == 6);
+
+	uint8_t before[BLE_MIDI_PACKET_MAX];
+	memcpy(before, packer.buffer, packer.length);
+	uint16_t length = packer.length;
+	const uint8_t sysex[] = {0xF0, 0x01, 0xF7};
+	expectTrue("SysEx refused when full", !bleMidiPacker_AddSysex(&packer, 0, sysex, sizeof(sysex)));
+	expectTrue("refused messages leave the packet untouched",
+					packer.length == length && packer.messages == 6 && memcmp(before, packer.buffer, length) == 0);
+
+	// A status byte has to come back when running status cannot be used, so one byte short is too short
+	bleMidiPacker_Begin(&packer, BLE_MIDI_PACKET_MIN);
+	for(uint8_t i=0; i<5; i++)
+		bleMidiPacker_Add(&packer, 0, 0x90, i, 100);
+	expectTrue("17 bytes used before the overflow check", packer.length == 17);
+	expectTrue("new status does not fit in 3 bytes", !bleMidiPacker_Add(&packer, 0, 0x80, 1, 0));
+	expectTrue("running status does fit in 3 bytes", bleMidiPacker_Add(&packer, 0, 0x90, 1, 0));
+}
+
+int main()
+{
+	testHeader();
+	testRunningStatusAcrossRealtime();
+	testSystemCommonCancels();
+	testSysexContinuation();
+	testTimestampRollover();
+	testLimit();
+
+	if(failures)
+		printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+}
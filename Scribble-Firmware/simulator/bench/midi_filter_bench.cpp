@@ -0,0 +1,129 @@
+// Host-side benchmark for the thru route filters
+// Times the compiled filter (src/midi_filter.cpp) against evaluating the same settings
+// message by message, and checks the two agree on every status byte
+//
+//	midi_filter_bench [--messages <count>]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "midi_filter.h"
+
+#define DEFAULT_MESSAGES	10000000
+
+typedef struct
+{
+	const char* name;
+	uint16_t types;
+	uint16_t channels;
+	int8_t remapOffset;		// Every channel moved up by this many, 0 for no remap
+} BenchFilter;
+
+static const BenchFilter benchFilters[] = {
+	{"pass_all",		MIDI_FILTER_ALL_TYPES, MIDI_FILTER_ALL_CHANNELS, 0},
+	{"pc_only",			(1 << MidiFilterProgramChange), MIDI_FILTER_ALL_CHANNELS, 0},
+	{"no_clock",		MIDI_FILTER_ALL_TYPES & ~((1 << MidiFilterClock) | (1 << MidiFilterTransport)), MIDI_FILTER_ALL_CHANNELS, 0},
+	{"ch1_4_remap",	MIDI_FILTER_ALL_TYPES, 0x000F, 4},
+};
+
+// The settings evaluated directly, as the forwarding path would without compiling them
+static bool evaluateSettings(const MidiFilterSettings* settings, uint8_t* status)
+{
+	uint8_t type = midiFilter_TypeOf(*status);
+	if(type == NUM_MIDI_FILTER_TYPES || ((settings->types >> type) & 1) == 0)
+		return false;
+	if(*status < 0xF0)
+	{
+		uint8_t channel = *status & 0x0F;
+		if(((settings->channels >> channel) & 1) == 0)
+			return false;
+		*status = (*status & 0xF0) | (settings->remap[channel] & 0x0F);
+	}
+	return true;
+}
+
+// A status byte stream weighted like busy thru traffic: mostly clock, CC and notes
+static void fillTraffic(uint8_t* statuses, uint32_t count)
+{
+	static const uint8_t mix[] = {0xF8, 0xF8, 0xF8, 0xB0, 0xB0, 0xB1, 0x90, 0x80, 0x91, 0x81, 0xC0, 0xE0, 0xD2, 0xFE, 0xF0, 0xFA};
+	srand(1);
+	for(uint32_t i=0; i<count; i++)
+	{
+		uint8_t status = mix[rand() % sizeof(mix)];
+		if(status < 0xF0)
+			status = (status & 0xF0) | (rand() & 0x0F);
+		statuses[i] = status;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t messages = DEFAULT_MESSAGES;
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "--messages") == 0 && i + 1 < argc)
+			messages = strtoul(argv[++i], NULL, 10);
+	}
+
+	uint8_t* statuses = (uint8_t*)malloc(messages);
+	fillTraffic(statuses, messages);
+
+	uint32_t mismatches = 0;
+	printf("%-12s %10s %10s %10s %12s\n", "filter", "passed", "ns/msg", "direct", "bytes");
+	for(const BenchFilter& bench : benchFilters)
+	{
+		MidiFilterSettings settings;
+		midiFilter_Default(&settings);
+		settings.types = bench.types;
+		settings.channels = bench.channels;
+		for(uint8_t i=0; i<16; i++)
+			settings.remap[i] = (i + bench.remapOffset) & 0x0F;
+		MidiFilter filter;
+		midiFilter_Compile(&filter, &settings);
+
+		for(uint16_t status=0; status<=0xFF; status++)
+		{
+			uint8_t compiled = status;
+			uint8_t direct = status;
+			bool compiledPass = midiFilter_Apply(&filter, &compiled);
+			bool directPass = evaluateSettings(&settings, &direct);
+			if(compiledPass != directPass || (compiledPass && compiled != direct))
+			{
+				printf("%s: status 0x%02x differs\n", bench.name, status);
+				mismatches++;
+			}
+		}
+
+		// Sum the results so neither loop can be optimised away
+		volatile uint32_t sink = 0;
+		uint32_t passed = 0;
+		auto start = std::chrono::steady_clock::now();
+		for(uint32_t i=0; i<messages; i++)
+		{
+			uint8_t status = statuses[i];
+			if(midiFilter_Apply(&filter, &status))
+			{
+				passed++;
+				sink += status;
+			}
+		}
+		auto compiledEnd = std::chrono::steady_clock::now();
+		for(uint32_t i=0; i<messages; i++)
+		{
+			uint8_t status = statuses[i];
+			if(evaluateSettings(&settings, &status))
+				sink += status;
+		}
+		auto directEnd = std::chrono::steady_clock::now();
+
+		double compiledNs = std::chrono::duration<double, std::nano>(compiledEnd - start).count() / messages;
+		double directNs = std::chrono::duration<double, std::nano>(directEnd - compiledEnd).count() / messages;
+		printf("%-12s %10u %10.2f %10.2f %12u\n", bench.name, passed, compiledNs, directNs, (unsigned)sizeof(MidiFilter));
+	}
+
+	free(statuses);
+	if(mismatches)
+		printf("%u mismatches\n", mismatches);
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#ifndef SIM_ADAFRUIT_ST7789_H
+#define SIM_ADAFRUIT_ST7789_H
+
+// Virtual ST7789 for the display simulator
+// Keeps its own RGB565 copy of the panel and counts the SPI traffic the real
+// Adafruit_SPITFT driver would generate for each call, so draw paths can be
+// compared on the host. Only the parts of the driver the firmware uses exist here
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "Adafruit_GFX.h"
+
+#define ST77XX_BLACK		0x0000
+#define ST77XX_WHITE		0xFFFF
+#define ST77XX_RED		0xF800
+#define ST77XX_GREEN		0x07E0
+#define ST77XX_BLUE		0x001F
+#define ST77XX_CYAN		0x07FF
+#define ST77XX_MAGENTA	0xF81F
+#define ST77XX_YELLOW	0xFFE0
+#define ST77XX_ORANGE	0xFC00
+
+// Bytes on the wire to open an address window: CASET + 4, RASET + 4, RAMWR
+#define SIM_ADDR_WINDOW_BYTES		11
+
+typedef struct
+{
+	uint32_t transactions;		// startWrite/endWrite pairs (CS low periods)
+	uint32_t commands;			// Command bytes sent with DC low
+	uint32_t addrWindows;		// CASET/RASET/RAMWR sequences
+	uint64_t pixels;				// Pixels written to panel RAM
+	uint64_t bytes;				// Every byte clocked out, commands included
+} VirtualPanelStats;
+
+class Adafruit_SPITFT : public Adafruit_GFX
+{
+public:
+	Adafruit_SPITFT(uint16_t w, uint16_t h);
+	~Adafruit_SPITFT();
+
+	void startWrite(void) override;
+	void endWrite(void) override;
+	virtual void setAddrWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+	void writePixels(uint16_t* colors, uint32_t len, bool block = true, bool bigEndian = false);
+	void writeColor(uint16_t color, uint32_t len);
+
+	void writePixel(int16_t x, int16_t y, uint16_t color) override;
+	void writeFillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override;
+	void writeFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) override;
+	void writeFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) override;
+	void drawPixel(int16_t x, int16_t y, uint16_t color) override;
+	void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override;
+	void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) override;
+	void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) override;
+	void fillScreen(uint16_t color) override;
+	uint16_t color565(uint8_t r, uint8_t g, uint8_t b);
+
+	// Simulator only
+	const VirtualPanelStats* getStats() const;
+	void resetStats();
+	const uint16_t* getPanel() const;
+	bool savePpm(const char* path) const;
+
+protected:
+	void sendCommand(uint8_t count, uint32_t dataBytes);
+	void allocatePanel();
+
+	uint16_t* panel;
+	uint16_t windowX, windowY, windowW, windowH;
+	uint32_t windowCursor;
+	bool inTransaction;
+	VirtualPanelStats stats;
+};
+
+class Adafruit_ST77xx : public Adafruit_SPITFT
+{
+public:
+	Adafruit_ST77xx(uint16_t w, uint16_t h, int8_t cs, int8_t dc, int8_t rst);
+	void setRotation(uint8_t r) override;
+	void enableDisplay(bool enable);
+	void invertDisplay(bool i) override;
+};
+
+class Adafruit_ST7789 : public Adafruit_ST77xx
+{
+public:
+	Adafruit_ST7789(int8_t cs, int8_t dc, int8_t rst);
+	void init(uint16_t width = 240, uint16_t height = 240, uint8_t spiMode = SPI_MODE0);
+};
+
+#endif // SIM_ADAFRUIT_ST7789_H
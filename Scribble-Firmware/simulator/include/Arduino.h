@@ -0,0 +1,41 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// Minimal host stand-in for the Arduino core, enough to build the display code on Linux
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "Print.h"
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define pgm_read_byte(addr)		(*(const uint8_t*)(addr))
+#define pgm_read_word(addr)		(*(const uint16_t*)(addr))
+#define pgm_read_dword(addr)		(*(const uint32_t*)(addr))
+#define pgm_read_pointer(addr)	((void*)*(void* const*)(addr))
+
+#define HIGH				1
+#define LOW					0
+#define INPUT				0
+#define OUTPUT				1
+#define INPUT_PULLUP		2
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+void analogWrite(uint8_t pin, int value);
+
+#include "esp_log.h"
+
+#endif // SIM_ARDUINO_H
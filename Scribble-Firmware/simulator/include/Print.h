@@ -0,0 +1,41 @@
+#ifndef SIM_PRINT_H
+#define SIM_PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t* buffer, size_t size)
+	{
+		size_t n = 0;
+		while(size--)
+			n += write(*buffer++);
+		return n;
+	}
+	size_t write(const char* str)
+	{
+		return str == NULL ? 0 : write((const uint8_t*)str, strlen(str));
+	}
+	size_t print(const char* str)
+	{
+		return write(str);
+	}
+	size_t print(char c)
+	{
+		return write((uint8_t)c);
+	}
+	size_t print(int value)
+	{
+		char buffer[12];
+		snprintf(buffer, sizeof(buffer), "%d", value);
+		return write(buffer);
+	}
+};
+
+#endif // SIM_PRINT_H
@@ -0,0 +1,17 @@
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+#include <stdint.h>
+
+#define SPI_MODE0		0
+
+class SPIClass
+{
+public:
+	void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+	void end() {}
+};
+
+extern SPIClass SPI;
+
+#endif // SIM_SPI_H
@@ -0,0 +1,38 @@
+#ifndef SIM_ESP32_MANAGER_H
+#define SIM_ESP32_MANAGER_H
+
+// Just the types the display code reads from the ESP32 manager
+
+#include "stdint.h"
+
+typedef enum
+{
+	Esp32None,
+	Esp32BLE,
+	Esp32WiFi
+} Esp32WirelessType;
+
+typedef enum
+{
+	Esp32BLEServer,
+	Esp32BLEClient
+} Esp32BLEMode;
+
+typedef struct
+{
+	uint8_t wirelessType;
+	uint8_t bleMode;
+	uint8_t useStaticIp;
+	uint8_t staticIp[4];
+	uint8_t staticGatewayIp[4];
+} Esp32ManagerConfig;
+
+typedef struct
+{
+	uint8_t wifiConnected;
+	uint8_t bleConnected;
+} Esp32Info;
+
+extern Esp32Info esp32Info;
+
+#endif // SIM_ESP32_MANAGER_H
@@ -0,0 +1,13 @@
+#ifndef SIM_ESP_LOG_H
+#define SIM_ESP_LOG_H
+
+#include <stdio.h>
+
+// Errors, warnings and info go to stderr. Debug and verbose output is dropped
+#define ESP_LOGE(tag, format, ...)	fprintf(stderr, "E [%s] " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)	fprintf(stderr, "W [%s] " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)	fprintf(stderr, "I [%s] " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)	((void)(tag))
+#define ESP_LOGV(tag, format, ...)	((void)(tag))
+
+#endif // SIM_ESP_LOG_H
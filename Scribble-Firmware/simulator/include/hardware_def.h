@@ -0,0 +1 @@
+#include "hardware_Def.h"
@@ -0,0 +1,18 @@
+#ifndef SIM_MIDI_HANDLING_H
+#define SIM_MIDI_HANDLING_H
+
+// Just the types main.h needs from the MIDI handling library
+
+#include "Arduino.h"
+
+#define MIDI_CHANNEL_OMNI		0
+
+typedef enum
+{
+	MidiUSBD,
+	MidiBLE,
+	MidiSerial1,
+	MidiWiFiRTP
+} MidiInterfaceType;
+
+#endif // SIM_MIDI_HANDLING_H
@@ -0,0 +1,545 @@
+// Host-side display simulator
+// Runs the real display and framebuffer code against a virtual ST7789 and
+// reports the SPI traffic each UI update generates. Frames can be dumped
+// as PPM images and compared against a reference set to catch rendering changes
+//
+//	display_sim [--dump <dir>] [--compare <dir>] [--spi-hz <hz>]
+
+#include <chrono>
+#include "Arduino.h"
+#include "Adafruit_ST7789.h"
+#include "display.h"
+#include "framebuffer.h"
+#include "preset_cache.h"
+#include "marquee.h"
+#include "main.h"
+
+static const char* SIM_TAG = "SIM";
+
+#define DEFAULT_SPI_HZ		40000000
+#define TEXT_BENCH_PASSES	20
+#define INDICATOR_BENCH_PASSES	2000
+
+// Firmware globals the display code reads
+GlobalSettings globalSettings;
+Preset presets[NUM_PRESETS];
+Esp32Info esp32Info;
+float currentBpm = 120.0;
+int8_t bleRssi = 0;
+
+extern Adafruit_ST7789 lcd;
+extern TextLayout layoutCache[NUM_LAYOUT_FONTS][NUM_PRESETS];
+
+typedef struct
+{
+	const char* name;
+	void (*setup)();
+	void (*step)(uint32_t index);
+	uint32_t steps;
+} SimScenario;
+
+const char* dumpDir = NULL;
+const char* compareDir = NULL;
+uint32_t spiHz = DEFAULT_SPI_HZ;
+uint32_t mismatches = 0;
+
+static std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+	return micros() / 1000;
+}
+
+unsigned long micros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(uint32_t ms) {}
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {}
+void analogWrite(uint8_t pin, int value) {}
+
+//----------------------------------------------------------------------------//
+//	Settings
+//----------------------------------------------------------------------------//
+
+// Same values as the firmware's factory defaults
+static void defaultSettings()
+{
+	memset(&globalSettings, 0, sizeof(GlobalSettings));
+	globalSettings.uiLightMode = UI_MODE_DARK;
+	globalSettings.mainColour = GEN_LOSS_BLUE;
+	globalSettings.textColour = ST77XX_BLACK;
+	globalSettings.displayBrightness = DEFAULT_DISPLAY_BRIGHTNESS;
+	globalSettings.globalBpm = 120.0;
+	globalSettings.clockDisplayType = MIDI_CLOCK_DISPLAY_BPM;
+	globalSettings.esp32ManagerConfig.wirelessType = Esp32BLE;
+
+	for(int i=0; i<NUM_PRESETS; i++)
+	{
+		memset(&presets[i], 0, sizeof(Preset));
+		sprintf(presets[i].name, "Preset %d", i + 1);
+		sprintf(presets[i].secondaryText, "Secondary %d", i + 1);
+		presets[i].bpm = 40.0 + i;
+	}
+	esp32Info.bleConnected = 1;
+}
+
+static void setLightMode(uint8_t mode)
+{
+	globalSettings.uiLightMode = mode;
+	presetCache_Invalidate();
+	display_SetBpmDrawColour(mode == UI_MODE_DARK ? ST77XX_WHITE : ST77XX_BLACK);
+}
+
+//----------------------------------------------------------------------------//
+//	Scenarios
+//	Each step mirrors one display task command followed by its flush
+//----------------------------------------------------------------------------//
+
+static void bootSetup()
+{
+	defaultSettings();
+}
+
+static void bootStep(uint32_t index)
+{
+	display_BuildLayoutCache();
+	display_Init();
+}
+
+static void presetSwitchStep(uint32_t index)
+{
+	globalSettings.currentPreset = index % NUM_PRESETS;
+	display_DrawPresetNumber(globalSettings.currentPreset);
+	display_DrawPresetText(globalSettings.currentPreset);
+	display_Flush();
+}
+
+static void bpmSetup()
+{
+	globalSettings.clockDisplayType = MIDI_CLOCK_DISPLAY_BPM;
+}
+
+static void bpmStep(uint32_t index)
+{
+	display_DrawBpm(60.0 + index * 0.5);
+	display_Flush();
+}
+
+// An external clock settling around 120 BPM
+static void bpmJitterStep(uint32_t index)
+{
+	static const float sequence[] = {119.9, 120.0, 120.1, 120.0};
+	display_DrawBpm(sequence[index % 4]);
+	display_Flush();
+}
+
+static void msSetup()
+{
+	globalSettings.clockDisplayType = MIDI_CLOCK_DISPLAY_MS;
+}
+
+static void midiIndicatorStep(uint32_t index)
+{
+	display_DrawMidiIndicator(!(index & 1));
+	display_Flush();
+}
+
+static void wirelessIndicatorStep(uint32_t index)
+{
+	display_DrawWirelessIndicator(Esp32BLE, index & 1);
+	display_Flush();
+}
+
+static void beatSetup()
+{
+	globalSettings.clockDisplayType = MIDI_CLOCK_DISPLAY_INDICATOR;
+	display_DrawBpm(currentBpm);
+	display_Flush();
+}
+
+// Downbeat, off, quarter, off, as the sync24 callback queues them
+static void beatStep(uint32_t index)
+{
+	static const uint8_t sequence[] = {BeatDownbeat, BeatOff, BeatQuarter, BeatOff};
+	display_DrawBeatIndicator(sequence[index % sizeof(sequence)]);
+	display_Flush();
+}
+
+static void lightModeSetup()
+{
+	setLightMode(UI_MODE_LIGHT);
+}
+
+static void darkModeSetup()
+{
+	setLightMode(UI_MODE_DARK);
+}
+
+static void mainScreenStep(uint32_t index)
+{
+	display_DrawMainScreen();
+	display_Flush();
+}
+
+// A name too wide for the panel, scrolled one step per frame
+static void marqueeSetup()
+{
+	strcpy(presets[0].name, "Shimmer Ambience");
+	display_UpdateLayoutCache(0);
+	presetCache_Invalidate();
+	globalSettings.currentPreset = 0;
+	display_DrawPresetText(0);
+	display_Flush();
+}
+
+static void marqueeStep(uint32_t index)
+{
+	// Every call is due, including the ones after a hold
+	marquee_Step(millis() + (index + 1) * MARQUEE_HOLD_MS);
+	display_Flush();
+}
+
+static const SimScenario scenarios[] =
+{
+	{"boot",					bootSetup,			bootStep,					1},
+	{"preset_switch",		NULL,					presetSwitchStep,			NUM_PRESETS},
+	{"bpm_update",			bpmSetup,			bpmStep,						281},
+	{"bpm_jitter",			bpmSetup,			bpmJitterStep,				100},
+	{"ms_update",			msSetup,				bpmStep,						281},
+	{"midi_indicator",	NULL,					midiIndicatorStep,		100},
+	{"ble_indicator",		NULL,					wirelessIndicatorStep,	100},
+	{"light_mode",			lightModeSetup,	mainScreenStep,			1},
+	{"light_preset",		NULL,					presetSwitchStep,			NUM_PRESETS},
+	{"dark_mode",			darkModeSetup,		mainScreenStep,			1},
+	{"beat_indicator",	beatSetup,			beatStep,					96},
+	{"marquee",				marqueeSetup,		marqueeStep,				240},
+};
+
+#define NUM_SCENARIOS		(sizeof(scenarios) / sizeof(SimScenario))
+
+//----------------------------------------------------------------------------//
+//	Frame capture
+//----------------------------------------------------------------------------//
+
+static void dumpFrame(const char* name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s.ppm", dumpDir, name);
+	if(!lcd.savePpm(path))
+		ESP_LOGE(SIM_TAG, "Failed to write %s", path);
+}
+
+// Compare the panel against a reference frame written by an earlier --dump run
+static void compareFrame(const char* name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s.ppm", compareDir, name);
+	FILE* file = fopen(path, "rb");
+	if(file == NULL)
+	{
+		ESP_LOGW(SIM_TAG, "No reference frame %s", path);
+		return;
+	}
+
+	int w, h, maxValue;
+	if(fscanf(file, "P6 %d %d %d", &w, &h, &maxValue) != 3 || fgetc(file) == EOF
+		|| w != lcd.width() || h != lcd.height())
+	{
+		ESP_LOGE(SIM_TAG, "%s: unexpected reference format", name);
+		fclose(file);
+		mismatches++;
+		return;
+	}
+
+	// Re-encode the panel the same way savePpm() does
+	const uint16_t* panel = lcd.getPanel();
+	uint32_t differing = 0;
+	int32_t firstX = -1, firstY = -1;
+	for(int32_t i=0; i<w*h; i++)
+	{
+		uint8_t ref[3];
+		if(fread(ref, 1, 3, file) != 3)
+		{
+			differing += w*h - i;
+			break;
+		}
+		uint16_t c = panel[i];
+		if(ref[0] != ((c >> 11) & 0x1F) * 255 / 31 || ref[1] != ((c >> 5) & 0x3F) * 255 / 63
+			|| ref[2] != (c & 0x1F) * 255 / 31)
+		{
+			if(differing++ == 0)
+			{
+				firstX = i % w;
+				firstY = i / w;
+			}
+		}
+	}
+	fclose(file);
+
+	if(differing)
+	{
+		ESP_LOGE(SIM_TAG, "%s: %d pixels differ from reference, first at (%d, %d)", name, differing, firstX, firstY);
+		mismatches++;
+	}
+}
+
+//----------------------------------------------------------------------------//
+//	Text rendering
+//	Compares the span renderer against Adafruit_GFX print() on every preset
+//----------------------------------------------------------------------------//
+
+// The main text path as it was drawn before the span renderer
+static void drawPresetTextGfx(uint16_t presetIndex)
+{
+	framebuffer.fillRect(0, LCD_HEIGHT-MAIN_FILL_HEIGHT, LCD_WIDTH, MAIN_FILL_HEIGHT, globalSettings.mainColour);
+	framebuffer.setTextColor(globalSettings.textColour);
+	framebuffer.setFont(&PRESET_NAME_FONT);
+	framebuffer.setCursor(layoutCache[LayoutPresetName][presetIndex].cursorX, layoutCache[LayoutPresetName][presetIndex].cursorY);
+	framebuffer.print(presets[presetIndex].name);
+	framebuffer.setFont(&SECONDARY_TEXT_FONT);
+	framebuffer.setCursor(layoutCache[LayoutSecondaryText][presetIndex].cursorX, layoutCache[LayoutSecondaryText][presetIndex].cursorY);
+	framebuffer.print(presets[presetIndex].secondaryText);
+}
+
+static void runTextBenchmark()
+{
+	// Scenarios leave their settings and preset names behind
+	defaultSettings();
+	display_BuildLayoutCache();
+	presetCache_Invalidate();
+
+	static uint16_t reference[LCD_WIDTH * MAIN_FILL_HEIGHT];
+	uint16_t* mainArea = &framebuffer.getBuffer()[(LCD_HEIGHT-MAIN_FILL_HEIGHT) * LCD_WIDTH];
+	uint32_t differing = 0;
+
+	unsigned long gfxUs = 0;
+	unsigned long spanUs = 0;
+	unsigned long blitUs = 0;
+	for(uint16_t i=0; i<NUM_PRESETS; i++)
+	{
+		unsigned long start = micros();
+		for(uint8_t pass=0; pass<TEXT_BENCH_PASSES; pass++)
+			drawPresetTextGfx(i);
+		gfxUs += micros() - start;
+		memcpy(reference, mainArea, sizeof(reference));
+
+		// Stale frames keep display_DrawPresetText() on the renderer
+		presetCache_Invalidate();
+		start = micros();
+		for(uint8_t pass=0; pass<TEXT_BENCH_PASSES; pass++)
+			display_DrawPresetText(i);
+		spanUs += micros() - start;
+		if(memcmp(reference, mainArea, sizeof(reference)) != 0)
+		{
+			ESP_LOGE(SIM_TAG, "Preset %d: span text differs from print()", i + 1);
+			differing++;
+		}
+
+		while(presetCache_Work());
+		memset(mainArea, 0, sizeof(reference));
+		start = micros();
+		for(uint8_t pass=0; pass<TEXT_BENCH_PASSES; pass++)
+			display_DrawPresetText(i);
+		blitUs += micros() - start;
+		if(memcmp(reference, mainArea, sizeof(reference)) != 0)
+		{
+			ESP_LOGE(SIM_TAG, "Preset %d: cached frame differs from print()", i + 1);
+			differing++;
+		}
+	}
+	// Nothing here is meant for the panel
+	framebuffer_MarkAllDirty();
+	display_Flush();
+
+	double presetsDrawn = NUM_PRESETS * TEXT_BENCH_PASSES;
+	printf("\nMain text, %d presets x %d passes\n", NUM_PRESETS, TEXT_BENCH_PASSES);
+	printf("%-16s %10.2f us/preset\n", "gfx print", gfxUs / presetsDrawn);
+	printf("%-16s %10.2f us/preset\n", "span render", spanUs / presetsDrawn);
+	printf("%-16s %10.2f us/preset\n", "cache blit", blitUs / presetsDrawn);
+	printf("%d mismatch(es) against print()\n", differing);
+	mismatches += differing;
+
+	const PresetCacheStats* cache = presetCache_GetStats();
+	printf("\nPreset cache: %d hits, %d misses, %d renders, %d rejected, %d runs peak (%d bytes)\n",
+			cache->hits, cache->misses, cache->renders, cache->rejected,
+			cache->runsPeak, cache->runsPeak * 2);
+}
+
+//----------------------------------------------------------------------------//
+//	Indicators
+//	Compares the indicator sprites against the circles they replaced
+//----------------------------------------------------------------------------//
+
+typedef struct
+{
+	bool midi;
+	uint8_t type;
+	uint8_t state;
+} IndicatorCase;
+
+static const IndicatorCase indicatorCases[] =
+{
+	{true, 0, 0}, {true, 0, 1},
+	{false, Esp32BLE, 0}, {false, Esp32BLE, 1},
+	{false, Esp32WiFi, 0}, {false, Esp32WiFi, 1}, {false, Esp32WiFi, 3},
+	{false, Esp32None, 0}, {false, Esp32None, 1}
+};
+
+#define NUM_INDICATOR_CASES		(sizeof(indicatorCases) / sizeof(IndicatorCase))
+
+// The indicator path as it was drawn before the sprites
+static void drawIndicatorGfx(const IndicatorCase* test)
+{
+	int16_t x = test->midi ? MIDI_INDICATOR_X : WIRELESS_INDICATOR_X;
+	uint16_t colour = ST77XX_WHITE;
+	if(test->midi)
+		colour = MIDI_INDICATOR_COLOUR;
+	else if(test->type == Esp32BLE)
+		colour = BLE_INDICATOR_COLOUR;
+	else if(test->type == Esp32WiFi)
+		colour = WIFI_INDICATOR_COLOUR;
+
+	if(test->state == 1)
+	{
+		framebuffer.fillCircle(x, INDICATOR_Y, CIRCLE_INDICATOR_SIZE, colour);
+		return;
+	}
+	uint16_t background = globalSettings.uiLightMode == UI_MODE_DARK ? ST77XX_BLACK : ST77XX_WHITE;
+	framebuffer.fillCircle(x, INDICATOR_Y, CIRCLE_INDICATOR_SIZE, background);
+	framebuffer.drawCircle(x, INDICATOR_Y, CIRCLE_INDICATOR_SIZE, colour);
+	if(test->state == 3)
+		framebuffer.fillCircle(x, INDICATOR_Y, CIRCLE_INDICATOR_SIZE/2, colour);
+}
+
+static void drawIndicatorSprite(const IndicatorCase* test)
+{
+	if(test->midi)
+		display_DrawMidiIndicator(test->state);
+	else
+		display_DrawWirelessIndicator(test->type, test->state);
+}
+
+static void runIndicatorBenchmark()
+{
+	static const uint8_t modes[] = {UI_MODE_LIGHT, UI_MODE_DARK};
+	uint16_t* buffer = framebuffer.getBuffer();
+	static uint16_t reference[LCD_WIDTH * LCD_HEIGHT];
+	uint32_t differing = 0;
+
+	unsigned long gfxUs = 0;
+	unsigned long spriteUs = 0;
+	for(uint8_t m=0; m<sizeof(modes); m++)
+	{
+		globalSettings.uiLightMode = modes[m];
+		for(uint8_t i=0; i<NUM_INDICATOR_CASES; i++)
+		{
+			// The info bar as the main screen leaves it
+			framebuffer.fillRect(0, 0, LCD_WIDTH, INFO_BAR_HEIGHT, modes[m] == UI_MODE_DARK ? ST77XX_BLACK : ST77XX_WHITE);
+			unsigned long start = micros();
+			for(uint16_t pass=0; pass<INDICATOR_BENCH_PASSES; pass++)
+				drawIndicatorGfx(&indicatorCases[i]);
+			gfxUs += micros() - start;
+			memcpy(reference, buffer, sizeof(reference));
+
+			framebuffer.fillRect(0, 0, LCD_WIDTH, INFO_BAR_HEIGHT, modes[m] == UI_MODE_DARK ? ST77XX_BLACK : ST77XX_WHITE);
+			start = micros();
+			for(uint16_t pass=0; pass<INDICATOR_BENCH_PASSES; pass++)
+				drawIndicatorSprite(&indicatorCases[i]);
+			spriteUs += micros() - start;
+			if(memcmp(reference, buffer, sizeof(reference)) != 0)
+			{
+				ESP_LOGE(SIM_TAG, "Indicator case %d, mode %d: sprite differs from circles", i, modes[m]);
+				differing++;
+			}
+		}
+	}
+	defaultSettings();
+	framebuffer_MarkAllDirty();
+	display_Flush();
+
+	double drawn = sizeof(modes) * NUM_INDICATOR_CASES * INDICATOR_BENCH_PASSES;
+	printf("\nIndicators, %d states x %d modes x %d passes\n", (int)NUM_INDICATOR_CASES, (int)sizeof(modes), INDICATOR_BENCH_PASSES);
+	printf("%-16s %10.2f us/draw\n", "gfx circles", gfxUs / drawn);
+	printf("%-16s %10.2f us/draw\n", "sprite blit", spriteUs / drawn);
+	printf("%d mismatch(es) against the circles\n", differing);
+	mismatches += differing;
+}
+
+//----------------------------------------------------------------------------//
+//	Main
+//----------------------------------------------------------------------------//
+
+static void runScenario(const SimScenario* scenario)
+{
+	if(scenario->setup != NULL)
+		scenario->setup();
+
+	lcd.resetStats();
+	uint64_t hostUs = 0;
+	uint32_t bytesPeak = 0;
+	for(uint32_t i=0; i<scenario->steps; i++)
+	{
+		uint64_t bytesBefore = lcd.getStats()->bytes;
+		unsigned long start = micros();
+		scenario->step(i);
+		hostUs += micros() - start;
+		uint32_t bytes = lcd.getStats()->bytes - bytesBefore;
+		if(bytes > bytesPeak)
+			bytesPeak = bytes;
+
+		// The display task fills the preset cache while idle
+		while(presetCache_Work());
+	}
+
+	const VirtualPanelStats* stats = lcd.getStats();
+	double steps = scenario->steps;
+	double wireUs = (double)stats->bytes * 8 * 1000000.0 / spiHz;
+	printf("%-16s %6d %8.1f %8.1f %10.0f %10d %10.1f %10.1f\n",
+			scenario->name, scenario->steps,
+			stats->transactions / steps, stats->addrWindows / steps,
+			stats->bytes / steps, bytesPeak,
+			wireUs / steps, hostUs / steps);
+
+	if(dumpDir != NULL)
+		dumpFrame(scenario->name);
+	if(compareDir != NULL)
+		compareFrame(scenario->name);
+}
+
+int main(int argc, char** argv)
+{
+	for(int i=1; i<argc; i++)
+	{
+		if(!strcmp(argv[i], "--dump") && i + 1 < argc)
+			dumpDir = argv[++i];
+		else if(!strcmp(argv[i], "--compare") && i + 1 < argc)
+			compareDir = argv[++i];
+		else if(!strcmp(argv[i], "--spi-hz") && i + 1 < argc)
+			spiHz = strtoul(argv[++i], NULL, 10);
+		else
+		{
+			fprintf(stderr, "usage: %s [--dump <dir>] [--compare <dir>] [--spi-hz <hz>]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	printf("Per-update averages, SPI at %.1f MHz\n", spiHz / 1000000.0);
+	printf("%-16s %6s %8s %8s %10s %10s %10s %10s\n",
+			"scenario", "steps", "txns", "windows", "bytes", "peak", "wire us", "host us");
+	for(uint32_t i=0; i<NUM_SCENARIOS; i++)
+	{
+		runScenario(&scenarios[i]);
+	}
+
+	runTextBenchmark();
+	runIndicatorBenchmark();
+
+	if(compareDir != NULL)
+	{
+		printf("%d scenario(s) differ from %s\n", mismatches, compareDir);
+	}
+	return mismatches ? 1 : 0;
+}
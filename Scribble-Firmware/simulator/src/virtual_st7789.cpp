@@ -0,0 +1,260 @@
+#include "Adafruit_ST7789.h"
+
+SPIClass SPI;
+
+//----------------------------------------------------------------------------//
+//	Adafruit_SPITFT
+//----------------------------------------------------------------------------//
+
+Adafruit_SPITFT::Adafruit_SPITFT(uint16_t w, uint16_t h) : Adafruit_GFX(w, h)
+{
+	panel = NULL;
+	windowX = windowY = windowW = windowH = 0;
+	windowCursor = 0;
+	inTransaction = false;
+	resetStats();
+}
+
+Adafruit_SPITFT::~Adafruit_SPITFT()
+{
+	free(panel);
+}
+
+// Panel RAM is stored in rotated (drawing) coordinates, so it only
+// needs to be large enough for WIDTH x HEIGHT in either orientation
+void Adafruit_SPITFT::allocatePanel()
+{
+	free(panel);
+	panel = (uint16_t*)calloc((size_t)WIDTH * HEIGHT, sizeof(uint16_t));
+}
+
+void Adafruit_SPITFT::sendCommand(uint8_t count, uint32_t dataBytes)
+{
+	stats.commands += count;
+	stats.bytes += count + dataBytes;
+}
+
+void Adafruit_SPITFT::startWrite(void)
+{
+	if(!inTransaction)
+		stats.transactions++;
+	inTransaction = true;
+}
+
+void Adafruit_SPITFT::endWrite(void)
+{
+	inTransaction = false;
+}
+
+void Adafruit_SPITFT::setAddrWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+	windowX = x;
+	windowY = y;
+	windowW = w;
+	windowH = h;
+	windowCursor = 0;
+	stats.addrWindows++;
+	sendCommand(3, SIM_ADDR_WINDOW_BYTES - 3);
+}
+
+// Pixels land in the current window left to right, top to bottom,
+// wrapping back to the start like the controller does
+void Adafruit_SPITFT::writePixels(uint16_t* colors, uint32_t len, bool block, bool bigEndian)
+{
+	uint32_t windowSize = (uint32_t)windowW * windowH;
+	stats.pixels += len;
+	stats.bytes += (uint64_t)len * 2;
+	if(panel == NULL || windowSize == 0)
+		return;
+	for(uint32_t i=0; i<len; i++)
+	{
+		int32_t x = windowX + windowCursor % windowW;
+		int32_t y = windowY + windowCursor / windowW;
+		if(x < _width && y < _height)
+		{
+			uint16_t colour = colors[i];
+			if(bigEndian)
+				colour = (colour >> 8) | (colour << 8);
+			panel[y * _width + x] = colour;
+		}
+		if(++windowCursor >= windowSize)
+			windowCursor = 0;
+	}
+}
+
+void Adafruit_SPITFT::writeColor(uint16_t color, uint32_t len)
+{
+	uint32_t windowSize = (uint32_t)windowW * windowH;
+	stats.pixels += len;
+	stats.bytes += (uint64_t)len * 2;
+	if(panel == NULL || windowSize == 0)
+		return;
+	for(uint32_t i=0; i<len; i++)
+	{
+		int32_t x = windowX + windowCursor % windowW;
+		int32_t y = windowY + windowCursor / windowW;
+		if(x < _width && y < _height)
+			panel[y * _width + x] = color;
+		if(++windowCursor >= windowSize)
+			windowCursor = 0;
+	}
+}
+
+void Adafruit_SPITFT::writePixel(int16_t x, int16_t y, uint16_t color)
+{
+	if(x < 0 || y < 0 || x >= _width || y >= _height)
+		return;
+	setAddrWindow(x, y, 1, 1);
+	writeColor(color, 1);
+}
+
+void Adafruit_SPITFT::writeFillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+	// Clip the same way the driver does before opening a window
+	if(x < 0)
+	{
+		w += x;
+		x = 0;
+	}
+	if(y < 0)
+	{
+		h += y;
+		y = 0;
+	}
+	if(x + w > _width)
+		w = _width - x;
+	if(y + h > _height)
+		h = _height - y;
+	if(w <= 0 || h <= 0)
+		return;
+	setAddrWindow(x, y, w, h);
+	writeColor(color, (uint32_t)w * h);
+}
+
+void Adafruit_SPITFT::writeFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color)
+{
+	writeFillRect(x, y, w, 1, color);
+}
+
+void Adafruit_SPITFT::writeFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color)
+{
+	writeFillRect(x, y, 1, h, color);
+}
+
+void Adafruit_SPITFT::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+	startWrite();
+	writePixel(x, y, color);
+	endWrite();
+}
+
+void Adafruit_SPITFT::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+	startWrite();
+	writeFillRect(x, y, w, h, color);
+	endWrite();
+}
+
+void Adafruit_SPITFT::drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color)
+{
+	fillRect(x, y, w, 1, color);
+}
+
+void Adafruit_SPITFT::drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color)
+{
+	fillRect(x, y, 1, h, color);
+}
+
+void Adafruit_SPITFT::fillScreen(uint16_t color)
+{
+	fillRect(0, 0, _width, _height, color);
+}
+
+uint16_t Adafruit_SPITFT::color565(uint8_t r, uint8_t g, uint8_t b)
+{
+	return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+const VirtualPanelStats* Adafruit_SPITFT::getStats() const
+{
+	return &stats;
+}
+
+void Adafruit_SPITFT::resetStats()
+{
+	memset(&stats, 0, sizeof(VirtualPanelStats));
+}
+
+const uint16_t* Adafruit_SPITFT::getPanel() const
+{
+	return panel;
+}
+
+// Write the visible panel as a binary PPM, expanding RGB565 to 8 bits per channel
+bool Adafruit_SPITFT::savePpm(const char* path) const
+{
+	if(panel == NULL)
+		return false;
+	FILE* file = fopen(path, "wb");
+	if(file == NULL)
+		return false;
+	fprintf(file, "P6\n%d %d\n255\n", _width, _height);
+	for(int32_t i=0; i<(int32_t)_width * _height; i++)
+	{
+		uint16_t c = panel[i];
+		uint8_t rgb[3];
+		rgb[0] = ((c >> 11) & 0x1F) * 255 / 31;
+		rgb[1] = ((c >> 5) & 0x3F) * 255 / 63;
+		rgb[2] = (c & 0x1F) * 255 / 31;
+		fwrite(rgb, 1, 3, file);
+	}
+	fclose(file);
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+//	Adafruit_ST77xx / Adafruit_ST7789
+//----------------------------------------------------------------------------//
+
+Adafruit_ST77xx::Adafruit_ST77xx(uint16_t w, uint16_t h, int8_t cs, int8_t dc, int8_t rst)
+	: Adafruit_SPITFT(w, h)
+{
+}
+
+void Adafruit_ST77xx::setRotation(uint8_t r)
+{
+	Adafruit_GFX::setRotation(r);
+	startWrite();
+	sendCommand(1, 1);	// MADCTL
+	endWrite();
+}
+
+void Adafruit_ST77xx::enableDisplay(bool enable)
+{
+	startWrite();
+	sendCommand(1, 0);	// DISPON / DISPOFF
+	endWrite();
+}
+
+void Adafruit_ST77xx::invertDisplay(bool i)
+{
+	startWrite();
+	sendCommand(1, 0);	// INVON / INVOFF
+	endWrite();
+}
+
+Adafruit_ST7789::Adafruit_ST7789(int8_t cs, int8_t dc, int8_t rst)
+	: Adafruit_ST77xx(240, 320, cs, dc, rst)
+{
+}
+
+void Adafruit_ST7789::init(uint16_t width, uint16_t height, uint8_t spiMode)
+{
+	WIDTH = width;
+	HEIGHT = height;
+	_width = width;
+	_height = height;
+	allocatePanel();
+	setRotation(0);
+	resetStats();
+}
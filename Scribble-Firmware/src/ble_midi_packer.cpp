@@ -0,0 +1,107 @@
+#include "ble_midi_packer.h"
+
+// Start an empty packet. The header byte is written with the first message
+void bleMidiPacker_Begin(BleMidiPacker* packer, uint16_t limit)
+{
+	if(limit > BLE_MIDI_PACKET_MAX)
+		limit = BLE_MIDI_PACKET_MAX;
+	if(limit < BLE_MIDI_PACKET_MIN)
+		limit = BLE_MIDI_PACKET_MIN;
+	packer->limit = limit;
+	packer->length = 0;
+	packer->runningStatus = 0;
+	packer->messages = 0;
+}
+
+// Append one message stamped with the low 13 bits of timeMs
+// Channel messages repeating the previous status leave the status byte out
+// Returns false, leaving the packet untouched, if the message does not fit
+bool bleMidiPacker_Add(BleMidiPacker* packer, uint16_t timeMs, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	uint8_t dataLength = bleMidiPacker_DataLength(status);
+	bool realtime = status >= 0xF8;
+	bool running = !realtime && status == packer->runningStatus;
+
+	uint16_t needed = 1 + (running ? 0 : 1) + dataLength;
+	if(packer->length == 0)
+		needed++;
+	if(packer->length + needed > packer->limit)
+		return false;
+
+	// Header: timestamp high bits, shared by every message in the packet. A receiver
+	// treats a timestamp low byte smaller than the one before it as a rollover
+	if(packer->length == 0)
+		packer->buffer[packer->length++] = 0x80 | ((timeMs >> 7) & 0x3F);
+
+	packer->buffer[packer->length++] = 0x80 | (timeMs & 0x7F);
+	if(!running)
+		packer->buffer[packer->length++] = status;
+	if(dataLength > 0)
+		packer->buffer[packer->length++] = data1 & 0x7F;
+	if(dataLength > 1)
+		packer->buffer[packer->length++] = data2 & 0x7F;
+
+	// Realtime messages may sit between running status messages without breaking it,
+	// system common messages cancel it
+	if(status < 0xF0)
+		packer->runningStatus = status;
+	else if(!realtime)
+		packer->runningStatus = 0;
+
+	packer->messages++;
+	return true;
+}
+
+// Append raw SysEx bytes. F0 and F7 each take a timestamp byte, data bytes go in as they are,
+// and a packet that starts part way through a SysEx just carries on after its header
+// Returns false, leaving the packet untouched, if the bytes do not fit
+bool bleMidiPacker_AddSysex(BleMidiPacker* packer, uint16_t timeMs, const uint8_t* bytes, uint8_t length)
+{
+	uint16_t needed = length;
+	if(packer->length == 0)
+		needed++;
+	for(uint8_t i=0; i<length; i++)
+	{
+		if(bytes[i] == 0xF0 || bytes[i] == 0xF7)
+			needed++;
+	}
+	if(packer->length + needed > packer->limit)
+		return false;
+
+	if(packer->length == 0)
+		packer->buffer[packer->length++] = 0x80 | ((timeMs >> 7) & 0x3F);
+	for(uint8_t i=0; i<length; i++)
+	{
+		if(bytes[i] == 0xF0 || bytes[i] == 0xF7)
+			packer->buffer[packer->length++] = 0x80 | (timeMs & 0x7F);
+		packer->buffer[packer->length++] = bytes[i];
+	}
+
+	packer->runningStatus = 0;
+	return true;
+}
+
+// Data bytes following a status byte
+uint8_t bleMidiPacker_DataLength(uint8_t status)
+{
+	if(status < 0xF0)
+	{
+		uint8_t command = status & 0xF0;
+		if(command == 0xC0 || command == 0xD0)
+			return 1;
+		return 2;
+	}
+	if(status == 0xF1 || status == 0xF3)
+		return 1;
+	if(status == 0xF2)
+		return 2;
+	return 0;
+}
+
+// Status byte for a midi::MidiType and the 1-indexed channel the MIDI library uses
+uint8_t bleMidiPacker_Status(uint8_t type, uint8_t channel)
+{
+	if(type >= 0xF0)
+		return type;
+	return (type & 0xF0) | ((channel - 1) & 0x0F);
+}
@@ -2,6 +2,7 @@
 #include "Arduino.h"
 #include "hardware_def.h"
 #include "main.h"
+#include "midi_stacks.h"
 #include "Button2.h"
 
 
@@ -57,23 +58,8 @@ void switch2Press(Button2& button)
 
 void switchPressHandler(uint8_t switchIndex)
 {
-	// Trigger any available message stacks before changing presets (if applicable)
-	// Global
-	for(uint8_t i=0; i<NUM_SWITCH_MESSAGES; i++)
-	{
-		if(globalSettings.switchPressMessages[switchIndex][i].status == 0)
-			break;
-
-		sendMidiMessage(globalSettings.switchPressMessages[switchIndex][i]);
-	}
-	// Preset
-	for(uint8_t i=0; i<NUM_SWITCH_MESSAGES; i++)
-	{
-		if(presets[globalSettings.currentPreset].switchPressMessages[switchIndex][i].status == 0)
-			break;
-
-		sendMidiMessage(presets[globalSettings.currentPreset].switchPressMessages[switchIndex][i]);
-	}
+	// Trigger the global and preset message stacks before changing presets (if applicable)
+	midiStacks_Send(MidiStackSwitchPress + switchIndex);
 
 	// Triger any navigation actions
 	if(globalSettings.switchMode[switchIndex] == SwitchPressPresetUp)
@@ -98,23 +84,8 @@ void switch2Hold(Button2& button)
 
 void switchHoldHandler(uint8_t switchIndex)
 {
-	// Trigger any available message stacks before changing presets (if applicable)
-	// Global
-	for(uint8_t i=0; i<NUM_SWITCH_MESSAGES; i++)
-	{
-		if(globalSettings.switchHoldMessages[switchIndex][i].status == 0)
-			break;
-
-		sendMidiMessage(globalSettings.switchHoldMessages[switchIndex][i]);
-	}
-	// Preset
-	for(uint8_t i=0; i<NUM_SWITCH_MESSAGES; i++)
-	{
-		if(presets[globalSettings.currentPreset].switchHoldMessages[switchIndex][i].status == 0)
-			break;
-
-		sendMidiMessage(presets[globalSettings.currentPreset].switchHoldMessages[switchIndex][i]);
-	}
+	// Trigger the global and preset message stacks before changing presets (if applicable)
+	midiStacks_Send(MidiStackSwitchHold + switchIndex);
 
 	// Triger any navigation actions
 	if(globalSettings.switchMode[switchIndex] == SwitchHoldPresetUp)
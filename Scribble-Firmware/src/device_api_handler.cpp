@@ -6,6 +6,22 @@
 #include "esp32-hal-tinyusb.h" // required for entering download mode
 #include "midi_handling.h"
 #include "main.h"
+#include "display.h"
+#include "preset_cache.h"
+#include "display_task.h"
+#include "render_profiler.h"
+#ifdef USE_LCD_DMA
+#include "lcd_dma.h"
+#include "framebuffer.h"
+#endif
+#include "midi_routing.h"
+#include "midi_output.h"
+#include "midi_stacks.h"
+#include "midi_journal.h"
+#include "midi_actions.h"
+#include "midi_sysex.h"
+#include "midi_loop.h"
+#include "mbedtls/base64.h"
 #include "esp_log.h"
 #include "esp32_settings.h"
 #include "ota_updating.h"
@@ -17,6 +33,10 @@ const char *midiInterfaceStrings[NUM_MIDI_INTERFACES] = {	USB_USB_STRING,
 																				USB_BLE_STRING,
 																				USB_MIDI1_STRING};
 
+const char *midiFilterTypeStrings[NUM_MIDI_FILTER_TYPES] = {"noteOff", "noteOn", "polyPressure", "cc", "pc",
+																				"channelPressure", "pitchBend", "sysex", "systemCommon",
+																				"clock", "transport", "activeSensing", "reset"};
+
 void packMessageStack(const JsonArray& jsonArray, MidiMessage* messages, uint16_t numMessages);
 void parseMessageStack(const JsonArray& jsonArray, MidiMessage* messages, uint16_t numMessages);
 uint16_t rgb888_to_rgb565(uint32_t rgb888);
@@ -120,6 +140,31 @@ void sendGlobalSettings(uint8_t transport)
 	//doc[USB_MIDI1_THRU_HANDLES_STRING][USB_WIFI_STRING] = (bool)globalSettings.midi1ThruHandles[MidiWiFiRTP];
 	doc[USB_MIDI1_THRU_HANDLES_STRING][USB_MIDI1_STRING] = (bool)globalSettings.midi1ThruHandles[MidiSerial1];
 
+	// Thru filters, [source][destination] as the types let through, a channel mask (bit 0 = channel 1)
+	// and the outgoing channel (1-16) for each incoming channel
+	for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+	{
+		for(uint8_t destination=0; destination<NUM_MIDI_INTERFACES; destination++)
+		{
+			const MidiFilterSettings* filter = &thruFilters[source][destination];
+			JsonObject route = doc["thruFilters"][midiInterfaceStrings[source]][midiInterfaceStrings[destination]].to<JsonObject>();
+			JsonArray types = route["types"].to<JsonArray>();
+			for(uint8_t type=0; type<NUM_MIDI_FILTER_TYPES; type++)
+			{
+				if((filter->types >> type) & 1)
+					types.add(midiFilterTypeStrings[type]);
+			}
+			route["channels"] = filter->channels;
+			JsonArray remap = route["remap"].to<JsonArray>();
+			for(uint8_t channel=0; channel<16; channel++)
+				remap.add(filter->remap[channel] + 1);
+		}
+	}
+
+	// CC coalescing window per output in milliseconds, 0 when off
+	for(uint8_t interface=0; interface<NUM_MIDI_INTERFACES; interface++)
+		doc["ccCoalesceMs"][midiInterfaceStrings[interface]] = midiOutput_GetCoalesceWindow(interface);
+
 	// MIDI clock output handles
 	doc[USB_MIDI_CLOCK_OUT_HANDLES_STRING][USB_USBD_STRING] = (bool)globalSettings.midiClockOutHandles[MidiUSBD];
 	doc[USB_MIDI_CLOCK_OUT_HANDLES_STRING][USB_BLE_STRING] = (bool)globalSettings.midiClockOutHandles[MidiBLE];
@@ -278,6 +323,245 @@ void sendCurrentBank(uint8_t transport)
 	}
 }
 
+// Per context, every display function that has run as [calls, total us, worst us, pixels, worst pixels]
+// Functions that have not run in a context are left out
+// With the DMA flush, the heap is reported alongside as [DMA strip bytes, DMA free before the strips,
+// internal free, internal lowest free, DMA free, DMA lowest free, largest DMA block, framebuffer bytes]
+void sendRenderProfile(uint8_t transport)
+{
+	JsonDocument doc;
+	JsonObject profile = doc["renderProfile"].to<JsonObject>();
+	for(uint8_t context=0; context<NUM_PROFILE_CONTEXTS; context++)
+	{
+		JsonObject contextObject;
+		for(uint8_t point=0; point<NUM_PROFILE_POINTS; point++)
+		{
+			const ProfileEntry* entry = renderProfiler_GetEntry(context, point);
+			if(entry->calls == 0)
+				continue;
+
+			if(contextObject.isNull())
+				contextObject = profile[renderProfiler_GetContextName(context)].to<JsonObject>();
+			JsonArray values = contextObject[renderProfiler_GetPointName(point)].to<JsonArray>();
+			values.add(entry->calls);
+			values.add(entry->totalUs);
+			values.add(entry->maxUs);
+			values.add(entry->pixels);
+			values.add(entry->maxPixels);
+		}
+	}
+#ifdef USE_LCD_DMA
+	LcdDmaHeapStats heap;
+	lcdDma_GetHeapStats(&heap);
+	JsonArray heapValues = doc["displayHeap"].to<JsonArray>();
+	heapValues.add(heap.stripBytes);
+	heapValues.add(heap.dmaFreeAtInit);
+	heapValues.add(heap.internalFree);
+	heapValues.add(heap.internalMinFree);
+	heapValues.add(heap.dmaFree);
+	heapValues.add(heap.dmaMinFree);
+	heapValues.add(heap.dmaLargestBlock);
+	heapValues.add(FRAMEBUFFER_BYTES);
+#endif
+
+	if(transport == USB_CDC_TRANSPORT)
+	{
+		serializeJson(doc, Serial);
+		sendPacketTermination(USB_CDC_TRANSPORT);
+	}
+	else if(transport == MIDI_TRANSPORT)
+	{
+		CustomWriter writer;
+		writer.transport = MIDI_TRANSPORT;
+		serializeJson(doc, writer);
+		writer.flush();
+		sendPacketTermination(MIDI_TRANSPORT);
+	}
+}
+
+// Per interface transmit ring, in interface order, as
+// [sent, overflows, realtime overflows, high water, realtime high water, worst send us, CCs coalesced]
+// followed by BLE packing as [packets, messages, most messages in a packet, total latency us, worst latency us]
+// and the Serial1 wire as [bytes, status bytes saved, realtime bytes inserted, wire us last second, peak wire us per second,
+// running status active, mask of sources whose unfiltered thru to Serial1 keeps running status off]
+// SysEx pass-through is reported per ring as [chunks, overflows, timeouts] and overall as
+// [streams, chunks, destinations cut off, peak bytes held by one stream]
+// Filtered thru routes are reported as [messages forwarded, messages filtered out, filters refused],
+// along with the routes, by source, whose last filter was refused for passing types other than cc, pc and sysex
+// Per interface, the mask of sources whose unfiltered thru reaches it without going through its
+// transmit ring, so its CCs are not coalesced
+void sendMidiOutputStats(uint8_t transport)
+{
+	JsonDocument doc;
+	for(uint8_t i=0; i<NUM_MIDI_OUTPUTS; i++)
+	{
+		const MidiOutputStats* stats = midiOutput_GetStats(i);
+		JsonArray values = doc["midiOutputStats"][i].to<JsonArray>();
+		values.add(stats->sent);
+		values.add(stats->overflows);
+		values.add(stats->realtimeOverflows);
+		values.add(stats->highWater);
+		values.add(stats->realtimeHighWater);
+		values.add(stats->sendUsMax);
+		values.add(stats->ccCoalesced);
+		JsonArray sysexValues = doc["sysexOutput"][i].to<JsonArray>();
+		sysexValues.add(stats->sysexChunks);
+		sysexValues.add(stats->sysexOverflows);
+		sysexValues.add(stats->sysexTimeouts);
+	}
+	const MidiSysexStats* sysexStats = midiSysex_GetStats();
+	JsonArray streamValues = doc["sysexStreams"].to<JsonArray>();
+	streamValues.add(sysexStats->streams);
+	streamValues.add(sysexStats->streamChunks);
+	streamValues.add(sysexStats->streamCutoffs);
+	streamValues.add(sysexStats->streamBytesPeak);
+	const MidiRoutingStats* routingStats = midiRouting_GetStats();
+	JsonArray filterValues = doc["thruFilterStats"].to<JsonArray>();
+	filterValues.add(routingStats->filtered);
+	filterValues.add(routingStats->filterDropped);
+	filterValues.add(routingStats->filterRefused);
+	JsonObject refusedValues = doc["thruFilterRefused"].to<JsonObject>();
+	for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+	{
+		JsonArray destinations = refusedValues[midiInterfaceStrings[source]].to<JsonArray>();
+		for(uint8_t destination=0; destination<NUM_MIDI_INTERFACES; destination++)
+		{
+			if((routingStats->refusedRoutes >> (source * NUM_MIDI_INTERFACES + destination)) & 1)
+				destinations.add(midiInterfaceStrings[destination]);
+		}
+	}
+	JsonArray bypassValues = doc["ccCoalesceBypass"].to<JsonArray>();
+	for(uint8_t destination=0; destination<NUM_MIDI_INTERFACES; destination++)
+	{
+		uint8_t sources = 0;
+		for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+		{
+			if(midiRouting_GetThruMask(source) & (1 << destination))
+				sources |= (1 << source);
+		}
+		bypassValues.add(sources);
+	}
+	const BleMidiOutputStats* bleStats = midiOutput_GetBleStats();
+	JsonArray bleValues = doc["bleMidiPackets"].to<JsonArray>();
+	bleValues.add(bleStats->packets);
+	bleValues.add(bleStats->messages);
+	bleValues.add(bleStats->maxMessages);
+	bleValues.add(bleStats->latencyUsTotal);
+	bleValues.add(bleStats->latencyUsMax);
+	const SerialMidiOutputStats* serialStats = midiOutput_GetSerialStats();
+	JsonArray serialValues = doc["serialMidiWire"].to<JsonArray>();
+	serialValues.add(serialStats->bytes);
+	serialValues.add(serialStats->statusBytesSaved);
+	serialValues.add(serialStats->realtimeInserted);
+	serialValues.add(serialStats->wireUsLastSecond);
+	serialValues.add(serialStats->wireUsPeak);
+	serialValues.add(serialStats->runningStatusActive);
+	serialValues.add(serialStats->runningStatusBlockers);
+
+	if(transport == USB_CDC_TRANSPORT)
+	{
+		serializeJson(doc, Serial);
+		sendPacketTermination(USB_CDC_TRANSPORT);
+	}
+	else if(transport == MIDI_TRANSPORT)
+	{
+		CustomWriter writer;
+		writer.transport = MIDI_TRANSPORT;
+		serializeJson(doc, writer);
+		writer.flush();
+		sendPacketTermination(MIDI_TRANSPORT);
+	}
+}
+
+// Loop breaker per interface as [echoes dropped, thru suspensions], the sources with thru
+// currently suspended as a mask, and the interfaces that have looped since the last report.
+// The warning is only reported once so the editor can raise it without tracking it itself
+// "covers" lists the message types echoes are detected on, a loop of any other type goes unnoticed
+void sendMidiLoopStatus(uint8_t transport)
+{
+	JsonDocument doc;
+	for(uint8_t i=0; i<NUM_MIDI_INTERFACES; i++)
+	{
+		const MidiLoopStats* stats = midiLoop_GetStats(i);
+		JsonArray values = doc["midiLoop"]["echoes"][i].to<JsonArray>();
+		values.add(stats->echoes);
+		values.add(stats->suspensions);
+	}
+	doc["midiLoop"]["suspended"] = midiRouting_GetStats()->suspendMask;
+	JsonArray coveredValues = doc["midiLoop"]["covers"].to<JsonArray>();
+	for(uint8_t type=0; type<NUM_MIDI_FILTER_TYPES; type++)
+	{
+		if((MIDI_LOOP_COVERED_TYPES >> type) & 1)
+			coveredValues.add(midiFilterTypeStrings[type]);
+	}
+	uint8_t warning = midiLoop_TakeWarning();
+	JsonArray warningValues = doc["midiLoop"]["warning"].to<JsonArray>();
+	for(uint8_t i=0; i<NUM_MIDI_INTERFACES; i++)
+	{
+		if(warning & (1 << i))
+			warningValues.add(midiInterfaceStrings[i]);
+	}
+
+	if(transport == USB_CDC_TRANSPORT)
+	{
+		serializeJson(doc, Serial);
+		sendPacketTermination(USB_CDC_TRANSPORT);
+	}
+	else if(transport == MIDI_TRANSPORT)
+	{
+		CustomWriter writer;
+		writer.transport = MIDI_TRANSPORT;
+		serializeJson(doc, writer);
+		writer.flush();
+		sendPacketTermination(MIDI_TRANSPORT);
+	}
+}
+
+// Journal records base64 encoded per chunk. A multiple of three bytes so the chunks join up
+#define JOURNAL_CHUNK_RECORDS		16
+
+static void writeTransport(uint8_t transport, CustomWriter* writer, const char* text, size_t length)
+{
+	if(transport == USB_CDC_TRANSPORT)
+		Serial.write((const uint8_t*)text, length);
+	else if(transport == MIDI_TRANSPORT)
+		writer->write((const uint8_t*)text, length);
+}
+
+// The MIDI journal oldest first, as one base64 string of packed records (see midiJournal_PackRecord)
+// Written out in chunks rather than through a JsonDocument so the whole journal is never held twice
+void sendMidiJournal(uint8_t transport)
+{
+	CustomWriter writer;
+	writer.transport = MIDI_TRANSPORT;
+	char text[96];
+
+	midiJournal_Freeze(true);
+	const MidiJournalStats* stats = midiJournal_GetStats();
+	uint16_t count = midiJournal_GetCount();
+	int length = snprintf(text, sizeof(text), "{\"midiJournal\":{\"nowUs\":%u,\"recorded\":%u,\"skipped\":%u,\"records\":\"",
+								(unsigned)micros(), (unsigned)stats->recorded, (unsigned)stats->skipped);
+	writeTransport(transport, &writer, text, length);
+
+	uint8_t records[JOURNAL_CHUNK_RECORDS * MIDI_JOURNAL_RECORD_BYTES];
+	unsigned char encoded[(sizeof(records) / 3) * 4 + 1];
+	for(uint16_t first=0; first<count; first+=JOURNAL_CHUNK_RECORDS)
+	{
+		uint16_t chunk = count - first < JOURNAL_CHUNK_RECORDS ? count - first : JOURNAL_CHUNK_RECORDS;
+		for(uint16_t i=0; i<chunk; i++)
+			midiJournal_PackRecord(first + i, &records[i * MIDI_JOURNAL_RECORD_BYTES]);
+
+		size_t encodedLength = 0;
+		mbedtls_base64_encode(encoded, sizeof(encoded), &encodedLength, records, chunk * MIDI_JOURNAL_RECORD_BYTES);
+		writeTransport(transport, &writer, (const char*)encoded, encodedLength);
+	}
+	midiJournal_Freeze(false);
+
+	writeTransport(transport, &writer, "\"}}", 3);
+	if(transport == MIDI_TRANSPORT)
+		writer.flush();
+	sendPacketTermination(transport);
+}
 
 // Parsing functions
 void parseGlobalSettings(char* appData, uint8_t transport)
@@ -307,6 +591,8 @@ void parseGlobalSettings(char* appData, uint8_t transport)
 
 	globalSettings.mainColour = rgb888_to_rgb565(doc["mainColour"]);
 	globalSettings.textColour = rgb888_to_rgb565(doc["textColour"]);
+	// Cached preset frames were drawn with the old colours
+	presetCache_Invalidate();
 	// todo brightness
 	uint8_t tempBrightness = doc["displayBrightness"];
 	globalSettings.displayBrightness = devApi_roundMap(doc["displayBrightness"], 0, 100, 0, 255);
@@ -355,6 +641,64 @@ void parseGlobalSettings(char* appData, uint8_t transport)
 	globalSettings.midiClockOutHandles[MidiBLE] = (uint8_t)doc[USB_MIDI_CLOCK_OUT_HANDLES_STRING][USB_BLE_STRING];
 	//globalSettings.midiClockOutHandles[MidiWiFiRTP] = (uint8_t)doc[USB_MIDI_CLOCK_OUT_HANDLES_STRING][USB_WIFI_STRING];
 	globalSettings.midiClockOutHandles[MidiSerial1] = (uint8_t)doc[USB_MIDI_CLOCK_OUT_HANDLES_STRING][USB_MIDI1_STRING];
+
+	// Thru filters. Routes left out keep the filter they have, parts of a route that are left out pass everything
+	// A filter letting through types a filtered route can't carry is refused and the route keeps
+	// the filter it had, reported in "thruFilterRefused" by the midiOutputStats command
+	bool filtersChanged = false;
+	for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+	{
+		for(uint8_t destination=0; destination<NUM_MIDI_INTERFACES; destination++)
+		{
+			JsonObject route = doc["thruFilters"][midiInterfaceStrings[source]][midiInterfaceStrings[destination]];
+			if(route.isNull())
+				continue;
+
+			MidiFilterSettings filter;
+			midiFilter_Default(&filter);
+
+			JsonArray types = route["types"];
+			if(!types.isNull())
+			{
+				filter.types = 0;
+				for(uint8_t i=0; i<types.size(); i++)
+				{
+					for(uint8_t type=0; type<NUM_MIDI_FILTER_TYPES; type++)
+					{
+						if(strcmp(types[i], midiFilterTypeStrings[type]) == 0)
+							filter.types |= (1 << type);
+					}
+				}
+			}
+			if(!route["channels"].isNull())
+				filter.channels = route["channels"];
+			JsonArray remap = route["remap"];
+			for(uint8_t channel=0; channel<16 && channel<remap.size(); channel++)
+			{
+				uint8_t outChannel = remap[channel];
+				if(outChannel >= 1 && outChannel <= 16)
+					filter.remap[channel] = outChannel - 1;
+			}
+			if(midiRouting_SetFilter(source, destination, &filter))
+				filtersChanged = true;
+		}
+	}
+	if(filtersChanged)
+		midiRouting_SaveFilters();
+	// The thru and clock handles above are compiled in too
+	midiRouting_Compile();
+
+	// CC coalescing windows, left as they are unless given
+	if(!doc["ccCoalesceMs"].isNull())
+	{
+		for(uint8_t interface=0; interface<NUM_MIDI_INTERFACES; interface++)
+		{
+			JsonVariant windowMs = doc["ccCoalesceMs"][midiInterfaceStrings[interface]];
+			if(!windowMs.isNull())
+				midiOutput_SetCoalesceWindow(interface, windowMs.as<uint16_t>());
+		}
+		midiOutput_SaveCoalesceWindows();
+	}
 	
 
 	// Switch messages
@@ -443,6 +787,9 @@ void parseGlobalSettings(char* appData, uint8_t transport)
 		globalSettings.esp32ManagerConfig.staticGatewayIp[i] = (uint8_t)gatewayParts[i];
 	}
 
+	// Global stacks and PC bank outputs are merged into the current preset's stacks
+	midiStacks_QueueCompile(false);
+	midiActions_Build();
 	esp32Settings_SaveGlobalSettings();
 }
 
@@ -494,6 +841,10 @@ void parseBankSettings(char* appData, uint16_t bankNum, uint8_t transport)
 	parseMessageStack(doc["customMessages"]["messages"],
 								presets[bankNum].customMessages, presets[bankNum].numCustomMessages);
 
+	// Have the render task re-measure the edited text so the next preset switch does not have to
+	display_QueueLayout(bankNum);
+	if(bankNum == globalSettings.currentPreset)
+		midiStacks_QueueCompile(false);
 	esp32Settings_SavePresets();
 }
 
@@ -540,6 +891,30 @@ void ctrlCommandHandler(char* appData, uint8_t transport)
 				{
 					presetDown();
 				}
+				else if(strcmp(command, "renderProfile") == 0)
+				{
+					sendRenderProfile(transport);
+				}
+				else if(strcmp(command, "resetRenderProfile") == 0)
+				{
+					renderProfiler_Reset();
+				}
+				else if(strcmp(command, "midiOutputStats") == 0)
+				{
+					sendMidiOutputStats(transport);
+				}
+				else if(strcmp(command, "midiLoopStatus") == 0)
+				{
+					sendMidiLoopStatus(transport);
+				}
+				else if(strcmp(command, "midiJournal") == 0)
+				{
+					sendMidiJournal(transport);
+				}
+				else if(strcmp(command, "resetMidiJournal") == 0)
+				{
+					midiJournal_Reset();
+				}
 				else if(strcmp(command, "savePresets") == 0)
 				{
 					esp32Settings_SavePresets();
@@ -603,6 +978,18 @@ void ctrlCommandHandler(char* appData, uint8_t transport)
 						goToPreset(bankIndex);
 					}
 				}
+				// CC coalescing window per output in milliseconds, 0 to turn it off
+				// Saved, and also part of the global settings
+				if(!doc[USB_COMMAND_STRING][i]["ccCoalesceMs"].isNull())
+				{
+					for(uint8_t interface=0; interface<NUM_MIDI_INTERFACES; interface++)
+					{
+						JsonVariant windowMs = doc[USB_COMMAND_STRING][i]["ccCoalesceMs"][midiInterfaceStrings[interface]];
+						if(!windowMs.isNull())
+							midiOutput_SetCoalesceWindow(interface, windowMs.as<uint16_t>());
+					}
+					midiOutput_SaveCoalesceWindows();
+				}
 				if(!doc[USB_COMMAND_STRING][i]["wifiSsid"].isNull())
 				{
 					const char* ssidPtr = doc[USB_COMMAND_STRING][i]["wifiSsid"];
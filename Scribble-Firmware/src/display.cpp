@@ -2,7 +2,16 @@
 #include	"hardware_def.h"
 #include "Adafruit_ST7789.h"
 #include "display.h"
+#include "framebuffer.h"
+#include "text_render.h"
+#include "preset_cache.h"
+#include "render_profiler.h"
+#include "marquee.h"
+#include "numeric_field.h"
 #include "main.h"
+#ifdef USE_LCD_DMA
+#include "lcd_dma.h"
+#endif
 
 static const char* DISPLAY_TAG = "DISPLAY";
 
@@ -10,6 +19,153 @@ Adafruit_ST7789 lcd = Adafruit_ST7789(LCD_CS_PIN, LCD_DC_PIN, LCD_RST_PIN);
 
 uint16_t clockTempoColour = ST77XX_WHITE; // Default clock tempo colour
 
+// Tempo readout, repainted a character cell at a time
+NumericField bpmField;
+
+// Pre-rendered beat indicator sprites, rebuilt when the colours they were drawn with change
+GFXcanvas16 beatSprites[NUM_BEAT_TYPES] =
+{
+	GFXcanvas16(BEAT_SPRITE_SIZE, BEAT_SPRITE_SIZE),
+	GFXcanvas16(BEAT_SPRITE_SIZE, BEAT_SPRITE_SIZE),
+	GFXcanvas16(BEAT_SPRITE_SIZE, BEAT_SPRITE_SIZE)
+};
+uint16_t beatSpriteColour = 0;
+uint16_t beatSpriteBackground = 0;
+bool beatSpritesValid = false;
+// Set once the tempo area has been handed over to the beat indicator, so tempo updates
+// leave it to the beat queue. Cleared whenever the tempo area is blanked or shows text
+bool beatIndicatorShown = false;
+uint16_t beatIndicatorColour = 0;
+
+// Every indicator state side by side, light mode in the top row and dark mode below
+// The colours are fixed, so the sheet is drawn once at boot
+GFXcanvas16 indicatorSprites = GFXcanvas16(INDICATOR_SPRITE_SIZE * NUM_INDICATOR_SPRITES, INDICATOR_SPRITE_SIZE * 2);
+
+typedef enum
+{
+	IndicatorOutline,
+	IndicatorFilled,
+	IndicatorOutlineDot
+} IndicatorShape;
+
+typedef struct
+{
+	uint16_t colour;
+	uint8_t shape;
+} IndicatorStyle;
+
+const IndicatorStyle indicatorStyles[NUM_INDICATOR_SPRITES] =
+{
+	{MIDI_INDICATOR_COLOUR,	IndicatorOutline},		// IndicatorMidiOff
+	{MIDI_INDICATOR_COLOUR,	IndicatorFilled},			// IndicatorMidiOn
+	{BLE_INDICATOR_COLOUR,	IndicatorOutline},		// IndicatorBleOff
+	{BLE_INDICATOR_COLOUR,	IndicatorFilled},			// IndicatorBleOn
+	{WIFI_INDICATOR_COLOUR,	IndicatorOutline},		// IndicatorWifiOff
+	{WIFI_INDICATOR_COLOUR,	IndicatorFilled},			// IndicatorWifiOn
+	{WIFI_INDICATOR_COLOUR,	IndicatorOutlineDot},	// IndicatorWifiAp
+	{ST77XX_WHITE,				IndicatorOutline},		// IndicatorNoneOff
+	{ST77XX_WHITE,				IndicatorFilled}			// IndicatorNoneOn
+};
+
+// Pre-measured text positions, indexed by font and preset
+// Filled by display_BuildLayoutCache() so preset switches never walk the glyph tables
+TextLayout layoutCache[NUM_LAYOUT_FONTS][NUM_PRESETS];
+// Set for presets whose name is too wide for the panel and scrolls instead
+bool presetNameScrolls[NUM_PRESETS];
+
+// Mark the bounding box of an indicator circle centred on x as needing a flush
+static void markIndicatorDirty(int16_t x)
+{
+	framebuffer_MarkDirty(x - CIRCLE_INDICATOR_SIZE, INDICATOR_Y - CIRCLE_INDICATOR_SIZE,
+								INDICATOR_SPRITE_SIZE, INDICATOR_SPRITE_SIZE);
+}
+
+// Draw an indicator circle centred on (x, y) with Adafruit_GFX primitives
+// Outlines clear their inside to the info bar colour first, except in auto mode
+static void rasterIndicator(Adafruit_GFX* target, int16_t x, int16_t y, uint8_t sprite, uint8_t uiMode)
+{
+	const IndicatorStyle* style = &indicatorStyles[sprite];
+	if(style->shape == IndicatorFilled)
+	{
+		target->fillCircle(x, y, CIRCLE_INDICATOR_SIZE, style->colour);
+		return;
+	}
+
+	if(uiMode == UI_MODE_DARK)
+	{
+		target->fillCircle(x, y, CIRCLE_INDICATOR_SIZE, ST77XX_BLACK);
+	}
+	else if(uiMode == UI_MODE_LIGHT)
+	{
+		target->fillCircle(x, y, CIRCLE_INDICATOR_SIZE, ST77XX_WHITE);
+	}
+	target->drawCircle(x, y, CIRCLE_INDICATOR_SIZE, style->colour);
+	if(style->shape == IndicatorOutlineDot)
+	{
+		target->fillCircle(x, y, CIRCLE_INDICATOR_SIZE/2, style->colour);
+	}
+}
+
+// Rasterise every indicator state for light and dark mode
+// Corners outside the circle take the info bar colour of that mode
+static void buildIndicatorSprites()
+{
+	if(indicatorSprites.getBuffer() == NULL)
+	{
+		ESP_LOGE(DISPLAY_TAG, "Failed to allocate indicator sprites");
+		return;
+	}
+	indicatorSprites.fillRect(0, UI_MODE_LIGHT * INDICATOR_SPRITE_SIZE, indicatorSprites.width(), INDICATOR_SPRITE_SIZE, ST77XX_WHITE);
+	indicatorSprites.fillRect(0, UI_MODE_DARK * INDICATOR_SPRITE_SIZE, indicatorSprites.width(), INDICATOR_SPRITE_SIZE, ST77XX_BLACK);
+	for(uint8_t i=0; i<NUM_INDICATOR_SPRITES; i++)
+	{
+		int16_t x = i * INDICATOR_SPRITE_SIZE + CIRCLE_INDICATOR_SIZE;
+		rasterIndicator(&indicatorSprites, x, UI_MODE_LIGHT * INDICATOR_SPRITE_SIZE + CIRCLE_INDICATOR_SIZE, i, UI_MODE_LIGHT);
+		rasterIndicator(&indicatorSprites, x, UI_MODE_DARK * INDICATOR_SPRITE_SIZE + CIRCLE_INDICATOR_SIZE, i, UI_MODE_DARK);
+	}
+}
+
+// Copy an indicator state into the info bar, centred on x
+// Auto mode has no fixed info bar colour to bake in, so it still draws the circles
+static void drawIndicator(int16_t x, uint8_t sprite)
+{
+	uint8_t uiMode = globalSettings.uiLightMode;
+	uint16_t* out = framebuffer.getBuffer();
+	const uint16_t* sheet = indicatorSprites.getBuffer();
+	if((uiMode == UI_MODE_LIGHT || uiMode == UI_MODE_DARK) && out != NULL && sheet != NULL)
+	{
+		int16_t sheetWidth = indicatorSprites.width();
+		sheet += uiMode * INDICATOR_SPRITE_SIZE * sheetWidth + sprite * INDICATOR_SPRITE_SIZE;
+		out += (INDICATOR_Y - CIRCLE_INDICATOR_SIZE) * LCD_WIDTH + x - CIRCLE_INDICATOR_SIZE;
+		for(int16_t row=0; row<INDICATOR_SPRITE_SIZE; row++)
+		{
+			memcpy(&out[row * LCD_WIDTH], &sheet[row * sheetWidth], INDICATOR_SPRITE_SIZE * 2);
+		}
+	}
+	else
+	{
+		rasterIndicator(&framebuffer, x, INDICATOR_Y, sprite, uiMode);
+	}
+	markIndicatorDirty(x);
+}
+
+// Measure a string and centre it horizontally on the given baseline
+static TextLayout measureCentredText(const char* text, const GFXfont* font, int16_t yOffset)
+{
+	TextLayout layout;
+	int16_t  x1, y1;
+	uint16_t w, h;
+	framebuffer.setFont(font);
+	framebuffer.getTextBounds(text, PRESET_NAME_X_OFFSET, yOffset, &x1, &y1, &w, &h);
+	layout.cursorX = LCD_WIDTH/2 - w/2;
+	layout.cursorY = yOffset;
+	layout.boundsX = layout.cursorX + (x1 - PRESET_NAME_X_OFFSET);
+	layout.boundsY = y1;
+	layout.w = w;
+	layout.h = h;
+	return layout;
+}
+
 void display_Init()
 {
 	// Set the display brightness
@@ -18,6 +174,14 @@ void display_Init()
 	SPI.begin(SPI_SCK_PIN, -1, SPI_MOSI_PIN, -1);
 	lcd.init(172, 320);           // Init ST7789 172x320
 	lcd.setRotation(3); // rotates the screen
+#ifdef USE_LCD_DMA
+	// Panel is configured, hand the bus to the DMA strip writer
+	lcdDma_Init(&lcd);
+#endif
+	framebuffer_Init();
+	presetCache_Init();
+	buildIndicatorSprites();
+	numericField_Init(&bpmField, BPM_X_OFFSET, 0, 100, INFO_BAR_HEIGHT, BPM_X_OFFSET, BPM_Y_OFFSET, &BPM_FONT);
   	
 	// Default clock tempo colour
 	if(globalSettings.uiLightMode == UI_MODE_DARK)
@@ -29,6 +193,7 @@ void display_Init()
 		clockTempoColour = ST77XX_BLACK;
 	}
 	display_DrawMainScreen();
+	display_Flush();
 }
 
 void display_SetBrightness(uint8_t value)
@@ -44,36 +209,44 @@ void display_ConfigureNewDeviceScreen()
 	int16_t yOffset;
 	// Set the display brightness
 	analogWrite(LCD_BL_PIN, 255);
-	lcd.fillRect(0, 0, LCD_WIDTH, LCD_HEIGHT, ST77XX_BLACK);
-	lcd.setFont(&INFO_TEXT_FONT);
-	lcd.setTextColor(ST77XX_WHITE);
-
-	lcd.setCursor(PRESET_NAME_X_OFFSET, PRESET_NAME_Y_TOP_OFFSET);
-	lcd.getTextBounds("Configuring default", PRESET_NAME_X_OFFSET, yOffset, &x1, &y1, &w, &h);
-	lcd.setCursor(LCD_WIDTH/2 - w/2, PRESET_NAME_Y_TOP_OFFSET);
-	lcd.print("Configuring default");
-
-	lcd.setCursor(PRESET_NAME_X_OFFSET, PRESET_NAME_Y_BOTTOM_OFFSET);
-	lcd.getTextBounds("device settings...", PRESET_NAME_X_OFFSET, yOffset, &x1, &y1, &w, &h);
-	lcd.setCursor(LCD_WIDTH/2 - w/2, PRESET_NAME_Y_BOTTOM_OFFSET);
-	lcd.print("device settings...");
+	framebuffer.fillRect(0, 0, LCD_WIDTH, LCD_HEIGHT, ST77XX_BLACK);
+	framebuffer_MarkAllDirty();
+	numericField_Invalidate(&bpmField);
+	beatIndicatorShown = false;
+	framebuffer.setFont(&INFO_TEXT_FONT);
+	framebuffer.setTextColor(ST77XX_WHITE);
+
+	framebuffer.setCursor(PRESET_NAME_X_OFFSET, PRESET_NAME_Y_TOP_OFFSET);
+	framebuffer.getTextBounds("Configuring default", PRESET_NAME_X_OFFSET, yOffset, &x1, &y1, &w, &h);
+	framebuffer.setCursor(LCD_WIDTH/2 - w/2, PRESET_NAME_Y_TOP_OFFSET);
+	framebuffer.print("Configuring default");
+
+	framebuffer.setCursor(PRESET_NAME_X_OFFSET, PRESET_NAME_Y_BOTTOM_OFFSET);
+	framebuffer.getTextBounds("device settings...", PRESET_NAME_X_OFFSET, yOffset, &x1, &y1, &w, &h);
+	framebuffer.setCursor(LCD_WIDTH/2 - w/2, PRESET_NAME_Y_BOTTOM_OFFSET);
+	framebuffer.print("device settings...");
+	display_Flush();
 }
 
 void display_DrawMainScreen()
 {
+	ProfileMark profileMark = renderProfiler_Begin();
 	// Draw main colour boxes
 	if(globalSettings.uiLightMode == UI_MODE_DARK)
 	{
-		lcd.fillRect(0, 0, 320, LCD_HEIGHT-MAIN_FILL_HEIGHT, ST77XX_BLACK);
+		framebuffer.fillRect(0, 0, 320, LCD_HEIGHT-MAIN_FILL_HEIGHT, ST77XX_BLACK);
 	}
 	else if(globalSettings.uiLightMode == UI_MODE_LIGHT)
 	{
-		lcd.fillRect(0, 0, 320, LCD_HEIGHT-MAIN_FILL_HEIGHT, ST77XX_WHITE);
+		framebuffer.fillRect(0, 0, 320, LCD_HEIGHT-MAIN_FILL_HEIGHT, ST77XX_WHITE);
 	}
+	framebuffer_MarkDirty(0, 0, LCD_WIDTH, INFO_BAR_HEIGHT);
+	numericField_Invalidate(&bpmField);
+	beatIndicatorShown = false;
 
 	// Draw info bar
 	display_DrawPresetNumber(globalSettings.currentPreset);
-	//lcd.print(128);
+	//framebuffer.print(128);
 	float bpmTest = 120.0;
 	display_DrawBpm(bpmTest);
 
@@ -91,65 +264,133 @@ void display_DrawMainScreen()
 	display_DrawMidiIndicator(false);
 
 	// Draw main text
-	display_DrawMainText(presets[globalSettings.currentPreset].name, presets[globalSettings.currentPreset].secondaryText);
+	display_DrawPresetText(globalSettings.currentPreset);
+	renderProfiler_End(ProfileDrawMainScreen, &profileMark);
 }
 
-// Draw a black rectangle around the preset number area to clear previous text
-// Then write the new preset number
+// Clear the preset number area and write the new preset number in one pass
 void display_DrawPresetNumber(uint16_t	 presetNumber)
 {
-	int16_t  x1, y1;
-	uint16_t w, h;
-	int16_t yOffset;
-	if(globalSettings.uiLightMode == UI_MODE_DARK)
+	ProfileMark profileMark = renderProfiler_Begin();
+	TextLine line = {NULL, &PRESET_NUM_FONT, 0, 0, ST77XX_WHITE};
+	uint16_t background = ST77XX_BLACK;
+	if(globalSettings.uiLightMode == UI_MODE_LIGHT)
 	{
-		lcd.fillRect(LCD_WIDTH-100, 0, 100, INFO_BAR_HEIGHT, ST77XX_BLACK);
-		lcd.setTextColor(ST77XX_WHITE);
+		background = ST77XX_WHITE;
+		line.colour = ST77XX_BLACK;
 	}
-	else if(globalSettings.uiLightMode == UI_MODE_LIGHT)
+
+	char presetNumString[4];
+	if(presetNumber < NUM_PRESETS)
 	{
-		lcd.fillRect(LCD_WIDTH-100, 0, 100, INFO_BAR_HEIGHT, ST77XX_WHITE);
-		lcd.setTextColor(ST77XX_BLACK);
+		sprintf(presetNumString, "%d", presetNumber + 1);
+		line.text = presetNumString;
+		line.cursorX = layoutCache[LayoutPresetNumber][presetNumber].cursorX;
+		line.cursorY = layoutCache[LayoutPresetNumber][presetNumber].cursorY;
 	}
-	
-	char presetNumString[4];
-	sprintf(presetNumString, "%d", presetNumber + 1);
-
-	lcd.setFont(&PRESET_NUM_FONT);
-	lcd.setCursor(PRESET_NUM_X_OFFSET, PRESET_NUM_Y_OFFSET);
-	lcd.getTextBounds(presetNumString, 0, PRESET_NUM_Y_OFFSET, &x1, &y1, &w, &h);
-	lcd.setCursor((PRESET_NUM_X_OFFSET) - w, PRESET_NUM_Y_OFFSET);
-	lcd.print(presetNumString);
+	textRender_Fill(LCD_WIDTH-100, 0, 100, INFO_BAR_HEIGHT, background, &line, 1);
+	renderProfiler_End(ProfileDrawPresetNumber, &profileMark);
 }
 
-// Draw a coloured rectangle around the preset number area to clear previous text
-// Then write the new preset name and secondary text
+// Write the new BPM or beat period, repainting only the characters that changed
+// The tempo area is left blank for the beat indicator
 void display_DrawBpm(float value)
 {
-	if(globalSettings.uiLightMode == UI_MODE_DARK)
+	ProfileMark profileMark = renderProfiler_Begin();
+	uint16_t background = ST77XX_BLACK;
+	if(globalSettings.uiLightMode == UI_MODE_LIGHT)
 	{
-		lcd.fillRect(BPM_X_OFFSET, 0, 100, INFO_BAR_HEIGHT, ST77XX_BLACK);
+		background = ST77XX_WHITE;
 	}
-	else if(globalSettings.uiLightMode == UI_MODE_LIGHT)
-	{
-		lcd.fillRect(BPM_X_OFFSET, 0, 100, INFO_BAR_HEIGHT, ST77XX_WHITE);
-	}
-	lcd.setFont(&BPM_FONT);
-	lcd.setTextColor(clockTempoColour);
-	lcd.setCursor(BPM_X_OFFSET, BPM_Y_OFFSET);
-	char bpmString[6];
+
+	char bpmString[NUMERIC_FIELD_MAX_CHARS + 1] = "";
 	if(globalSettings.clockDisplayType == MIDI_CLOCK_DISPLAY_BPM)
 	{
-		sprintf(bpmString, "%.1f", value);
-		lcd.print(bpmString);
+		snprintf(bpmString, sizeof(bpmString), "%.1f", value);
 	}
 	else if(globalSettings.clockDisplayType == MIDI_CLOCK_DISPLAY_MS)
 	{
-		sprintf(bpmString, "%.0fms", (60000.0 / value));
-		lcd.print(bpmString);
+		snprintf(bpmString, sizeof(bpmString), "%.0fms", (60000.0 / value));
+	}
+	if(globalSettings.clockDisplayType != MIDI_CLOCK_DISPLAY_INDICATOR && beatIndicatorShown)
+	{
+		// Leaving indicator mode, the beat sprite has drawn over the field
+		numericField_Invalidate(&bpmField);
+		beatIndicatorShown = false;
+	}
+	numericField_Draw(&bpmField, bpmString, clockTempoColour, background);
+
+	// The flashing indicator starts on its off sprite. After that the beat queue owns it,
+	// so a tempo change never paints over a flash. It is only redrawn here if the colour changes
+	if(globalSettings.clockDisplayType == MIDI_CLOCK_DISPLAY_INDICATOR)
+	{
+		if(!beatIndicatorShown || beatIndicatorColour != clockTempoColour)
+		{
+			display_DrawBeatIndicator(BeatOff);
+			beatIndicatorShown = true;
+			beatIndicatorColour = clockTempoColour;
+		}
+	}
+	renderProfiler_End(ProfileDrawBpm, &profileMark);
+}
+
+static void buildBeatSprites(uint16_t colour, uint16_t background)
+{
+	int16_t centre = BEAT_SPRITE_SIZE/2;
+	for(uint8_t i=0; i<NUM_BEAT_TYPES; i++)
+	{
+		beatSprites[i].fillScreen(background);
+	}
+	beatSprites[BeatOff].drawCircle(centre, centre, BEAT_DOWNBEAT_RADIUS, colour);
+	beatSprites[BeatQuarter].drawCircle(centre, centre, BEAT_DOWNBEAT_RADIUS, colour);
+	beatSprites[BeatQuarter].fillCircle(centre, centre, BEAT_QUARTER_RADIUS, colour);
+	beatSprites[BeatDownbeat].fillCircle(centre, centre, BEAT_DOWNBEAT_RADIUS, colour);
+
+	beatSpriteColour = colour;
+	beatSpriteBackground = background;
+	beatSpritesValid = true;
+}
+
+// Copy one of the pre-rendered beat sprites into the tempo area
+// A downbeat is a filled circle, other quarter notes a smaller dot inside the ring
+void display_DrawBeatIndicator(uint8_t type)
+{
+	if(type >= NUM_BEAT_TYPES)
+		return;
+
+	ProfileMark profileMark = renderProfiler_Begin();
+	uint16_t background = ST77XX_BLACK;
+	if(globalSettings.uiLightMode == UI_MODE_LIGHT)
+	{
+		background = ST77XX_WHITE;
+	}
+	if(!beatSpritesValid || beatSpriteColour != clockTempoColour || beatSpriteBackground != background)
+	{
+		buildBeatSprites(clockTempoColour, background);
+	}
+
+	uint16_t* out = framebuffer.getBuffer();
+	const uint16_t* sprite = beatSprites[type].getBuffer();
+	if(out != NULL && sprite != NULL)
+	{
+		out += BEAT_SPRITE_Y_OFFSET * LCD_WIDTH + BEAT_SPRITE_X_OFFSET;
+		for(int16_t row=0; row<BEAT_SPRITE_SIZE; row++)
+		{
+			memcpy(&out[row * LCD_WIDTH], &sprite[row * BEAT_SPRITE_SIZE], BEAT_SPRITE_SIZE * 2);
+		}
+		framebuffer_MarkDirty(BEAT_SPRITE_X_OFFSET, BEAT_SPRITE_Y_OFFSET, BEAT_SPRITE_SIZE, BEAT_SPRITE_SIZE);
 	}
+	renderProfiler_End(ProfileDrawBeatIndicator, &profileMark);
+}
 
-	// Ignore for a flashing indicator as that is handled in the indicator task
+// Push everything drawn since the last flush to the LCD
+// Returns the number of pixel bytes sent over SPI
+uint32_t display_Flush()
+{
+	uint32_t start = micros();
+	uint32_t bytes = framebuffer_Flush(&lcd);
+	renderProfiler_Record(ProfileFlush, micros() - start, bytes / 2);
+	return bytes;
 }
 
 void display_SetBpmDrawColour(uint16_t colour)
@@ -157,31 +398,58 @@ void display_SetBpmDrawColour(uint16_t colour)
 	clockTempoColour = colour;
 }
 
-void display_DrawMainText(const char* text, const char* secondaryText)
+// Work out the main area colours and text lines for already measured text
+// Either layout may be NULL if that line is not drawn. Returns the number of lines
+static uint8_t buildMainText(	uint16_t presetIndex, const char* text, const TextLayout* textLayout,
+										const char* secondaryText, const TextLayout* secondaryLayout,
+										TextLine* lines, uint16_t* background)
 {
-	int16_t  x1, y1;
-	uint16_t w, h;
-	int16_t yOffset;
 	// Check to use the global colour or the preset override colour
-	if(presets[globalSettings.currentPreset].colourOverrideFlag)
+	*background = globalSettings.mainColour;
+	if(presets[presetIndex].colourOverrideFlag)
 	{
-		lcd.fillRect(0, LCD_HEIGHT-MAIN_FILL_HEIGHT, 320, MAIN_FILL_HEIGHT, presets[globalSettings.currentPreset].colourOverride);
+		*background = presets[presetIndex].colourOverride;
 	}
-	else
+	// Check for the preset text override colour
+	uint16_t textColour = globalSettings.textColour;
+	if(presets[presetIndex].textColourOverrideFlag)
 	{
-		lcd.fillRect(0, LCD_HEIGHT-MAIN_FILL_HEIGHT, 320, MAIN_FILL_HEIGHT, globalSettings.mainColour);
+		textColour = presets[presetIndex].textColourOverride;
 	}
-	// Check for the preset text override colour
-	if(presets[globalSettings.currentPreset].textColourOverrideFlag)
+
+	// Main text, then secondary text if available
+	uint8_t numLines = 0;
+	if(text != NULL && textLayout != NULL)
 	{
-		lcd.setTextColor(presets[globalSettings.currentPreset].textColourOverride);
+		lines[numLines++] = {text, &PRESET_NAME_FONT, textLayout->cursorX, textLayout->cursorY, textColour};
 	}
-	else
+	if(secondaryText != NULL && secondaryLayout != NULL)
 	{
-		lcd.setTextColor(globalSettings.textColour);
+		lines[numLines++] = {secondaryText, &SECONDARY_TEXT_FONT, secondaryLayout->cursorX, secondaryLayout->cursorY, textColour};
 	}
-	
-	// Draw main text
+	return numLines;
+}
+
+// Fill the main area and draw already measured text on top of it
+static void drawMainText(	uint16_t presetIndex, const char* text, const TextLayout* textLayout,
+									const char* secondaryText, const TextLayout* secondaryLayout)
+{
+	TextLine lines[2];
+	uint16_t background;
+	uint8_t numLines = buildMainText(presetIndex, text, textLayout, secondaryText, secondaryLayout, lines, &background);
+	textRender_Fill(0, LCD_HEIGHT-MAIN_FILL_HEIGHT, LCD_WIDTH, MAIN_FILL_HEIGHT, background, lines, numLines);
+}
+
+// Draw arbitrary main and secondary text, measuring it on every call
+// Preset names should use display_DrawPresetText() which uses the layout cache
+void display_DrawMainText(const char* text, const char* secondaryText)
+{
+	ProfileMark profileMark = renderProfiler_Begin();
+	marquee_Stop();
+	TextLayout textLayout;
+	TextLayout secondaryLayout;
+	int16_t yOffset;
+
 	if(text != NULL)
 	{
 		// If no secondary text is used, centre the main text
@@ -191,121 +459,139 @@ void display_DrawMainText(const char* text, const char* secondaryText)
 		else
 			yOffset = PRESET_NAME_Y_TOP_OFFSET;
 
-		lcd.setFont(&PRESET_NAME_FONT);
-		lcd.setCursor(PRESET_NAME_X_OFFSET, yOffset);
-		lcd.getTextBounds(text, PRESET_NAME_X_OFFSET, yOffset, &x1, &y1, &w, &h);
-		lcd.setCursor(LCD_WIDTH/2 - w/2, yOffset);
-		lcd.print(text);
+		textLayout = measureCentredText(text, &PRESET_NAME_FONT, yOffset);
 	}
-	// Draw secondary text if available
 	if(secondaryText != NULL)
 	{
-		yOffset = PRESET_NAME_Y_BOTTOM_OFFSET;
-		lcd.setFont(&SECONDARY_TEXT_FONT);
-		lcd.setCursor(PRESET_NAME_X_OFFSET, yOffset);
-		lcd.getTextBounds(secondaryText, PRESET_NAME_X_OFFSET, yOffset, &x1, &y1, &w, &h);
-		lcd.setCursor(LCD_WIDTH/2 - w/2, yOffset);
-		lcd.print(secondaryText);
+		secondaryLayout = measureCentredText(secondaryText, &SECONDARY_TEXT_FONT, PRESET_NAME_Y_BOTTOM_OFFSET);
 	}
+	drawMainText(globalSettings.currentPreset, text, &textLayout, secondaryText, &secondaryLayout);
+	renderProfiler_End(ProfileDrawMainText, &profileMark);
 }
 
-void display_DrawMidiIndicator(bool active)
+// The main area lines and colours for a preset, as display_DrawPresetText() draws them
+// A scrolling name is left out. lines must have room for two entries. Returns the number of lines
+uint8_t display_GetPresetText(uint16_t presetIndex, TextLine* lines, uint16_t* background)
 {
-	if(active)
+	const char* name = presetNameScrolls[presetIndex] ? NULL : presets[presetIndex].name;
+	return buildMainText(	presetIndex,
+									name, &layoutCache[LayoutPresetName][presetIndex],
+									presets[presetIndex].secondaryText, &layoutCache[LayoutSecondaryText][presetIndex],
+									lines, background);
+}
+
+// Draw a preset's name and secondary text, from the preset cache when it has
+// the preset ready and using the pre-measured layouts otherwise
+// A name too wide for the panel is drawn by the marquee and scrolls from there
+void display_DrawPresetText(uint16_t presetIndex)
+{
+	if(presetIndex >= NUM_PRESETS)
+		return;
+
+	ProfileMark profileMark = renderProfiler_Begin();
+	const char* name = presetNameScrolls[presetIndex] ? NULL : presets[presetIndex].name;
+	if(!presetCache_Blit(presetIndex))
+	{
+		drawMainText(	presetIndex,
+							name, &layoutCache[LayoutPresetName][presetIndex],
+							presets[presetIndex].secondaryText, &layoutCache[LayoutSecondaryText][presetIndex]);
+	}
+
+	if(presetNameScrolls[presetIndex])
 	{
-		lcd.fillCircle((LCD_WIDTH/2) - (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, MIDI_INDICATOR_COLOUR);
+		TextLine lines[2];
+		uint16_t background;
+		buildMainText(	presetIndex, presets[presetIndex].name, &layoutCache[LayoutPresetName][presetIndex],
+							NULL, NULL, lines, &background);
+		marquee_Start(&lines[0], background, millis());
 	}
 	else
 	{
-		if(globalSettings.uiLightMode == UI_MODE_DARK)
-		{
-			lcd.fillCircle((LCD_WIDTH/2) - (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_BLACK);
-		}
-		else if(globalSettings.uiLightMode == UI_MODE_LIGHT)
-		{
-			lcd.fillCircle((LCD_WIDTH/2) - (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_WHITE);
-		}
-		lcd.drawCircle((LCD_WIDTH/2) - (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, MIDI_INDICATOR_COLOUR);
+		marquee_Stop();
+	}
+	renderProfiler_End(ProfileDrawPresetText, &profileMark);
+}
+
+// Measure the name, secondary text and number of a single preset
+// Uses the framebuffer's font, so once the render task is running only it may call this.
+// Other tasks post edits with display_QueueLayout()
+void display_UpdateLayoutCache(uint16_t presetIndex)
+{
+	if(presetIndex >= NUM_PRESETS)
+		return;
+
+	// Presets always pass secondary text, so the name sits in the top position
+	layoutCache[LayoutPresetName][presetIndex] =
+		measureCentredText(presets[presetIndex].name, &PRESET_NAME_FONT, PRESET_NAME_Y_TOP_OFFSET);
+	layoutCache[LayoutSecondaryText][presetIndex] =
+		measureCentredText(presets[presetIndex].secondaryText, &SECONDARY_TEXT_FONT, PRESET_NAME_Y_BOTTOM_OFFSET);
+	presetNameScrolls[presetIndex] = !marquee_Fits(presets[presetIndex].name, &PRESET_NAME_FONT);
+
+	// The preset number is right aligned against PRESET_NUM_X_OFFSET
+	int16_t  x1, y1;
+	uint16_t w, h;
+	char presetNumString[4];
+	sprintf(presetNumString, "%d", presetIndex + 1);
+	framebuffer.setFont(&PRESET_NUM_FONT);
+	framebuffer.getTextBounds(presetNumString, 0, PRESET_NUM_Y_OFFSET, &x1, &y1, &w, &h);
+	TextLayout* numLayout = &layoutCache[LayoutPresetNumber][presetIndex];
+	numLayout->cursorX = (PRESET_NUM_X_OFFSET) - w;
+	numLayout->cursorY = PRESET_NUM_Y_OFFSET;
+	numLayout->boundsX = numLayout->cursorX + x1;
+	numLayout->boundsY = y1;
+	numLayout->w = w;
+	numLayout->h = h;
+}
+
+// Measure every preset. Call once the presets have been read from storage
+void display_BuildLayoutCache()
+{
+	for(uint16_t i=0; i<NUM_PRESETS; i++)
+	{
+		display_UpdateLayoutCache(i);
 	}
 }
 
+void display_DrawMidiIndicator(bool active)
+{
+	ProfileMark profileMark = renderProfiler_Begin();
+	drawIndicator(MIDI_INDICATOR_X, active ? IndicatorMidiOn : IndicatorMidiOff);
+	renderProfiler_End(ProfileDrawMidiIndicator, &profileMark);
+}
+
 // Type: 0 = is None, 1 = BLE, 2 = WiFi
-// State: 0 = disconnected, 1 = connected, 2 = AP (WiFi only)
+// State: 0 = disconnected, 1 = connected, 2 = AP (WiFi only), 3 = outline with dot (WiFi only)
 void display_DrawWirelessIndicator(uint8_t type, uint8_t state)
 {
+	ProfileMark profileMark = renderProfiler_Begin();
+	uint8_t sprite = NUM_INDICATOR_SPRITES;
 	if(type == Esp32BLE)
 	{
 		if(state == 0)
-		{
-			if(globalSettings.uiLightMode == UI_MODE_DARK)
-			{
-				lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_BLACK);
-			}
-			else if(globalSettings.uiLightMode == UI_MODE_LIGHT)
-			{
-				lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_WHITE);
-			}
-			lcd.drawCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, BLE_INDICATOR_COLOUR);
-		}
+			sprite = IndicatorBleOff;
 		else if(state == 1)
-		{
-			lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, BLE_INDICATOR_COLOUR);
-		}
+			sprite = IndicatorBleOn;
 	}
 	else if(type == Esp32WiFi)
 	{
-		// Circle outline
 		if(state == 0)
-		{
-			if(globalSettings.uiLightMode == UI_MODE_DARK)
-			{
-				lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_BLACK);
-			}
-			else if(globalSettings.uiLightMode == UI_MODE_LIGHT)
-			{
-				lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_WHITE);
-			}
-			lcd.drawCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, WIFI_INDICATOR_COLOUR);
-		}
-		// Solid circle
+			sprite = IndicatorWifiOff;
 		else if(state == 1 || state == 2)
-		{
-			lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, WIFI_INDICATOR_COLOUR);
-		}
-		// Circle outline with dot in the middle
+			sprite = IndicatorWifiOn;
 		else if(state == 3)
-		{
-			if(globalSettings.uiLightMode == UI_MODE_DARK)
-			{
-				lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_BLACK);
-			}
-			else if(globalSettings.uiLightMode == UI_MODE_LIGHT)
-			{
-				lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_WHITE);
-			}
-			lcd.drawCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, WIFI_INDICATOR_COLOUR);
-			lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE/2, WIFI_INDICATOR_COLOUR);
-		}
-		
+			sprite = IndicatorWifiAp;
 	}
 	else if(type == Esp32None)
 	{
 		if(state == 0)
-		{
-			if(globalSettings.uiLightMode == UI_MODE_DARK)
-			{
-				lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_BLACK);
-			}
-			else if(globalSettings.uiLightMode == UI_MODE_LIGHT)
-			{
-				lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_WHITE);
-			}
-			
-			lcd.drawCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_WHITE);
-		}
+			sprite = IndicatorNoneOff;
 		else if(state == 1)
-		{
-			lcd.fillCircle((LCD_WIDTH/2) + (CIRCLE_INDICATOR_SIZE + CIRCLE_INDIACTOR_X_OFFSET), (INFO_BAR_HEIGHT)/2, CIRCLE_INDICATOR_SIZE, ST77XX_WHITE);
-		}
+			sprite = IndicatorNoneOn;
 	}
+
+	if(sprite < NUM_INDICATOR_SPRITES)
+		drawIndicator(WIRELESS_INDICATOR_X, sprite);
+	else
+		markIndicatorDirty(WIRELESS_INDICATOR_X);
+	renderProfiler_End(ProfileDrawWirelessIndicator, &profileMark);
 }
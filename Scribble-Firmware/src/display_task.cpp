@@ -0,0 +1,323 @@
+#include "Arduino.h"
+#include "display_task.h"
+#include "display.h"
+#include "preset_cache.h"
+#include "render_profiler.h"
+#include "marquee.h"
+#include "main.h"
+#include "task_priorities.h"
+
+static const char* DISPLAY_TASK_TAG = "DISPLAY TASK";
+
+TaskHandle_t displayTaskHandle = NULL;
+QueueHandle_t beatQueue = NULL;
+
+// One slot per command type. A set bit in pendingCommands means the slot holds
+// a request the render task has not drawn yet
+DisplayCommand pendingCommandSlots[NUM_DISPLAY_COMMANDS];
+uint32_t pendingCommands = 0;
+// Presets waiting to be re-measured. Only the render task touches the layout cache and the
+// framebuffer's font, so edits from other tasks are handed over here
+uint32_t pendingLayouts[(NUM_PRESETS + 31) / 32];
+portMUX_TYPE displayCommandMux = portMUX_INITIALIZER_UNLOCKED;
+
+DisplayTaskStats displayTaskStats;
+
+// Which profiler context each command's draws are charged to
+const uint8_t commandProfileContexts[NUM_DISPLAY_COMMANDS] = {	ProfileCtxOther,
+																					ProfileCtxPresetChange,
+																					ProfileCtxClock,
+																					ProfileCtxIndicator,
+																					ProfileCtxIndicator,
+																					ProfileCtxPresetChange};
+
+void display_TaskInit()
+{
+	memset(&displayTaskStats, 0, sizeof(DisplayTaskStats));
+	memset(pendingLayouts, 0, sizeof(pendingLayouts));
+	beatQueue = xQueueCreate(DISPLAY_BEAT_QUEUE_LENGTH, sizeof(BeatEvent));
+	BaseType_t taskResult = xTaskCreatePinnedToCore(
+		display_Task, // Task function. 
+		"Display Task", // name of task. 
+		5000, // Stack size of task 
+		NULL, // parameter of the task 
+		DISPLAY_TASK_PRIORITY, // priority of the task 
+		&displayTaskHandle, // Task handle to keep track of created task 
+		1); // pin task to core 1 
+	ESP_LOGI(DISPLAY_TASK_TAG, "Display task created: %d", taskResult);
+}
+
+// Store a command, replacing any pending command of the same type, and wake the render task
+static void postCommand(DisplayCommandType type, DisplayCommand* command)
+{
+	uint32_t now = micros();
+	portENTER_CRITICAL(&displayCommandMux);
+	displayTaskStats.commands[type].posted++;
+	if(pendingCommands & (1 << type))
+	{
+		// Keep the original post time so latency covers the whole wait
+		command->postedAt = pendingCommandSlots[type].postedAt;
+		displayTaskStats.commands[type].coalesced++;
+	}
+	else if(command->postedAt == 0)
+	{
+		command->postedAt = now;
+	}
+	pendingCommandSlots[type] = *command;
+	pendingCommands |= (1 << type);
+	portEXIT_CRITICAL(&displayCommandMux);
+
+	if(displayTaskHandle != NULL)
+	{
+		xTaskNotifyGive(displayTaskHandle);
+	}
+}
+
+static void renderCommand(DisplayCommandType type, const DisplayCommand* command)
+{
+	switch(type)
+	{
+		case DisplayCmdMainScreen:
+			display_DrawMainScreen();
+		break;
+
+		case DisplayCmdPreset:
+			display_DrawPresetNumber(command->value);
+			display_DrawPresetText(command->value);
+		break;
+
+		case DisplayCmdBpm:
+			display_DrawBpm(command->bpm);
+		break;
+
+		case DisplayCmdMidiIndicator:
+			display_DrawMidiIndicator(command->value);
+		break;
+
+		case DisplayCmdWirelessIndicator:
+			display_DrawWirelessIndicator(command->param, command->value);
+		break;
+
+		default:
+		break;
+	}
+}
+
+// Measure every preset flagged since the last batch. Cached frames were drawn
+// with the old layouts, so they are thrown away once the new ones are in
+static void updateLayouts(const uint32_t* layouts)
+{
+	for(uint8_t word=0; word<(NUM_PRESETS + 31) / 32; word++)
+	{
+		uint32_t bits = layouts[word];
+		while(bits)
+		{
+			display_UpdateLayoutCache(word * 32 + __builtin_ctz(bits));
+			bits &= bits - 1;
+		}
+	}
+	presetCache_Invalidate();
+}
+
+// The render task is the only owner of the LCD once the main screen is up
+// Every batch of pending commands is composed into the framebuffer and flushed once
+void display_Task(void* parameter)
+{
+	ESP_LOGI(DISPLAY_TASK_TAG, "Display task started");
+	DisplayCommand commands[NUM_DISPLAY_COMMANDS];
+	uint32_t layouts[(NUM_PRESETS + 31) / 32];
+	uint32_t batch;
+	while(1)
+	{
+		// Fill the preset cache whenever there is nothing to draw
+		// Sleep until the next command, or the next marquee step if a name is scrolling
+		if(ulTaskNotifyTake(pdTRUE, 0) == 0 && marquee_MsUntilStep(millis()) > 0)
+		{
+			if(presetCache_Work())
+				continue;
+			uint32_t wait = marquee_MsUntilStep(millis());
+			ulTaskNotifyTake(pdTRUE, wait == MARQUEE_IDLE ? portMAX_DELAY : pdMS_TO_TICKS(wait));
+		}
+
+		// Beats go out ahead of everything else, one flush each, so the delay from
+		// the clock tick is bounded by a single small flush
+		BeatEvent beat;
+		if(beatQueue != NULL && xQueueReceive(beatQueue, &beat, 0) == pdTRUE)
+		{
+			renderProfiler_SetContext(ProfileCtxClock);
+			display_DrawBeatIndicator(beat.type);
+			display_Flush();
+			renderProfiler_SetContext(ProfileCtxOther);
+			displayTaskStats.beatsRendered++;
+			displayTaskStats.beatLatencyUsLast = micros() - beat.tickTime;
+			if(displayTaskStats.beatLatencyUsLast > displayTaskStats.beatLatencyUsMax)
+				displayTaskStats.beatLatencyUsMax = displayTaskStats.beatLatencyUsLast;
+			if(beat.type == BeatDownbeat)
+			{
+				ESP_LOGD(DISPLAY_TASK_TAG, "Tick to photon %dus (max %dus)",
+							displayTaskStats.beatLatencyUsLast, displayTaskStats.beatLatencyUsMax);
+			}
+			// Come straight back for the rest so every state gets its own frame
+			if(uxQueueMessagesWaiting(beatQueue) > 0)
+				xTaskNotifyGive(displayTaskHandle);
+		}
+
+		// Take a snapshot of everything pending so posting never waits on drawing
+		portENTER_CRITICAL(&displayCommandMux);
+		batch = pendingCommands;
+		pendingCommands = 0;
+		memcpy(commands, pendingCommandSlots, sizeof(commands));
+		memcpy(layouts, pendingLayouts, sizeof(layouts));
+		memset(pendingLayouts, 0, sizeof(pendingLayouts));
+		portEXIT_CRITICAL(&displayCommandMux);
+
+		// Layouts go first so nothing in this batch is drawn with the old ones
+		// Nothing is drawn by this alone, so it never needs a flush of its own
+		if(batch & (1 << DisplayCmdLayout))
+		{
+			uint32_t start = micros();
+			updateLayouts(layouts);
+			uint32_t elapsed = micros() - start;
+			displayTaskStats.commands[DisplayCmdLayout].rendered++;
+			displayTaskStats.commands[DisplayCmdLayout].renderUsLast = elapsed;
+			if(elapsed > displayTaskStats.commands[DisplayCmdLayout].renderUsMax)
+				displayTaskStats.commands[DisplayCmdLayout].renderUsMax = elapsed;
+			batch &= ~(1 << DisplayCmdLayout);
+		}
+
+		// A scrolling name moves on its own timer and shares the flush with any commands
+		bool marqueeStepped = marquee_Step(millis());
+
+		if(batch == 0)
+		{
+			if(marqueeStepped)
+				display_Flush();
+			continue;
+		}
+
+		uint8_t depth = __builtin_popcount(batch);
+		displayTaskStats.queueDepth = depth;
+		if(depth > displayTaskStats.queueDepthPeak)
+			displayTaskStats.queueDepthPeak = depth;
+
+		// A full redraw already covers every other command
+		if(batch & (1 << DisplayCmdMainScreen))
+		{
+			batch = (1 << DisplayCmdMainScreen);
+		}
+
+		for(uint8_t i=0; i<NUM_DISPLAY_COMMANDS; i++)
+		{
+			if(!(batch & (1 << i)))
+				continue;
+
+			uint32_t start = micros();
+			renderProfiler_SetContext(commandProfileContexts[i]);
+			renderCommand((DisplayCommandType)i, &commands[i]);
+			uint32_t elapsed = micros() - start;
+			displayTaskStats.commands[i].rendered++;
+			displayTaskStats.commands[i].renderUsLast = elapsed;
+			if(elapsed > displayTaskStats.commands[i].renderUsMax)
+				displayTaskStats.commands[i].renderUsMax = elapsed;
+		}
+
+		// A flush carrying several commands cannot be split between them
+		if(__builtin_popcount(batch) > 1)
+			renderProfiler_SetContext(ProfileCtxOther);
+		uint32_t flushStart = micros();
+		display_Flush();
+		uint32_t flushEnd = micros();
+		renderProfiler_SetContext(ProfileCtxOther);
+		displayTaskStats.flushUsLast = flushEnd - flushStart;
+		if(displayTaskStats.flushUsLast > displayTaskStats.flushUsMax)
+			displayTaskStats.flushUsMax = displayTaskStats.flushUsLast;
+
+		for(uint8_t i=0; i<NUM_DISPLAY_COMMANDS; i++)
+		{
+			if(!(batch & (1 << i)))
+				continue;
+
+			uint32_t latency = flushEnd - commands[i].postedAt;
+			if(latency > displayTaskStats.commands[i].latencyUsMax)
+				displayTaskStats.commands[i].latencyUsMax = latency;
+			ESP_LOGV(DISPLAY_TASK_TAG, "Command %d: render %dus, event to pixel %dus, depth %d",
+						i, displayTaskStats.commands[i].renderUsLast, latency, depth);
+		}
+	}
+}
+
+void display_QueueMainScreen()
+{
+	DisplayCommand command = {};
+	postCommand(DisplayCmdMainScreen, &command);
+}
+
+void display_QueuePreset(uint16_t presetIndex)
+{
+	DisplayCommand command = {};
+	command.value = presetIndex;
+	postCommand(DisplayCmdPreset, &command);
+}
+
+void display_QueueBpm(float bpm, uint32_t eventTime)
+{
+	DisplayCommand command = {};
+	command.bpm = bpm;
+	command.postedAt = eventTime;
+	postCommand(DisplayCmdBpm, &command);
+}
+
+void display_QueueMidiIndicator(bool active, uint32_t eventTime)
+{
+	DisplayCommand command = {};
+	command.value = active;
+	command.postedAt = eventTime;
+	postCommand(DisplayCmdMidiIndicator, &command);
+}
+
+void display_QueueWirelessIndicator(uint8_t type, uint8_t state, uint32_t eventTime)
+{
+	DisplayCommand command = {};
+	command.value = state;
+	command.param = type;
+	command.postedAt = eventTime;
+	postCommand(DisplayCmdWirelessIndicator, &command);
+}
+
+// Called from the clock callback on every beat indicator change
+void display_QueueBeat(uint8_t type, uint32_t tickTime)
+{
+	if(beatQueue == NULL)
+		return;
+
+	BeatEvent beat = {type, tickTime};
+	if(xQueueSend(beatQueue, &beat, 0) != pdTRUE)
+	{
+		displayTaskStats.beatsDropped++;
+		return;
+	}
+	if(displayTaskHandle != NULL)
+	{
+		xTaskNotifyGive(displayTaskHandle);
+	}
+}
+
+// Called when a preset's text has been edited. Every preset posted before the
+// render task gets round to it is measured in the same batch
+void display_QueueLayout(uint16_t presetIndex)
+{
+	if(presetIndex >= NUM_PRESETS)
+		return;
+
+	portENTER_CRITICAL(&displayCommandMux);
+	pendingLayouts[presetIndex / 32] |= (1UL << (presetIndex % 32));
+	portEXIT_CRITICAL(&displayCommandMux);
+	DisplayCommand command = {};
+	command.value = presetIndex;
+	postCommand(DisplayCmdLayout, &command);
+}
+
+const DisplayTaskStats* display_GetTaskStats()
+{
+	return &displayTaskStats;
+}
@@ -0,0 +1,179 @@
+#include "Arduino.h"
+#include "Adafruit_ST7789.h"
+#include "framebuffer.h"
+#ifdef USE_LCD_DMA
+#include "lcd_dma.h"
+#endif
+
+static const char* FRAMEBUFFER_TAG = "FRAMEBUFFER";
+
+// Extra pixels allowed when merging two rectangles.
+// Roughly the cost of opening another address window (CASET/RASET/RAMWR)
+#define MERGE_SLACK_PIXELS		64
+
+GFXcanvas16 framebuffer = GFXcanvas16(LCD_WIDTH, LCD_HEIGHT);
+
+DisplayRect dirtyRects[FRAMEBUFFER_MAX_DIRTY_RECTS];
+uint8_t numDirtyRects = 0;
+FramebufferStats framebufferStats;
+
+static int32_t rectArea(const DisplayRect* r)
+{
+	return (int32_t)r->w * r->h;
+}
+
+static DisplayRect rectUnion(const DisplayRect* a, const DisplayRect* b)
+{
+	DisplayRect u;
+	int16_t x2 = max(a->x + a->w, b->x + b->w);
+	int16_t y2 = max(a->y + a->h, b->y + b->h);
+	u.x = min(a->x, b->x);
+	u.y = min(a->y, b->y);
+	u.w = x2 - u.x;
+	u.h = y2 - u.y;
+	return u;
+}
+
+void framebuffer_Init()
+{
+	if(framebuffer.getBuffer() == NULL)
+	{
+		ESP_LOGE(FRAMEBUFFER_TAG, "Failed to allocate %d byte framebuffer", LCD_WIDTH * LCD_HEIGHT * 2);
+		return;
+	}
+	numDirtyRects = 0;
+	memset(&framebufferStats, 0, sizeof(FramebufferStats));
+}
+
+// Add a region to the dirty list, merging it with any region it overlaps or
+// sits next to when that does not push noticeably more pixels
+void framebuffer_MarkDirty(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+	// Clip to the panel
+	if(x < 0)
+	{
+		w += x;
+		x = 0;
+	}
+	if(y < 0)
+	{
+		h += y;
+		y = 0;
+	}
+	if(x + w > LCD_WIDTH)
+		w = LCD_WIDTH - x;
+	if(y + h > LCD_HEIGHT)
+		h = LCD_HEIGHT - y;
+	if(w <= 0 || h <= 0)
+		return;
+	framebufferStats.pixelsMarked += (uint32_t)w * h;
+
+	DisplayRect rect = {x, y, w, h};
+
+	// Keep merging until the new rectangle no longer overlaps anything
+	uint8_t merged = 1;
+	while(merged)
+	{
+		merged = 0;
+		for(uint8_t i=0; i<numDirtyRects; i++)
+		{
+			DisplayRect u = rectUnion(&rect, &dirtyRects[i]);
+			if(rectArea(&u) <= rectArea(&rect) + rectArea(&dirtyRects[i]) + MERGE_SLACK_PIXELS)
+			{
+				rect = u;
+				dirtyRects[i] = dirtyRects[--numDirtyRects];
+				merged = 1;
+				break;
+			}
+		}
+	}
+
+	if(numDirtyRects < FRAMEBUFFER_MAX_DIRTY_RECTS)
+	{
+		dirtyRects[numDirtyRects++] = rect;
+		return;
+	}
+
+	// List is full, grow whichever rectangle costs the least extra pixels
+	uint8_t best = 0;
+	int32_t bestGrowth = INT32_MAX;
+	for(uint8_t i=0; i<numDirtyRects; i++)
+	{
+		DisplayRect u = rectUnion(&rect, &dirtyRects[i]);
+		int32_t growth = rectArea(&u) - rectArea(&dirtyRects[i]);
+		if(growth < bestGrowth)
+		{
+			bestGrowth = growth;
+			best = i;
+		}
+	}
+	dirtyRects[best] = rectUnion(&rect, &dirtyRects[best]);
+}
+
+void framebuffer_MarkAllDirty()
+{
+	numDirtyRects = 0;
+	framebuffer_MarkDirty(0, 0, LCD_WIDTH, LCD_HEIGHT);
+}
+
+// Push every dirty region to the panel, one address window per region
+// Returns the number of pixel bytes sent
+uint32_t framebuffer_Flush(Adafruit_SPITFT* target)
+{
+	uint16_t* buffer = framebuffer.getBuffer();
+	if(numDirtyRects == 0 || buffer == NULL)
+		return 0;
+
+	uint32_t bytes = 0;
+#ifdef USE_LCD_DMA
+	if(lcdDma_IsActive())
+	{
+		for(uint8_t i=0; i<numDirtyRects; i++)
+		{
+			DisplayRect* r = &dirtyRects[i];
+			bytes += lcdDma_PushRect(buffer, LCD_WIDTH, r->x, r->y, r->w, r->h);
+		}
+		// The task sleeps here while the last strips go out
+		lcdDma_Wait();
+	}
+	else
+#endif
+	{
+		target->startWrite();
+		for(uint8_t i=0; i<numDirtyRects; i++)
+		{
+			DisplayRect* r = &dirtyRects[i];
+			target->setAddrWindow(r->x, r->y, r->w, r->h);
+			// Rows are not contiguous unless the region spans the full width
+			if(r->w == LCD_WIDTH)
+			{
+				target->writePixels(&buffer[r->y * LCD_WIDTH], (uint32_t)r->w * r->h);
+			}
+			else
+			{
+				for(int16_t row=0; row<r->h; row++)
+				{
+					target->writePixels(&buffer[(r->y + row) * LCD_WIDTH + r->x], r->w);
+				}
+			}
+			bytes += (uint32_t)r->w * r->h * 2;
+		}
+		target->endWrite();
+	}
+
+	framebufferStats.frames++;
+	framebufferStats.bytesLastFrame = bytes;
+	framebufferStats.rectsLastFrame = numDirtyRects;
+	framebufferStats.bytesTotal += bytes;
+	if(bytes > framebufferStats.bytesPeakFrame)
+		framebufferStats.bytesPeakFrame = bytes;
+	ESP_LOGV(FRAMEBUFFER_TAG, "Flushed %d bytes in %d rects", bytes, numDirtyRects);
+
+	numDirtyRects = 0;
+	return bytes;
+}
+
+const FramebufferStats* framebuffer_GetStats()
+{
+	return &framebufferStats;
+}
@@ -0,0 +1,189 @@
+#include "Arduino.h"
+#include "freertos/event_groups.h"
+#include "freertos/timers.h"
+#include "indicators.h"
+#include "display.h"
+#include "display_task.h"
+#include "main.h"
+#include "midi_clock.h"
+#include "midi_routing.h"
+#include "task_priorities.h"
+
+static const char* INDICATOR_TAG = "INDICATOR";
+
+EventGroupHandle_t indicatorEvents = NULL;
+TimerHandle_t midiIndicatorTimer = NULL;
+TimerHandle_t linkPollTimer = NULL;
+
+// micros() of the first occurrence of each event since it was last handled
+uint32_t indicatorEventTimes[INDICATOR_NUM_EVENTS];
+portMUX_TYPE indicatorEventMux = portMUX_INITIALIZER_UNLOCKED;
+
+void midiIndicatorTimerCallback(TimerHandle_t timer);
+void linkPollTimerCallback(TimerHandle_t timer);
+
+// Look up the timestamp recorded for a single event bit
+static inline uint32_t timeOf(const uint32_t* times, uint32_t event)
+{
+	return times[__builtin_ctz(event)];
+}
+
+void indicator_Init()
+{
+	indicatorEvents = xEventGroupCreate();
+	memset(indicatorEventTimes, 0, sizeof(indicatorEventTimes));
+
+	// One-shot timer that turns the MIDI indicator off again
+	midiIndicatorTimer = xTimerCreate("MIDI Indicator", pdMS_TO_TICKS(MIDI_INDICATOR_ON_TIME), pdFALSE, NULL, midiIndicatorTimerCallback);
+
+	// The ESP32 manager only exposes BLE/WiFi changes and its own MIDI activity as flags,
+	// so those are bridged into the event group at a low rate
+	linkPollTimer = xTimerCreate("Indicator Poll", pdMS_TO_TICKS(INDICATOR_LINK_POLL_MS), pdTRUE, NULL, linkPollTimerCallback);
+	xTimerStart(linkPollTimer, 0);
+
+	BaseType_t taskResult = xTaskCreatePinnedToCore(
+		indicatorTask, // Task function. 
+		"Inicator Task", // name of task. 
+		5000, // Stack size of task 
+		NULL, // parameter of the task 
+		INDICATOR_TASK_PRIORITY, // priority of the task 
+		NULL, // Task handle to keep track of created task 
+		1); // pin task to core 1 
+	ESP_LOGI(INDICATOR_TAG, "Indicator task created: %d", taskResult);
+}
+
+// Flag one or more indicator events. Safe to call from any task
+void indicator_Signal(uint32_t events)
+{
+	if(indicatorEvents == NULL)
+		return;
+
+	uint32_t now = micros();
+	portENTER_CRITICAL(&indicatorEventMux);
+	for(uint8_t i=0; i<INDICATOR_NUM_EVENTS; i++)
+	{
+		if((events & (1 << i)) && indicatorEventTimes[i] == 0)
+			indicatorEventTimes[i] = now;
+	}
+	portEXIT_CRITICAL(&indicatorEventMux);
+	xEventGroupSetBits(indicatorEvents, events);
+}
+
+void midiIndicatorTimerCallback(TimerHandle_t timer)
+{
+	indicator_Signal(INDICATOR_EVENT_MIDI_OFF);
+}
+
+void linkPollTimerCallback(TimerHandle_t timer)
+{
+	uint32_t events = 0;
+	if(midiReceived)
+	{
+		midiReceived = 0;
+		events |= INDICATOR_EVENT_MIDI_RX;
+	}
+	if(newBleEvent)
+	{
+		newBleEvent = 0;
+		events |= INDICATOR_EVENT_BLE;
+	}
+	if(newWifiEvent)
+	{
+		newWifiEvent = 0;
+		events |= INDICATOR_EVENT_WIFI;
+	}
+	if(events)
+		indicator_Signal(events);
+
+	// MIDI routing drops destinations whose link is down
+	midiRouting_PollLinks();
+}
+
+// Sleeps until an indicator event arrives, then queues the matching redraws
+// Each redraw carries the event time so the display task logs event to pixel latency
+void indicatorTask(void* parameter)
+{
+	uint32_t eventTimes[INDICATOR_NUM_EVENTS];
+	uint8_t midiIndicatorOn = 0;
+	while(1)
+	{
+		EventBits_t events = xEventGroupWaitBits(indicatorEvents, INDICATOR_EVENT_ALL, pdTRUE, pdFALSE, portMAX_DELAY);
+
+		portENTER_CRITICAL(&indicatorEventMux);
+		memcpy(eventTimes, indicatorEventTimes, sizeof(eventTimes));
+		for(uint8_t i=0; i<INDICATOR_NUM_EVENTS; i++)
+		{
+			if(events & (1 << i))
+				indicatorEventTimes[i] = 0;
+		}
+		portEXIT_CRITICAL(&indicatorEventMux);
+
+		// Handle the hold timer first so new input in the same batch keeps the indicator lit
+		if(events & INDICATOR_EVENT_MIDI_OFF)
+		{
+			display_QueueMidiIndicator(false, timeOf(eventTimes, INDICATOR_EVENT_MIDI_OFF));
+			midiIndicatorOn = 0;
+		}
+		// New MIDI input
+		if(events & INDICATOR_EVENT_MIDI_RX)
+		{
+			if(!midiIndicatorOn)
+			{
+				display_QueueMidiIndicator(true, timeOf(eventTimes, INDICATOR_EVENT_MIDI_RX));
+				midiIndicatorOn = 1;
+			}
+			// Restart the hold time on every message
+			xTimerReset(midiIndicatorTimer, 0);
+		}
+		// New BLE event
+		if(events & INDICATOR_EVENT_BLE)
+		{
+			if(bleConnected)
+			{
+				display_QueueWirelessIndicator(Esp32BLE, 1, timeOf(eventTimes, INDICATOR_EVENT_BLE)); // BLE connected
+			}
+			else
+			{
+				display_QueueWirelessIndicator(Esp32BLE, 0, timeOf(eventTimes, INDICATOR_EVENT_BLE)); // BLE disconnected
+			}
+		}
+		if(events & INDICATOR_EVENT_WIFI)
+		{
+			if(globalSettings.esp32ManagerConfig.wirelessType == Esp32WiFi)
+			{
+				display_QueueWirelessIndicator(globalSettings.esp32ManagerConfig.wirelessType, esp32Info.wifiConnected, timeOf(eventTimes, INDICATOR_EVENT_WIFI));
+			}
+		}
+		// New MIDI clock events
+		if(globalSettings.clockMode == MIDI_CLOCK_EXTERNAL)
+		{
+			if(events & INDICATOR_EVENT_CLOCK_START)
+			{
+				// Set the BPM colour to green
+				display_SetBpmDrawColour(CLOCK_START_COLOUR); 
+				display_QueueBpm(currentBpm, timeOf(eventTimes, INDICATOR_EVENT_CLOCK_START));
+			}
+			if(events & INDICATOR_EVENT_CLOCK_STOP)
+			{
+				// Set the BPM colour to orange
+				display_SetBpmDrawColour(CLOCK_STOP_COLOUR); 
+				display_QueueBpm(currentBpm, timeOf(eventTimes, INDICATOR_EVENT_CLOCK_STOP));
+			}
+			if(events & INDICATOR_EVENT_CLOCK_CHANGE)
+			{
+				// The tempo has changed; update the display with new bpm
+				display_QueueBpm(currentBpm, timeOf(eventTimes, INDICATOR_EVENT_CLOCK_CHANGE));
+			}
+		}
+		else if(	globalSettings.clockMode == MIDI_CLOCK_PRESET ||
+					globalSettings.clockMode == MIDI_CLOCK_GLOBAL)
+		{
+			if(events & INDICATOR_EVENT_CLOCK_CHANGE)
+			{
+				// The tempo has changed; update the display with new bpm
+				display_SetBpmDrawColour(CLOCK_START_COLOUR); 
+				display_QueueBpm(currentBpm, timeOf(eventTimes, INDICATOR_EVENT_CLOCK_CHANGE));
+			}
+		}
+	}
+}
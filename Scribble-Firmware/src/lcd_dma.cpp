@@ -0,0 +1,227 @@
+#include "Arduino.h"
+#include "SPI.h"
+#include "Adafruit_ST7789.h"
+#include "driver/spi_master.h"
+#include "driver/gpio.h"
+#include "esp_heap_caps.h"
+#include "hardware_def.h"
+#include "display.h"
+#include "lcd_dma.h"
+
+static const char* LCD_DMA_TAG = "LCD DMA";
+
+#define LCD_DMA_STRIP_PIXELS		(LCD_WIDTH * LCD_DMA_STRIP_LINES)
+#define LCD_DMA_NUM_STRIPS			2
+
+spi_device_handle_t lcdSpi = NULL;
+uint16_t* dmaStrips[LCD_DMA_NUM_STRIPS] = {NULL, NULL};
+spi_transaction_t stripTransactions[LCD_DMA_NUM_STRIPS];
+uint8_t nextStrip = 0;
+uint8_t stripsInFlight = 0;
+uint32_t dmaFreeAtInit = 0;
+
+// Panel RAM offset for the current rotation
+int16_t panelXStart = 0;
+int16_t panelYStart = 0;
+
+// The Adafruit driver keeps the rotation offsets protected
+class LcdOffsetReader : public Adafruit_ST7789
+{
+public:
+	static void read(Adafruit_ST7789* lcd, int16_t* x, int16_t* y)
+	{
+		LcdOffsetReader* reader = static_cast<LcdOffsetReader*>(lcd);
+		*x = reader->_xstart;
+		*y = reader->_ystart;
+	}
+};
+
+// Runs in the SPI ISR before each transaction. The user field carries the D/C level
+static void IRAM_ATTR lcdSpiPreTransfer(spi_transaction_t* transaction)
+{
+	gpio_set_level((gpio_num_t)LCD_DC_PIN, (int)(intptr_t)transaction->user);
+}
+
+// Take the SPI bus over from the Adafruit driver once it has configured the panel
+// The driver must not be used to draw after this succeeds
+bool lcdDma_Init(Adafruit_ST7789* lcd)
+{
+	// The display is initialised again after a new device configuration
+	if(lcdSpi != NULL)
+		return true;
+
+	dmaFreeAtInit = heap_caps_get_free_size(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	if(dmaFreeAtInit < LCD_DMA_NUM_STRIPS * LCD_DMA_STRIP_PIXELS * 2 + LCD_DMA_HEAP_RESERVE)
+	{
+		ESP_LOGW(LCD_DMA_TAG, "Only %d bytes of DMA capable RAM free, staying on the blocking driver", dmaFreeAtInit);
+		return false;
+	}
+
+	for(uint8_t i=0; i<LCD_DMA_NUM_STRIPS; i++)
+	{
+		dmaStrips[i] = (uint16_t*)heap_caps_malloc(LCD_DMA_STRIP_PIXELS * 2, MALLOC_CAP_DMA);
+		if(dmaStrips[i] == NULL)
+		{
+			ESP_LOGE(LCD_DMA_TAG, "Failed to allocate DMA strip buffers, staying on the blocking driver");
+			for(uint8_t j=0; j<i; j++)
+			{
+				heap_caps_free(dmaStrips[j]);
+				dmaStrips[j] = NULL;
+			}
+			return false;
+		}
+	}
+	LcdOffsetReader::read(lcd, &panelXStart, &panelYStart);
+
+	SPI.end();
+	spi_bus_config_t busConfig = {};
+	busConfig.mosi_io_num = SPI_MOSI_PIN;
+	busConfig.miso_io_num = -1;
+	busConfig.sclk_io_num = SPI_SCK_PIN;
+	busConfig.quadwp_io_num = -1;
+	busConfig.quadhd_io_num = -1;
+	busConfig.max_transfer_sz = LCD_DMA_STRIP_PIXELS * 2;
+
+	spi_device_interface_config_t deviceConfig = {};
+	deviceConfig.clock_speed_hz = LCD_DMA_SPI_CLOCK;
+	deviceConfig.mode = 0;
+	deviceConfig.spics_io_num = LCD_CS_PIN;
+	deviceConfig.queue_size = LCD_DMA_NUM_STRIPS;
+	deviceConfig.pre_cb = lcdSpiPreTransfer;
+
+	esp_err_t result = spi_bus_initialize(SPI2_HOST, &busConfig, SPI_DMA_CH_AUTO);
+	if(result == ESP_OK)
+	{
+		result = spi_bus_add_device(SPI2_HOST, &deviceConfig, &lcdSpi);
+		if(result != ESP_OK)
+			spi_bus_free(SPI2_HOST);
+	}
+	if(result != ESP_OK)
+	{
+		ESP_LOGE(LCD_DMA_TAG, "SPI DMA setup failed (%d), staying on the blocking driver", result);
+		lcdSpi = NULL;
+		SPI.begin(SPI_SCK_PIN, -1, SPI_MOSI_PIN, -1);
+		for(uint8_t i=0; i<LCD_DMA_NUM_STRIPS; i++)
+		{
+			heap_caps_free(dmaStrips[i]);
+			dmaStrips[i] = NULL;
+		}
+		return false;
+	}
+
+	// The D/C pin was driven by the Adafruit driver until now
+	gpio_set_direction((gpio_num_t)LCD_DC_PIN, GPIO_MODE_OUTPUT);
+	ESP_LOGI(LCD_DMA_TAG, "LCD on SPI DMA, %d byte strips, panel offset %d,%d, %d bytes of DMA capable RAM left",
+				LCD_DMA_STRIP_PIXELS * 2, panelXStart, panelYStart,
+				heap_caps_get_free_size(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+	return true;
+}
+
+bool lcdDma_IsActive()
+{
+	return lcdSpi != NULL;
+}
+
+// Block until every queued strip has gone out. The calling task sleeps while it waits
+void lcdDma_Wait()
+{
+	spi_transaction_t* done;
+	while(stripsInFlight > 0)
+	{
+		spi_device_get_trans_result(lcdSpi, &done, portMAX_DELAY);
+		stripsInFlight--;
+	}
+}
+
+// Send a command and its parameters. Waits for any strips still in flight first
+void lcdDma_SendCommand(uint8_t command, const uint8_t* data, uint8_t length)
+{
+	lcdDma_Wait();
+	spi_transaction_t transaction = {};
+	transaction.length = 8;
+	transaction.tx_buffer = &command;
+	transaction.user = (void*)0;
+	spi_device_polling_transmit(lcdSpi, &transaction);
+	if(length > 0)
+	{
+		transaction.length = length * 8;
+		transaction.tx_buffer = data;
+		transaction.user = (void*)1;
+		spi_device_polling_transmit(lcdSpi, &transaction);
+	}
+}
+
+static void setAddrWindow(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+	uint16_t x1 = x + panelXStart;
+	uint16_t x2 = x1 + w - 1;
+	uint16_t y1 = y + panelYStart;
+	uint16_t y2 = y1 + h - 1;
+	uint8_t columns[4] = {(uint8_t)(x1 >> 8), (uint8_t)x1, (uint8_t)(x2 >> 8), (uint8_t)x2};
+	uint8_t rows[4] = {(uint8_t)(y1 >> 8), (uint8_t)y1, (uint8_t)(y2 >> 8), (uint8_t)y2};
+	lcdDma_SendCommand(ST77XX_CASET, columns, 4);
+	lcdDma_SendCommand(ST77XX_RASET, rows, 4);
+	lcdDma_SendCommand(ST77XX_RAMWR, NULL, 0);
+}
+
+// Stream a region of an RGB565 buffer to the panel
+// Rows are byte swapped into whichever strip is free and queued for DMA, so the
+// next strip is prepared while the previous one is on the wire. The last strips
+// may still be in flight on return, call lcdDma_Wait() before reusing the bus
+uint32_t lcdDma_PushRect(const uint16_t* buffer, uint16_t stride, int16_t x, int16_t y, int16_t w, int16_t h)
+{
+	if(lcdSpi == NULL || w <= 0 || h <= 0)
+		return 0;
+
+	setAddrWindow(x, y, w, h);
+
+	int16_t rowsPerStrip = LCD_DMA_STRIP_PIXELS / w;
+	const uint16_t* source = &buffer[y * stride + x];
+	int16_t row = 0;
+	while(row < h)
+	{
+		// Reclaim the oldest strip before overwriting it
+		if(stripsInFlight == LCD_DMA_NUM_STRIPS)
+		{
+			spi_transaction_t* done;
+			spi_device_get_trans_result(lcdSpi, &done, portMAX_DELAY);
+			stripsInFlight--;
+		}
+
+		uint16_t* strip = dmaStrips[nextStrip];
+		int16_t rows = min((int16_t)(h - row), rowsPerStrip);
+		for(int16_t r=0; r<rows; r++)
+		{
+			const uint16_t* line = &source[(row + r) * stride];
+			uint16_t* out = &strip[r * w];
+			for(int16_t i=0; i<w; i++)
+			{
+				out[i] = __builtin_bswap16(line[i]);
+			}
+		}
+
+		spi_transaction_t* transaction = &stripTransactions[nextStrip];
+		memset(transaction, 0, sizeof(spi_transaction_t));
+		transaction->length = (uint32_t)rows * w * 16;
+		transaction->tx_buffer = strip;
+		transaction->user = (void*)1;
+		spi_device_queue_trans(lcdSpi, transaction, portMAX_DELAY);
+		stripsInFlight++;
+		nextStrip = (nextStrip + 1) % LCD_DMA_NUM_STRIPS;
+		row += rows;
+	}
+	return (uint32_t)w * h * 2;
+}
+
+// Fill in what the strips hold next to what is left, so the headroom can be
+// checked on a running device with BLE and WiFi up
+void lcdDma_GetHeapStats(LcdDmaHeapStats* stats)
+{
+	stats->stripBytes = lcdSpi != NULL ? LCD_DMA_NUM_STRIPS * LCD_DMA_STRIP_PIXELS * 2 : 0;
+	stats->dmaFreeAtInit = dmaFreeAtInit;
+	stats->internalFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+	stats->internalMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+	stats->dmaFree = heap_caps_get_free_size(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	stats->dmaMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+	stats->dmaLargestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+}
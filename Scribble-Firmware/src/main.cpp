@@ -3,6 +3,7 @@
 #include "esp32_settings.h"
 #include "main.h"
 #include "display.h"
+#include "display_task.h"
 #include "midi_handling.h"
 #include "task_priorities.h"
 #include "esp_system.h"
@@ -11,6 +12,14 @@
 #include "device_api.h"
 #include "buttons.h"
 #include "midi_clock.h"
+#include "midi_routing.h"
+#include "midi_output.h"
+#include "midi_stacks.h"
+#include "midi_journal.h"
+#include "midi_actions.h"
+#include "midi_sysex.h"
+#include "midi_loop.h"
+#include "indicators.h"
 #include "wifi_management.h"
 #include "esp32-hal-tinyusb.h"
 
@@ -28,7 +37,6 @@ Preset presets[NUM_PRESETS];
 void defaultGlobalSettingsAssignment();
 void defaultPresetsAssignment();
 
-void indicatorTask(void* parameter);
 void deviceApiTask(void* parameter);
 
 void setOutTypeA();
@@ -47,6 +55,8 @@ void setup()
 	esp32Settings_AssignDefaultGlobalSettings(defaultGlobalSettingsAssignment);
 	esp32Settings_AssignDefaultPresetSettings(defaultPresetsAssignment);
 	esp32Settings_BootCheck(&globalSettings, sizeof(GlobalSettings), presets, sizeof(Preset), NUM_PRESETS, &globalSettings.bootState);
+	// The boot check has read the presets; measure their text once up front
+	display_BuildLayoutCache();
 
 	// Configure pins
 	if(globalSettings.midiOutMode == MIDI_OUT_TYPE_A)
@@ -58,6 +68,13 @@ void setup()
 		setOutTypeB();
 	}
 
+	midiLoop_Init();
+	midiOutput_Init();
+	midiRouting_Init();
+	midiStacks_Compile();
+	midiStacks_Init();
+	midiActions_Build();
+	midiSysex_Init();
 	assignMidiCallbacks();
 	// Check for stored WiFi credentials and attempt to connect
 	//WiFi.persistent(true);
@@ -69,20 +86,11 @@ void setup()
 	debugMIDIPins();
 
 	display_Init();
-
-	
+	// From here on only the display task draws to the LCD
+	display_TaskInit();
 
 	// Display indicator task
-	BaseType_t taskResult;
-	taskResult = xTaskCreatePinnedToCore(
-		indicatorTask, // Task function. 
-		"Inicator Task", // name of task. 
-		5000, // Stack size of task 
-		NULL, // parameter of the task 
-		INDICATOR_TASK_PRIORITY, // priority of the task 
-		NULL, // Task handle to keep track of created task 
-		1); // pin task to core 1 
-	ESP_LOGI(MAIN_TAG, "Indicator task created: %d", taskResult);
+	indicator_Init();
 
 	/*
 	// Device API task
@@ -110,6 +118,8 @@ void loop()
 {
 	//midi_ReadAll();
 	buttons_Process();
+	// Device API frames received as SysEx
+	midiSysex_Process();
 	if(Serial.available())
 	{
 		deviceApi_Handler(deviceApiBuffer, 0);
@@ -161,7 +171,7 @@ void defaultGlobalSettingsAssignment()
 	globalSettings.midi1ThruHandles[MidiBLE] = 1;
 	//globalSettings.midi1ThruHandles[MidiWiFiRTP] = 1;
 	globalSettings.midi1ThruHandles[MidiSerial1] = 1;
-	
+
 	// Default MIDI mapping
 	globalSettings.presetUpCC = PRESET_UP_CC;
 	globalSettings.presetDownCC = PRESET_DOWN_CC;
@@ -222,12 +232,8 @@ void defaultPresetsAssignment()
 
 void assignMidiCallbacks()
 {
-	// Assign thru handling pointers
-	usbdMidiThruHandlesPtr = globalSettings.usbdThruHandles;
-	bleMidiThruHandlesPtr = globalSettings.bleThruHandles;
-	//wifiMidiThruHandlesPtr = globalSettings.wifiThruHandles;
-	serial1MidiThruHandlesPtr = globalSettings.midi1ThruHandles;
-
+	// The thru handling pointers are kept pointing at the compiled routing tables
+	// (settings with dead links removed) by midiRouting_Compile()
 	midi_AssignControlChangeCallback(controlChangeHandler);
 	midi_AssignProgramChangeCallback(programChangeHandler);
 	midi_AssignSysemExclusiveCallback(sysExHandler);
@@ -235,79 +241,68 @@ void assignMidiCallbacks()
 
 void controlChangeHandler(MidiInterfaceType interface, byte channel, byte number, byte value)
 {
-	if(channel == globalSettings.midiChannel || globalSettings.midiChannel == MIDI_CHANNEL_OMNI)
-	{
-		switch(number)
-		{
-			case PRESET_UP_CC:
-				presetUp();
-				break;
-			case PRESET_DOWN_CC:
-				presetDown();
-				break;
-			case PRESET_SELECT_CC:
-				goToPreset(value);
-				break;
-			default:
-				break;
-		}
-	}
-	midiReceived = 1;
+	uint8_t status = midi::ControlChange | ((channel - 1) & 0x0F);
+	uint32_t fingerprint = midiLoop_Fingerprint(status, number, value);
+	bool echo = midiLoop_IsEcho(interface, fingerprint);
+	// The MIDI handler has already passed it through the unfiltered routes, so only those are noted
+	// here. Filtered routes are forwarded and noted by midiRouting_Forward() below. A route back out
+	// of the port it came in on isn't noted, or a controller repeating itself would look like its own echo
+	midiLoop_Record(midiRouting_GetThruMask(interface) & ~(1 << interface), fingerprint);
+	midiJournal_Record(echo ? MidiJournalEcho : MidiJournalIn, interface, midiRouting_GetThruMask(interface),
+								status, number, value);
+	if(echo)
+		return;
+	midiRouting_Forward(interface, status, number, value);
+	// The action tables already account for the listening channel and the configured CCs
+	midiActions_ControlChange(channel, number, value);
+	indicator_Signal(INDICATOR_EVENT_MIDI_RX);
 }
 
 void programChangeHandler(MidiInterfaceType interface, byte channel, byte number)
 {
-	if(channel	== globalSettings.midiChannel || globalSettings.midiChannel == MIDI_CHANNEL_OMNI)
-	{
-		goToPreset(number);	
-	}
-	midiReceived = 1;
+	uint8_t status = midi::ProgramChange | ((channel - 1) & 0x0F);
+	uint32_t fingerprint = midiLoop_Fingerprint(status, number, 0);
+	bool echo = midiLoop_IsEcho(interface, fingerprint);
+	midiLoop_Record(midiRouting_GetThruMask(interface) & ~(1 << interface), fingerprint);
+	midiJournal_Record(echo ? MidiJournalEcho : MidiJournalIn, interface, midiRouting_GetThruMask(interface),
+								status, number, 0);
+	if(echo)
+		return;
+	midiRouting_Forward(interface, status, number, 0);
+	midiActions_ProgramChange(channel, number);
+	indicator_Signal(INDICATOR_EVENT_MIDI_RX);
 }
 
 void sysExHandler(MidiInterfaceType interface, byte* data, unsigned length)
 {
-
+	uint32_t fingerprint = midiLoop_FingerprintSysex(data, length);
+	bool echo = midiLoop_IsEcho(interface, fingerprint);
+	// The MIDI handler passes it through unfiltered routes, midiSysex_Receive() streams it through filtered ones
+	uint8_t thruMask = midiRouting_GetThruMask(interface) | midiRouting_GetFilteredMask(interface, midi::SystemExclusiveStart);
+	midiLoop_Record(thruMask & ~(1 << interface), fingerprint);
+	// SysEx is journalled with its length in place of the data bytes
+	midiJournal_Record(echo ? MidiJournalEcho : MidiJournalIn, interface, midiRouting_GetThruMask(interface),
+								midi::SystemExclusive, length & 0xFF, length >> 8);
+	if(echo)
+		return;
+	midiSysex_Receive(interface, data, length);
 }
 
 void sendMidiMessage(MidiMessage message)
 {
-	// Get the transmission interfaces
-	uint8_t sendUsbd = message.midiInterface & 0x01;
-	uint8_t sendBle = (message.midiInterface >> 1) & 0x01;
-	uint8_t sendWifi = (message.midiInterface >> 2) & 0x01;
-	uint8_t sendSerial1 = (message.midiInterface >> 3) & 0x01;
+	// Get the transmission interfaces that are up
+	uint8_t destinations = midiRouting_GetLiveMask(message.midiInterface);
 	// Channel messages
 	if((message.status & 0xF0) <= midi::PitchBend)
 	{
 		uint8_t type = message.status & 0xF0;
-		uint8_t channel = message.status & 0x0F;
-		if(sendUsbd)
-			midi_SendMessage(MidiUSBD, (midi::MidiType)type, channel, message.data1, message.data2);
-		if(sendBle)
-			midi_SendMessage(MidiBLE, (midi::MidiType)type, channel, message.data1, message.data2);
-
-#ifdef USE_WIFI_RTP_MIDI			
-		if(sendWifi)
-			midi_SendMessage(MidiWiFiRTP, (midi::MidiType)type, channel, message.data1, message.data2);
-#endif
-
-		if(sendSerial1)
-			midi_SendMessage(MidiSerial1, (midi::MidiType)type, channel, message.data1, message.data2);
+		// The MIDI library takes 1-indexed channels
+		uint8_t channel = (message.status & 0x0F) + 1;
+		midiRouting_Send(destinations, (midi::MidiType)type, channel, message.data1, message.data2);
 	}
 	else
 	{
-		if(sendUsbd)
-			midi_SendMessage(MidiUSBD, (midi::MidiType)message.status, 0, message.data1, message.data2);
-		if(sendBle)
-			midi_SendMessage(MidiBLE, (midi::MidiType)message.status, 0, message.data1, message.data2);
-
-#ifdef USE_WIFI_RTP_MIDI		
-			if(sendWifi)
-			midi_SendMessage(MidiWiFiRTP, (midi::MidiType)message.status, 0, message.data1, message.data2);
-#endif
-
-		if(sendSerial1)
-			midi_SendMessage(MidiSerial1, (midi::MidiType)message.status, 0, message.data1, message.data2);
+		midiRouting_Send(destinations, (midi::MidiType)message.status, 0, message.data1, message.data2);
 	}
 }
 
@@ -375,20 +370,13 @@ void goToPreset(uint16_t presetIndex)
 	{
 		globalSettings.currentPreset = presetIndex;
 	}
-	display_DrawPresetNumber(globalSettings.currentPreset);
-	display_DrawMainText(presets[globalSettings.currentPreset].name, presets[globalSettings.currentPreset].secondaryText);
+	// Drawing is left to the display task so MIDI handling is never held up by SPI
+	display_QueuePreset(globalSettings.currentPreset);
 	clock_SetTempo();
 
-	// Send any PC Bank Output messages. These use 0 to indicate it should not be sent, and 1-indexed channels if it should be sent
-	for(uint8_t i=0; i<NUM_MIDI_INTERFACES; i++)
-	{
-		if(globalSettings.pcBankOutputs[i] > 0 && globalSettings.pcBankOutputs[i] <= 16)
-		{
-			Serial.print("Sending PC on interface ");
-			Serial.println(i);
-			midi_SendMessage((MidiInterfaceType)i, midi::ProgramChange, globalSettings.pcBankOutputs[i], globalSettings.currentPreset, 0);
-		}
-	}
+	// The new preset's stacks, then its PC bank outputs and preset messages in one write per interface,
+	// built and sent from the stacks task rather than whichever MIDI callback or button got here
+	midiStacks_QueueCompile(true);
 }
 
 void enterBootloader()
@@ -419,83 +407,3 @@ void deviceApiTask(void* parameter)
 		vTaskDelay(2 / portTICK_PERIOD_MS);
 	}
 }
-
-void indicatorTask(void* parameter)
-{
-	while(1)
-	{
-		// New MIDI input
-		if(midiReceived)
-		{
-			display_DrawMidiIndicator(true);
-			vTaskDelay(MIDI_INDICATOR_ON_TIME / portTICK_PERIOD_MS);
-			display_DrawMidiIndicator(false);
-			midiReceived = 0;
-		}
-		// New BLE event
-		if(newBleEvent)
-		{
-			if(bleConnected)
-			{
-				display_DrawWirelessIndicator(Esp32BLE, 1); // BLE connected
-			}
-			else
-			{
-				display_DrawWirelessIndicator(Esp32BLE, 0); // BLE disconnected
-			}
-			newBleEvent = 0;
-		}
-		if(newWifiEvent)
-		{
-			if(globalSettings.esp32ManagerConfig.wirelessType == Esp32WiFi)
-			{
-				display_DrawWirelessIndicator(globalSettings.esp32ManagerConfig.wirelessType, esp32Info.wifiConnected);
-			}
-			newWifiEvent = 0;
-		}
-		// New MIDI clock event
-		if(newClockEvent)
-		{
-			if(globalSettings.clockMode == MIDI_CLOCK_EXTERNAL)
-			{
-				switch(newClockEvent)
-				{
-					case MIDI_CLOCK_EVENT_CHANGE:
-						// The tempo has changed; update the display with new bpm
-						display_DrawBpm(currentBpm);
-					break;
-
-					case MIDI_CLOCK_EVENT_START:
-						// Set the BPM colour to green
-						display_SetBpmDrawColour(CLOCK_START_COLOUR); 
-						display_DrawBpm(currentBpm);
-					break;
-
-					case MIDI_CLOCK_EVENT_STOP:
-						// Set the BPM colour to green
-						display_SetBpmDrawColour(CLOCK_STOP_COLOUR); 
-						display_DrawBpm(currentBpm);
-					break;
-
-					newClockEvent = MIDI_CLOCK_EVENT_CLEAR;
-				}
-			}
-			else if(	globalSettings.clockMode == MIDI_CLOCK_PRESET ||
-						globalSettings.clockMode == MIDI_CLOCK_GLOBAL)
-			{
-				switch(newClockEvent)
-				{
-					case MIDI_CLOCK_EVENT_CHANGE:
-						// The tempo has changed; update the display with new bpm
-						display_SetBpmDrawColour(CLOCK_START_COLOUR); 
-						display_DrawBpm(currentBpm);
-					break;
-				}
-				// TODO: is a clock tempo indicator needed considering most pedals have them already?
-				// Might not be worth adding to avoid confusion
-			}
-		}
-				
-		vTaskDelay(20 / portTICK_PERIOD_MS);
-	}
-}
\ No newline at end of file
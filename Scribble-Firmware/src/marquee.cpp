@@ -0,0 +1,154 @@
+#include "Arduino.h"
+#include "display.h"
+#include "framebuffer.h"
+#include "text_render.h"
+#include "render_profiler.h"
+#include "marquee.h"
+
+static const char* MARQUEE_TAG = "MARQUEE";
+
+// The ST7789 scroll registers (VSCRDEF/VSCSAD) move whole gate lines, which are
+// the panel's columns once it is rotated to landscape. Scrolling the name that
+// way would drag the info bar and secondary text with it, so the marquee scrolls
+// in the framebuffer instead: the name's rows are shifted in place, only the
+// strip that scrolls in is rendered, and the flush sends just those rows
+
+typedef struct
+{
+	uint8_t active;
+	char text[MARQUEE_MAX_TEXT];
+	const GFXfont* font;
+	uint16_t colour;
+	uint16_t background;
+	int16_t cursorY;
+	int16_t bandY;					// Rows covered by the name's glyphs
+	int16_t bandH;
+	int16_t period;				// Name width plus the gap
+	int16_t position;				// Pixels scrolled into the current pass
+	uint32_t nextStepAt;			// millis() of the next step
+} Marquee;
+
+Marquee marquee;
+
+// The name and its repeat, positioned for the current scroll position
+static uint8_t buildLines(TextLine* lines)
+{
+	for(uint8_t i=0; i<2; i++)
+	{
+		lines[i].text = marquee.text;
+		lines[i].font = marquee.font;
+		lines[i].cursorX = PRESET_NAME_X_OFFSET - marquee.position + i * marquee.period;
+		lines[i].cursorY = marquee.cursorY;
+		lines[i].colour = marquee.colour;
+	}
+	return 2;
+}
+
+// True if the text fits between the side margins without scrolling
+bool marquee_Fits(const char* text, const GFXfont* font)
+{
+	if(text == NULL)
+		return true;
+
+	int16_t  x1, y1;
+	uint16_t w, h;
+	framebuffer.setFont(font);
+	framebuffer.setTextWrap(false);
+	framebuffer.getTextBounds(text, 0, 0, &x1, &y1, &w, &h);
+	framebuffer.setTextWrap(true);
+	return w <= LCD_WIDTH - 2*PRESET_NAME_X_OFFSET;
+}
+
+// Start scrolling a line of text from the left margin, replacing anything
+// already scrolling. The line's rows are redrawn with the start of the text
+void marquee_Start(const TextLine* line, uint16_t background, uint32_t now)
+{
+	if(line == NULL || line->text == NULL || line->font == NULL)
+		return;
+
+	int16_t  x1, y1;
+	uint16_t w, h;
+	framebuffer.setFont(line->font);
+	framebuffer.setTextWrap(false);
+	framebuffer.getTextBounds(line->text, 0, line->cursorY, &x1, &y1, &w, &h);
+	framebuffer.setTextWrap(true);
+
+	strncpy(marquee.text, line->text, MARQUEE_MAX_TEXT - 1);
+	marquee.text[MARQUEE_MAX_TEXT - 1] = 0;
+	marquee.font = line->font;
+	marquee.colour = line->colour;
+	marquee.background = background;
+	marquee.cursorY = line->cursorY;
+	// Keep the band inside the main area even if the font overhangs it
+	marquee.bandY = max(y1, (int16_t)(LCD_HEIGHT-MAIN_FILL_HEIGHT));
+	marquee.bandH = min((int16_t)(y1 + h), (int16_t)LCD_HEIGHT) - marquee.bandY;
+	marquee.period = x1 + w + MARQUEE_GAP_PIXELS;
+	marquee.position = 0;
+	marquee.nextStepAt = now + MARQUEE_HOLD_MS;
+	marquee.active = 1;
+
+	TextLine lines[2];
+	uint8_t numLines = buildLines(lines);
+	textRender_Strip(0, marquee.bandY, LCD_WIDTH, marquee.bandH, marquee.background, lines, numLines);
+	ESP_LOGD(MARQUEE_TAG, "Scrolling \"%s\", %d px loop over rows %d-%d",
+				marquee.text, marquee.period, marquee.bandY, marquee.bandY + marquee.bandH - 1);
+}
+
+void marquee_Stop()
+{
+	marquee.active = 0;
+}
+
+bool marquee_IsActive()
+{
+	return marquee.active;
+}
+
+// Milliseconds until the next step is due, MARQUEE_IDLE if nothing is scrolling
+uint32_t marquee_MsUntilStep(uint32_t now)
+{
+	if(!marquee.active)
+		return MARQUEE_IDLE;
+
+	int32_t remaining = (int32_t)(marquee.nextStepAt - now);
+	return remaining > 0 ? remaining : 0;
+}
+
+// Advance the scroll if a step is due. Returns true if the framebuffer changed
+// and needs a flush
+bool marquee_Step(uint32_t now)
+{
+	if(!marquee.active || (int32_t)(now - marquee.nextStepAt) < 0)
+		return false;
+
+	uint16_t* buffer = framebuffer.getBuffer();
+	if(buffer == NULL)
+		return false;
+
+	ProfileMark profileMark = renderProfiler_Begin();
+	marquee.position += MARQUEE_STEP_PIXELS;
+	bool wrapped = false;
+	if(marquee.position >= marquee.period)
+	{
+		marquee.position -= marquee.period;
+		wrapped = true;
+	}
+
+	// Everything already drawn moves left, then only the new strip is rendered
+	for(int16_t row=marquee.bandY; row<marquee.bandY+marquee.bandH; row++)
+	{
+		uint16_t* line = &buffer[row * LCD_WIDTH];
+		memmove(line, &line[MARQUEE_STEP_PIXELS], (LCD_WIDTH - MARQUEE_STEP_PIXELS) * 2);
+	}
+	framebuffer_MarkDirty(0, marquee.bandY, LCD_WIDTH - MARQUEE_STEP_PIXELS, marquee.bandH);
+
+	TextLine lines[2];
+	uint8_t numLines = buildLines(lines);
+	textRender_Strip(	LCD_WIDTH - MARQUEE_STEP_PIXELS, marquee.bandY, MARQUEE_STEP_PIXELS, marquee.bandH,
+							marquee.background, lines, numLines);
+
+	// Rest at the start of each pass so the name can be read
+	marquee.nextStepAt = now + (wrapped ? MARQUEE_HOLD_MS : MARQUEE_STEP_MS);
+	renderProfiler_End(ProfileMarqueeStep, &profileMark);
+	return true;
+}
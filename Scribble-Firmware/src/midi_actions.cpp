@@ -0,0 +1,113 @@
+#include "Arduino.h"
+#include "midi_actions.h"
+#include "midi_stacks.h"
+#include "main.h"
+
+static const char* MIDI_ACTIONS_TAG = "MIDI ACTIONS";
+
+// Indexed by 0-indexed channel and CC or PC number
+typedef struct
+{
+	uint8_t cc[16][128];
+	uint8_t pc[16][128];
+} MidiActionTables;
+
+// Built into the spare copy and published by one pointer write, so a
+// handler on another task never sees a half built table
+static MidiActionTables actionTables[2];
+static MidiActionTables* volatile activeActions = &actionTables[0];
+
+MidiActionsStats midiActionsStats;
+
+// Map one CC number on every channel the device listens on
+static void mapControlChange(MidiActionTables* tables, uint8_t number, uint8_t action)
+{
+	// Out of range numbers leave the mapping off
+	if(number > 127)
+		return;
+
+	for(uint8_t channel=0; channel<16; channel++)
+	{
+		if(globalSettings.midiChannel == MIDI_CHANNEL_OMNI || globalSettings.midiChannel == channel + 1)
+			tables->cc[channel][number] = action;
+	}
+}
+
+// Rebuild both tables from the MIDI mapping settings
+// Call when the settings are edited; preset changes need no rebuild
+void midiActions_Build()
+{
+	MidiActionTables* tables = (activeActions == &actionTables[0]) ? &actionTables[1] : &actionTables[0];
+
+	memset(tables, MidiActionNone, sizeof(MidiActionTables));
+
+	// Every PC on a channel the device listens on selects that preset
+	for(uint8_t channel=0; channel<16; channel++)
+	{
+		if(globalSettings.midiChannel == MIDI_CHANNEL_OMNI || globalSettings.midiChannel == channel + 1)
+			memset(tables->pc[channel], MidiActionGoToPreset, sizeof(tables->pc[channel]));
+	}
+
+	// Where two settings share a CC, the later one here wins
+	mapControlChange(tables, globalSettings.globalCustomMessagesCC, MidiActionGlobalCustom);
+	// Whether the current preset has a stack is checked when the CC arrives
+	mapControlChange(tables, globalSettings.presetCustomMessagesCC, MidiActionPresetCustom);
+	mapControlChange(tables, globalSettings.goToPresetCC, MidiActionGoToPreset);
+	mapControlChange(tables, globalSettings.presetUpCC, MidiActionPresetUp);
+	mapControlChange(tables, globalSettings.presetDownCC, MidiActionPresetDown);
+
+	activeActions = tables;
+	midiActionsStats.builds++;
+	ESP_LOGD(MIDI_ACTIONS_TAG, "Action tables built, channel %d", globalSettings.midiChannel);
+}
+
+static void runAction(uint8_t action, uint8_t value)
+{
+	switch(action)
+	{
+		case MidiActionPresetUp:
+			presetUp();
+			break;
+		case MidiActionPresetDown:
+			presetDown();
+			break;
+		case MidiActionGoToPreset:
+			goToPreset(value);
+			break;
+		case MidiActionGlobalCustom:
+			midiStacks_Send(MidiStackGlobalCustom);
+			break;
+		case MidiActionPresetCustom:
+			// A preset without a custom stack leaves the CC to the global stack, if it shares it
+			if(presets[globalSettings.currentPreset].customMessages[0].status != 0)
+				midiStacks_Send(MidiStackPresetCustom);
+			else if(globalSettings.globalCustomMessagesCC == globalSettings.presetCustomMessagesCC)
+				midiStacks_Send(MidiStackGlobalCustom);
+			else
+			{
+				midiActionsStats.ignored++;
+				return;
+			}
+			break;
+		default:
+			midiActionsStats.ignored++;
+			return;
+	}
+	midiActionsStats.dispatched++;
+}
+
+// Channels are 1-indexed, as the MIDI library passes them
+void midiActions_ControlChange(uint8_t channel, uint8_t number, uint8_t value)
+{
+	runAction(activeActions->cc[(channel - 1) & 0x0F][number & 0x7F], value);
+}
+
+void midiActions_ProgramChange(uint8_t channel, uint8_t number)
+{
+	runAction(activeActions->pc[(channel - 1) & 0x0F][number & 0x7F], number);
+}
+
+const MidiActionsStats* midiActions_GetStats()
+{
+	return &midiActionsStats;
+}
@@ -3,12 +3,16 @@
 #include <uClock.h>
 #include "esp_log.h"
 #include "task_priorities.h"
+#include "indicators.h"
+#include "display.h"
+#include "display_task.h"
+#include "midi_routing.h"
+#include "midi_output.h"
 #include "Arduino.h"
 
 static const char* CLOCK_TAG = "MIDI Clock";
 
 uint8_t midiReceived = 0;
-uint8_t newClockEvent = 0;
 
 void clock_Init()
 {
@@ -62,7 +66,7 @@ void clock_Task(void* parameter)
 			{
 				currentBpm = newTempo;
 				ESP_LOGE(CLOCK_TAG, "New BPM: %.1f", currentBpm);
-				newClockEvent = MIDI_CLOCK_EVENT_CHANGE;
+				indicator_Signal(INDICATOR_EVENT_CLOCK_CHANGE);
 			}
 		}
 
@@ -78,54 +82,57 @@ void clock_ExternalClockHandler()
 void clock_ExternalClockStart()
 {
   uClock.start();
-  midiReceived = 1;
-  newClockEvent = MIDI_CLOCK_EVENT_START;
+  indicator_Signal(INDICATOR_EVENT_MIDI_RX | INDICATOR_EVENT_CLOCK_START);
 }
 
 void clock_ExternalClockStop()
 {
   uClock.stop();
-  midiReceived = 1;
-  newClockEvent = MIDI_CLOCK_EVENT_STOP;
+  indicator_Signal(INDICATOR_EVENT_MIDI_RX | INDICATOR_EVENT_CLOCK_STOP);
 }
 
 void clock_OnSync24Callback(uint32_t tick)
 {
 	static uint8_t bpm_blink_timer = 1;
+	static uint8_t beatState = BeatOff;
   	if(globalSettings.clockMode == MIDI_CLOCK_PRESET ||
 		globalSettings.clockMode == MIDI_CLOCK_GLOBAL)
 	{
-		if(globalSettings.midiClockOutHandles[MidiUSBD])
-			midi_SendMessage(MidiUSBD, midi::Clock, 0, 0, 0);
-
-		if(globalSettings.midiClockOutHandles[MidiBLE])
-			midi_SendMessage(MidiBLE, midi::Clock, 0, 0, 0);
+		midiRouting_Send(midiRouting_GetClassMask(MidiRouteClock), midi::Clock, 0, 0, 0);
 
 #ifdef USE_WIFI_RTP_MIDI
 		if(globalSettings.midiClockOutHandles[MidiWiFiRTP])
-			midi_SendMessage(MidiWiFiRTP, midi::Clock, 0, 0, 0);
+			midiOutput_Send(MidiWiFiRTP, midi::Clock, 0, 0, 0);
 #endif
-
-		if(globalSettings.midiClockOutHandles[MidiSerial1])
-			midi_SendMessage(MidiSerial1, midi::Clock, 0, 0, 0);
-	}
-	// BPM indicator
-	// First downbeat
-	if ( !(tick % (96)) || (tick == 1) )
-	{  
-		bpm_blink_timer = 8;
-		newClockEvent = MIDI_CLOCK_INDICATOR_ON;
-	}
-	// Each quarter note
-	else if ( !(tick % (24)) )
-	{   
-		bpm_blink_timer = 1;
-		newClockEvent = MIDI_CLOCK_INDICATOR_ON;
 	}
-	// Other clock intervals
-	else if ( !(tick % bpm_blink_timer) )
+	// Beat indicator. Only changes are queued, each stamped with the tick time
+	if(globalSettings.clockDisplayType == MIDI_CLOCK_DISPLAY_INDICATOR)
 	{
-		newClockEvent = MIDI_CLOCK_INDICATOR_OFF;
+		int8_t beat = -1;
+		// First downbeat
+		if ( !(tick % (96)) || (tick == 1) )
+		{  
+			bpm_blink_timer = 8;
+			beat = BeatDownbeat;
+		}
+		// Each quarter note
+		else if ( !(tick % (24)) )
+		{   
+			bpm_blink_timer = 1;
+			beat = BeatQuarter;
+		}
+		// Other clock intervals
+		else if ( !(tick % bpm_blink_timer) )
+		{
+			beat = BeatOff;
+		}
+
+		// Off is only sent on the tick the light goes out
+		if(beat >= 0 && !(beat == BeatOff && beatState == BeatOff))
+		{
+			display_QueueBeat(beat, micros());
+			beatState = beat;
+		}
 	}
 }
 
@@ -135,19 +142,12 @@ void clock_OnClockStart()
 	if(globalSettings.clockMode == MIDI_CLOCK_PRESET ||
 		globalSettings.clockMode == MIDI_CLOCK_GLOBAL)
 	{
-		if(globalSettings.midiClockOutHandles[MidiUSBD])
-			midi_SendMessage(MidiUSBD, midi::Clock, 0, 0, 0);
+		midiRouting_Send(midiRouting_GetClassMask(MidiRouteClock), midi::Clock, 0, 0, 0);
 
-		if(globalSettings.midiClockOutHandles[MidiBLE])
-			midi_SendMessage(MidiBLE, midi::Clock, 0, 0, 0);
-			
 #ifdef USE_WIFI_RTP_MIDI
 		if(globalSettings.midiClockOutHandles[MidiWiFiRTP])
-			midi_SendMessage(MidiWiFiRTP, midi::Clock, 0, 0, 0);
+			midiOutput_Send(MidiWiFiRTP, midi::Clock, 0, 0, 0);
 #endif		
-
-		if(globalSettings.midiClockOutHandles[MidiSerial1])
-			midi_SendMessage(MidiSerial1, midi::Clock, 0, 0, 0);
 	}
 }
 
@@ -157,19 +157,12 @@ void clock_OnClockStop()
 	if(globalSettings.clockMode == MIDI_CLOCK_PRESET ||
 		globalSettings.clockMode == MIDI_CLOCK_GLOBAL)
 	{
-		if(globalSettings.midiClockOutHandles[MidiUSBD])
-			midi_SendMessage(MidiUSBD, midi::Clock, 0, 0, 0);
-
-		if(globalSettings.midiClockOutHandles[MidiBLE])
-			midi_SendMessage(MidiBLE, midi::Clock, 0, 0, 0);
+		midiRouting_Send(midiRouting_GetClassMask(MidiRouteClock), midi::Clock, 0, 0, 0);
 
 #ifdef USE_WIFI_RTP_MIDI			
 		if(globalSettings.midiClockOutHandles[MidiWiFiRTP])
-			midi_SendMessage(MidiWiFiRTP, midi::Clock, 0, 0, 0);
+			midiOutput_Send(MidiWiFiRTP, midi::Clock, 0, 0, 0);
 #endif
-		
-		if(globalSettings.midiClockOutHandles[MidiSerial1])
-			midi_SendMessage(MidiSerial1, midi::Clock, 0, 0, 0);
 	}
 }
  
@@ -0,0 +1,67 @@
+#include "midi_filter.h"
+#include "string.h"
+
+// System message types by the low nibble of 0xF0-0xFF. Undefined ones never pass
+static const uint8_t systemTypes[16] = {
+	MidiFilterSysex,				// F0 SysEx start
+	MidiFilterSystemCommon,		// F1 MTC quarter frame
+	MidiFilterSystemCommon,		// F2 Song position
+	MidiFilterSystemCommon,		// F3 Song select
+	NUM_MIDI_FILTER_TYPES,		// F4
+	NUM_MIDI_FILTER_TYPES,		// F5
+	MidiFilterSystemCommon,		// F6 Tune request
+	MidiFilterSysex,				// F7 SysEx end
+	MidiFilterClock,				// F8 Clock
+	NUM_MIDI_FILTER_TYPES,		// F9
+	MidiFilterTransport,			// FA Start
+	MidiFilterTransport,			// FB Continue
+	MidiFilterTransport,			// FC Stop
+	NUM_MIDI_FILTER_TYPES,		// FD
+	MidiFilterActiveSensing,	// FE Active sensing
+	MidiFilterReset				// FF Reset
+};
+
+// Everything through, on its own channel
+void midiFilter_Default(MidiFilterSettings* settings)
+{
+	settings->types = MIDI_FILTER_ALL_TYPES;
+	settings->channels = MIDI_FILTER_ALL_CHANNELS;
+	for(uint8_t i=0; i<16; i++)
+		settings->remap[i] = i;
+}
+
+// The filter type of a status byte, NUM_MIDI_FILTER_TYPES for data bytes and undefined statuses
+uint8_t midiFilter_TypeOf(uint8_t status)
+{
+	if(status < 0x80)
+		return NUM_MIDI_FILTER_TYPES;
+	if(status < 0xF0)
+		return (status >> 4) - 8;
+	return systemTypes[status & 0x0F];
+}
+
+void midiFilter_Compile(MidiFilter* filter, const MidiFilterSettings* settings)
+{
+	memset(filter->statusPass, 0, sizeof(filter->statusPass));
+	bool identity = true;
+	for(uint8_t i=0; i<16; i++)
+	{
+		filter->remap[i] = settings->remap[i] & 0x0F;
+		if(filter->remap[i] != i)
+			identity = false;
+	}
+
+	for(uint16_t status=0x80; status<=0xFF; status++)
+	{
+		uint8_t type = midiFilter_TypeOf(status);
+		if(type == NUM_MIDI_FILTER_TYPES || ((settings->types >> type) & 1) == 0)
+			continue;
+		if(status < 0xF0 && ((settings->channels >> (status & 0x0F)) & 1) == 0)
+			continue;
+		filter->statusPass[status >> 5] |= (1UL << (status & 0x1F));
+	}
+
+	filter->passAll = identity
+							&& (settings->types & MIDI_FILTER_ALL_TYPES) == MIDI_FILTER_ALL_TYPES
+							&& settings->channels == MIDI_FILTER_ALL_CHANNELS;
+}
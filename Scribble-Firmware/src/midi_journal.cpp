@@ -0,0 +1,84 @@
+#include "Arduino.h"
+#include "midi_journal.h"
+#include "MIDI.h"
+
+static const char* MIDI_JOURNAL_TAG = "MIDI JOURNAL";
+
+MidiJournalEntry journalEntries[MIDI_JOURNAL_LENGTH];
+// Total records written, the next one goes at journalHead % MIDI_JOURNAL_LENGTH
+uint32_t journalHead = 0;
+volatile bool journalFrozen = false;
+portMUX_TYPE journalMux = portMUX_INITIALIZER_UNLOCKED;
+
+MidiJournalStats midiJournalStats;
+
+void midiJournal_Reset()
+{
+	portENTER_CRITICAL(&journalMux);
+	journalHead = 0;
+	memset(&midiJournalStats, 0, sizeof(MidiJournalStats));
+	portEXIT_CRITICAL(&journalMux);
+	ESP_LOGD(MIDI_JOURNAL_TAG, "MIDI journal cleared");
+}
+
+// Called from the MIDI handlers, the thru path and every sender task, so it only
+// stamps the time and stores a handful of bytes
+void midiJournal_Record(uint8_t event, uint8_t interface, uint8_t route, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	// Clock ticks and active sensing would push everything else out within a second
+	if(status == midi::Clock || status == midi::ActiveSensing)
+		return;
+
+	uint32_t now = micros();
+	if(journalFrozen)
+	{
+		midiJournalStats.skipped++;
+		return;
+	}
+
+	portENTER_CRITICAL(&journalMux);
+	MidiJournalEntry* entry = &journalEntries[journalHead & (MIDI_JOURNAL_LENGTH - 1)];
+	entry->timeUs = now;
+	entry->event = event;
+	entry->interface = interface;
+	entry->route = route;
+	entry->status = status;
+	entry->data1 = data1;
+	entry->data2 = data2;
+	journalHead++;
+	midiJournalStats.recorded++;
+	portEXIT_CRITICAL(&journalMux);
+}
+
+// Stop recording while a report is read out, so it is not overwritten underneath
+void midiJournal_Freeze(bool freeze)
+{
+	journalFrozen = freeze;
+}
+
+uint16_t midiJournal_GetCount()
+{
+	return journalHead < MIDI_JOURNAL_LENGTH ? journalHead : MIDI_JOURNAL_LENGTH;
+}
+
+// Pack a record, 0 being the oldest, as
+// [time us (4 bytes, little endian), event << 4 | interface, route, status, data 1, data 2]
+void midiJournal_PackRecord(uint16_t index, uint8_t* bytes)
+{
+	uint32_t first = journalHead - midiJournal_GetCount();
+	const MidiJournalEntry* entry = &journalEntries[(first + index) & (MIDI_JOURNAL_LENGTH - 1)];
+	bytes[0] = entry->timeUs;
+	bytes[1] = entry->timeUs >> 8;
+	bytes[2] = entry->timeUs >> 16;
+	bytes[3] = entry->timeUs >> 24;
+	bytes[4] = (entry->event << 4) | (entry->interface & 0x0F);
+	bytes[5] = entry->route;
+	bytes[6] = entry->status;
+	bytes[7] = entry->data1;
+	bytes[8] = entry->data2;
+}
+
+const MidiJournalStats* midiJournal_GetStats()
+{
+	return &midiJournalStats;
+}
@@ -0,0 +1,131 @@
+#include "Arduino.h"
+#include "midi_loop.h"
+#include "main.h"
+#include "midi_routing.h"
+
+static const char* MIDI_LOOP_TAG = "MIDI LOOP";
+
+// A fingerprint of something sent out of an interface and when it went
+typedef struct
+{
+	uint32_t fingerprint;
+	uint32_t timeMs;
+} MidiLoopEntry;
+
+typedef struct
+{
+	MidiLoopEntry entries[MIDI_LOOP_RING_LENGTH];
+	uint8_t head;
+	uint8_t stormEchoes;
+	uint32_t stormStartMs;
+	MidiLoopStats stats;
+} MidiLoopRing;
+
+MidiLoopRing midiLoopRings[NUM_MIDI_INTERFACES];
+uint8_t midiLoopWarning;
+portMUX_TYPE midiLoopMux = portMUX_INITIALIZER_UNLOCKED;
+
+void midiLoop_Init()
+{
+	memset(midiLoopRings, 0, sizeof(midiLoopRings));
+	midiLoopWarning = 0;
+}
+
+// Short messages are their own fingerprint. The status byte keeps it from ever being 0,
+// which marks an empty slot
+uint32_t midiLoop_Fingerprint(uint8_t status, uint8_t data1, uint8_t data2)
+{
+	return ((uint32_t)status << 16) | ((uint32_t)data1 << 8) | data2;
+}
+
+// SysEx is hashed (FNV-1a) with the top bit set so it can't collide with a short message
+uint32_t midiLoop_FingerprintSysex(const uint8_t* data, unsigned length)
+{
+	uint32_t hash = 2166136261UL;
+	for(unsigned i=0; i<length; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619UL;
+	}
+	return hash | 0x80000000UL;
+}
+
+// Note a message going out of every interface in the mask
+// Called for thru as it is received, leaving out the port it came in on, and for our own messages as they are sent
+void midiLoop_Record(uint8_t mask, uint32_t fingerprint)
+{
+	mask &= MIDI_ROUTE_ALL;
+	uint32_t now = millis();
+	portENTER_CRITICAL(&midiLoopMux);
+	while(mask)
+	{
+		MidiLoopRing* ring = &midiLoopRings[__builtin_ctz(mask)];
+		mask &= mask - 1;
+		ring->entries[ring->head].fingerprint = fingerprint;
+		ring->entries[ring->head].timeMs = now;
+		ring->head = (ring->head + 1) & (MIDI_LOOP_RING_LENGTH - 1);
+	}
+	portEXIT_CRITICAL(&midiLoopMux);
+}
+
+// Check a received message against what recently went out of the same interface
+// Returns true if it should be dropped. Enough echoes in a row suspend the interface's thru
+// Only ever called for the types in MIDI_LOOP_COVERED_TYPES, see midi_loop.h
+bool midiLoop_IsEcho(uint8_t interface, uint32_t fingerprint)
+{
+	if(interface >= NUM_MIDI_INTERFACES)
+		return false;
+
+	MidiLoopRing* ring = &midiLoopRings[interface];
+	uint32_t now = millis();
+	bool echo = false;
+	bool storm = false;
+	portENTER_CRITICAL(&midiLoopMux);
+	for(uint8_t i=0; i<MIDI_LOOP_RING_LENGTH; i++)
+	{
+		if(ring->entries[i].fingerprint == fingerprint && now - ring->entries[i].timeMs < MIDI_LOOP_ECHO_WINDOW_MS)
+		{
+			echo = true;
+			break;
+		}
+	}
+	if(echo)
+	{
+		ring->stats.echoes++;
+		if(now - ring->stormStartMs > MIDI_LOOP_STORM_WINDOW_MS)
+		{
+			ring->stormStartMs = now;
+			ring->stormEchoes = 0;
+		}
+		if(++ring->stormEchoes >= MIDI_LOOP_STORM_ECHOES)
+		{
+			ring->stormEchoes = 0;
+			ring->stats.suspensions++;
+			midiLoopWarning |= (1 << interface);
+			storm = true;
+		}
+	}
+	portEXIT_CRITICAL(&midiLoopMux);
+
+	if(storm)
+	{
+		ESP_LOGW(MIDI_LOOP_TAG, "Feedback loop on interface %d, thru suspended for %d ms", interface, MIDI_LOOP_SUSPEND_MS);
+		midiRouting_SuspendThru(interface, MIDI_LOOP_SUSPEND_MS);
+	}
+	return echo;
+}
+
+// Interfaces that have tripped the loop breaker since the last call, each reported once
+uint8_t midiLoop_TakeWarning()
+{
+	portENTER_CRITICAL(&midiLoopMux);
+	uint8_t warning = midiLoopWarning;
+	midiLoopWarning = 0;
+	portEXIT_CRITICAL(&midiLoopMux);
+	return warning;
+}
+
+const MidiLoopStats* midiLoop_GetStats(uint8_t interface)
+{
+	return &midiLoopRings[interface].stats;
+}
@@ -0,0 +1,809 @@
+#include "Arduino.h"
+#include "midi_output.h"
+#include "main.h"
+#include "task_priorities.h"
+#include "hardware_def.h"
+#include "midi_routing.h"
+#include "midi_journal.h"
+#include "midi_loop.h"
+#include "esp32_settings.h"
+#ifdef USE_SERIAL1_MIDI
+#include "serial_midi_encoder.h"
+#endif
+#include "ble_midi_packer.h"
+#ifdef USE_BLE_MIDI
+#include "NimBLEDevice.h"
+#endif
+#ifdef USE_USBD_MIDI
+#include "tusb.h" // tud_midi_stream_write()
+#include "esp32-hal-tinyusb.h" // tud_mounted()
+#endif
+
+static const char* MIDI_OUTPUT_TAG = "MIDI OUTPUT";
+
+// BLE-MIDI service and its data I/O characteristic, as created by the BLE-MIDI library
+#define BLE_MIDI_SERVICE_UUID				"03b80e5a-ede8-4b33-a751-6ce34ec4c700"
+#define BLE_MIDI_CHARACTERISTIC_UUID	"7772e5db-3868-4112-a1a9-f2669d106bf3"
+// Used until a central has negotiated its own connection interval
+#define BLE_MIDI_DEFAULT_INTERVAL_MS	15
+
+// Wire time of one byte at 31250 baud (start, 8 data and stop bits)
+#define SERIAL_MIDI_BYTE_US				320
+// UART hardware FIFO. Serial1 runs without a software TX buffer so this is all that is queued
+#define SERIAL_MIDI_UART_FIFO				128
+// Bytes let into the FIFO ahead of the wire. Realtime bytes wait behind at most this many,
+// while the wire still stays busy across a one tick sleep
+#define SERIAL_MIDI_TX_AHEAD				6
+
+// A CC held back by the coalescer, sent with the latest value seen when the window closes
+typedef struct
+{
+	uint8_t channel;
+	uint8_t number;
+	uint8_t value;
+	bool thru;
+} CoalescedCc;
+
+// A stack waiting to be sent, tagged with how many single messages had been queued ahead of it
+typedef struct
+{
+	uint32_t sequence;
+	MidiOutputStack stack;
+} QueuedStack;
+
+typedef struct
+{
+	QueueHandle_t messages;
+	QueueHandle_t realtime;
+	QueueHandle_t stacks;
+	MidiOutputStack stack;			// Stack being sent, a message at a time
+	uint8_t stackPosition;
+	uint32_t messagesQueued;		// Single messages queued and taken so far. A stack only starts once
+	uint32_t messagesTaken;			// everything queued ahead of it has been taken, keeping both in FIFO order
+	QueueHandle_t sysex;
+	MidiOutputSysexChunk sysexChunk;	// SysEx chunk being sent, a fragment at a time
+	uint8_t sysexPosition;
+	bool sysexOpen;					// Inside a SysEx, so only realtime may go between its bytes
+	uint32_t sysexLastMs;
+	uint16_t coalesceWindowMs;		// 0 sends every CC as it comes
+	CoalescedCc coalesced[MIDI_OUTPUT_COALESCE_SLOTS];
+	uint8_t coalescedCount;
+	uint8_t coalescedSent;			// Held CCs already sent from the front of the list
+	uint32_t coalesceStartMs;
+	TaskHandle_t task;
+	uint8_t interface;
+	MidiOutputStats stats;
+} MidiOutputRing;
+
+MidiOutputRing midiOutputRings[NUM_MIDI_OUTPUTS];
+// Keeps a stack's sequence in step with the single messages queued from other tasks
+portMUX_TYPE midiOutputOrderMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* senderTaskNames[] = {"MIDI Out 0", "MIDI Out 1", "MIDI Out 2", "MIDI Out 3"};
+
+BleMidiOutputStats bleMidiOutputStats;
+#ifdef USE_BLE_MIDI
+static BleMidiPacker blePacker;
+// When the last notification went out, for holding the next one to one per connection interval
+static uint32_t bleLastPacketUs;
+#endif
+
+SerialMidiOutputStats serialMidiOutputStats;
+static uint32_t serialWindowSecond;
+static uint32_t serialWindowBytes;
+#ifdef USE_SERIAL1_MIDI
+static SerialMidiEncoder serialEncoder;
+// Held by every write the firmware makes to Serial1, see midiOutput_SerialTask()
+static SemaphoreHandle_t serialMidiMutex = NULL;
+#endif
+
+// Create a ring and a sender task for every interface, so a slow transport
+// only ever holds up its own messages
+// Call after the settings boot check has mounted the file system
+void midiOutput_Init()
+{
+	// Every output starts with coalescing off if the file is missing or from a build with a different number of outputs
+	uint16_t coalesceWindows[NUM_MIDI_OUTPUTS];
+	if(!esp32Settings_ReadFile(MIDI_OUTPUT_COALESCE_FILE, coalesceWindows, sizeof(coalesceWindows)))
+		memset(coalesceWindows, 0, sizeof(coalesceWindows));
+#ifdef USE_SERIAL1_MIDI
+	serialMidiMutex = xSemaphoreCreateMutex();
+#endif
+	for(uint8_t i=0; i<NUM_MIDI_OUTPUTS; i++)
+	{
+		MidiOutputRing* ring = &midiOutputRings[i];
+		memset(&ring->stats, 0, sizeof(MidiOutputStats));
+		ring->interface = i;
+		ring->messages = xQueueCreate(MIDI_OUTPUT_RING_LENGTH, sizeof(MidiOutputMessage));
+		ring->realtime = xQueueCreate(MIDI_OUTPUT_REALTIME_LENGTH, sizeof(MidiOutputMessage));
+		ring->stacks = xQueueCreate(MIDI_OUTPUT_STACK_LENGTH, sizeof(QueuedStack));
+		ring->stack.length = 0;
+		ring->stackPosition = 0;
+		ring->messagesQueued = 0;
+		ring->messagesTaken = 0;
+		ring->sysex = xQueueCreate(MIDI_OUTPUT_SYSEX_LENGTH, sizeof(MidiOutputSysexChunk));
+		ring->sysexChunk.length = 0;
+		ring->sysexPosition = 0;
+		ring->sysexOpen = false;
+		ring->coalesceWindowMs = coalesceWindows[i];
+		ring->coalescedCount = 0;
+		ring->coalescedSent = 0;
+		TaskFunction_t taskFunction = midiOutput_Task;
+#ifdef USE_BLE_MIDI
+		if(i == MidiBLE)
+			taskFunction = midiOutput_BleTask;
+#endif
+#ifdef USE_SERIAL1_MIDI
+		if(i == MidiSerial1)
+			taskFunction = midiOutput_SerialTask;
+#endif
+		BaseType_t taskResult = xTaskCreatePinnedToCore(
+			taskFunction, // Task function. 
+			senderTaskNames[i], // name of task. 
+			4096, // Stack size of task 
+			ring, // parameter of the task 
+			MIDI_OUTPUT_TASK_PRIORITY, // priority of the task 
+			&ring->task, // Task handle to keep track of created task 
+			1); // pin task to core 1 
+		ESP_LOGI(MIDI_OUTPUT_TAG, "MIDI output %d task created: %d", i, taskResult);
+	}
+}
+
+// Let the loop breaker know one of our own channel messages went out, so it can spot it coming back
+// Realtime is left out, clocks would push everything else out of its ring. Thru was noted as it came in
+static inline void recordSent(MidiOutputRing* ring, const MidiOutputMessage* message, uint8_t status)
+{
+	if(!message->thru && status < midi::SystemExclusive)
+		midiLoop_Record(1 << ring->interface, midiLoop_Fingerprint(status, message->data1, message->data2));
+}
+
+// A stack is being sent, or the next one has every single message queued ahead of it behind it
+static bool stackDue(MidiOutputRing* ring)
+{
+	if(ring->stackPosition < ring->stack.length)
+		return true;
+	QueuedStack queued;
+	if(xQueuePeek(ring->stacks, &queued, 0) != pdTRUE)
+		return false;
+	return (int32_t)(ring->messagesTaken - queued.sequence) >= 0;
+}
+
+// Take the next message out of the stack being sent, starting the next queued stack if needed
+// Only call once stackDue() says a stack is due
+static bool nextStackMessage(MidiOutputRing* ring, MidiOutputMessage* message)
+{
+	if(ring->stackPosition >= ring->stack.length)
+	{
+		QueuedStack queued;
+		if(xQueueReceive(ring->stacks, &queued, 0) != pdTRUE)
+			return false;
+		memcpy(&ring->stack, &queued.stack, sizeof(MidiOutputStack));
+		ring->stackPosition = 0;
+	}
+
+	uint8_t status = ring->stack.bytes[ring->stackPosition];
+	uint8_t length = 1 + bleMidiPacker_DataLength(status);
+	// Channel messages go back to the type and 1-indexed channel the MIDI library uses
+	message->type = status < 0xF0 ? (status & 0xF0) : status;
+	message->channel = status < 0xF0 ? (status & 0x0F) + 1 : 0;
+	message->data1 = length > 1 ? ring->stack.bytes[ring->stackPosition + 1] : 0;
+	message->data2 = length > 2 ? ring->stack.bytes[ring->stackPosition + 2] : 0;
+	message->thru = false;
+	ring->stackPosition += length;
+	return true;
+}
+
+// Take up to two raw SysEx bytes as a SystemExclusive message with the byte count as
+// its channel. Small fragments let realtime bytes in between without holding a whole chunk
+static bool nextSysexFragment(MidiOutputRing* ring, MidiOutputMessage* message)
+{
+	if(ring->sysexPosition >= ring->sysexChunk.length)
+	{
+		if(xQueueReceive(ring->sysex, &ring->sysexChunk, 0) != pdTRUE)
+		{
+			// Close a stream whose source went quiet or cut this destination out
+			if(ring->sysexOpen && millis() - ring->sysexLastMs > MIDI_OUTPUT_SYSEX_TIMEOUT_MS)
+			{
+				ring->sysexOpen = false;
+				ring->stats.sysexTimeouts++;
+				*message = {midi::SystemExclusive, 1, midi::SystemExclusiveEnd, 0};
+				return true;
+			}
+			return false;
+		}
+		ring->sysexPosition = 0;
+		ring->stats.sysexChunks++;
+	}
+
+	uint8_t count = ring->sysexChunk.length - ring->sysexPosition;
+	if(count > 2)
+		count = 2;
+	message->type = midi::SystemExclusive;
+	message->channel = count;
+	message->data1 = ring->sysexChunk.bytes[ring->sysexPosition];
+	message->data2 = count > 1 ? ring->sysexChunk.bytes[ring->sysexPosition + 1] : 0;
+	ring->sysexPosition += count;
+
+	if(message->data1 == midi::SystemExclusiveStart)
+		ring->sysexOpen = true;
+	if(message->data1 == midi::SystemExclusiveEnd || (count > 1 && message->data2 == midi::SystemExclusiveEnd))
+		ring->sysexOpen = false;
+	ring->sysexLastMs = millis();
+	return true;
+}
+
+// Hold a CC back, replacing the value of one already held for the same channel and number
+// Returns false if every slot is taken
+static bool coalesceCc(MidiOutputRing* ring, const MidiOutputMessage* message)
+{
+	for(uint8_t i=ring->coalescedSent; i<ring->coalescedCount; i++)
+	{
+		CoalescedCc* held = &ring->coalesced[i];
+		if(held->channel == message->channel && held->number == message->data1)
+		{
+			held->value = message->data2;
+			held->thru = message->thru;
+			ring->stats.ccCoalesced++;
+			return true;
+		}
+	}
+
+	if(ring->coalescedCount >= MIDI_OUTPUT_COALESCE_SLOTS)
+		return false;
+	if(ring->coalescedCount == 0)
+		ring->coalesceStartMs = millis();
+	ring->coalesced[ring->coalescedCount++] = {message->channel, message->data1, message->data2, message->thru};
+	return true;
+}
+
+// Send held CCs in the order they first arrived, once the window has closed or when
+// something that must not overtake them is next
+static bool nextCoalescedCc(MidiOutputRing* ring, MidiOutputMessage* message, bool force)
+{
+	if(ring->coalescedSent >= ring->coalescedCount)
+		return false;
+	if(!force && millis() - ring->coalesceStartMs < ring->coalesceWindowMs)
+		return false;
+
+	CoalescedCc* held = &ring->coalesced[ring->coalescedSent++];
+	*message = {midi::ControlChange, held->channel, held->number, held->value, held->thru};
+	if(ring->coalescedSent >= ring->coalescedCount)
+	{
+		ring->coalescedCount = 0;
+		ring->coalescedSent = 0;
+	}
+	return true;
+}
+
+// Take the next message from a ring: realtime first, then SysEx, then stacks and single messages
+// in the order they were queued. Once a SysEx has started nothing but realtime goes out until it ends
+// With coalescing on, CCs are held for the window while notes, PCs and stacks still pass
+// straight through, after any CCs that were queued ahead of them
+static bool receiveMessage(MidiOutputRing* ring, MidiOutputMessage* message)
+{
+	if(xQueueReceive(ring->realtime, message, 0) == pdTRUE || nextSysexFragment(ring, message))
+		return true;
+	if(ring->sysexOpen)
+		return false;
+	if(nextCoalescedCc(ring, message, false))
+		return true;
+
+	while(1)
+	{
+		// Stacks and single messages go out in the order they were queued
+		if(stackDue(ring))
+			return nextCoalescedCc(ring, message, true) || nextStackMessage(ring, message);
+		if(xQueuePeek(ring->messages, message, 0) != pdTRUE)
+			return false;
+
+		bool coalescing = ring->coalesceWindowMs > 0 && message->type == midi::ControlChange;
+		if(!coalescing && nextCoalescedCc(ring, message, true))
+			return true;
+		xQueueReceive(ring->messages, message, 0);
+		ring->messagesTaken++;
+		if(!coalescing)
+			return true;
+		// Out of slots, send this one as it is
+		if(!coalesceCc(ring, message))
+			return true;
+	}
+}
+
+// How long a sender with nothing to do may sleep. An open SysEx needs waking to time out,
+// held CCs when their window closes
+static TickType_t idleWait(MidiOutputRing* ring)
+{
+	if(ring->coalescedSent < ring->coalescedCount)
+	{
+		uint32_t elapsed = millis() - ring->coalesceStartMs;
+		return elapsed >= ring->coalesceWindowMs ? 1 : pdMS_TO_TICKS(ring->coalesceWindowMs - elapsed);
+	}
+	return ring->sysexOpen ? pdMS_TO_TICKS(MIDI_OUTPUT_SYSEX_TIMEOUT_MS) : portMAX_DELAY;
+}
+
+// Drains one interface's rings, sending each message as it is taken
+void midiOutput_Task(void* parameter)
+{
+	MidiOutputRing* ring = (MidiOutputRing*)parameter;
+	MidiOutputMessage message;
+	while(1)
+	{
+		if(!receiveMessage(ring, &message))
+		{
+			ulTaskNotifyTake(pdTRUE, idleWait(ring));
+			continue;
+		}
+
+		if(message.type == midi::SystemExclusive)
+		{
+#ifdef USE_USBD_MIDI
+			// The USB MIDI stream writer packs SysEx across calls itself
+			if(ring->interface == MidiUSBD)
+			{
+				uint8_t bytes[2] = {message.data1, message.data2};
+				uint8_t written = 0;
+				while(written < message.channel && tud_mounted())
+				{
+					written += tud_midi_stream_write(0, &bytes[written], message.channel - written);
+					if(written < message.channel)
+						vTaskDelay(1);
+				}
+			}
+#endif
+			continue;
+		}
+
+		uint32_t start = micros();
+		midi_SendMessage((MidiInterfaceType)ring->interface, (midi::MidiType)message.type, message.channel, message.data1, message.data2);
+		uint32_t elapsed = micros() - start;
+		uint8_t status = bleMidiPacker_Status(message.type, message.channel);
+		midiJournal_Record(MidiJournalSent, ring->interface, 0, status, message.data1, message.data2);
+		recordSent(ring, &message, status);
+		ring->stats.sent++;
+		if(elapsed > ring->stats.sendUsMax)
+			ring->stats.sendUsMax = elapsed;
+	}
+}
+
+#ifdef USE_BLE_MIDI
+// Look up the BLE-MIDI characteristic and the first central's connection interval and payload size
+// Returns NULL when nobody is connected
+static NimBLECharacteristic* bleMidiConnection(uint16_t* intervalMs, uint16_t* payload)
+{
+	*intervalMs = BLE_MIDI_DEFAULT_INTERVAL_MS;
+	*payload = BLE_MIDI_PACKET_MIN;
+	NimBLEServer* server = NimBLEDevice::getServer();
+	if(server == NULL || server->getConnectedCount() == 0)
+		return NULL;
+
+	NimBLEConnInfo info = server->getPeerInfo(0);
+	// Interval is in 1.25ms units
+	*intervalMs = (info.getConnInterval() * 5 + 3) / 4;
+	*payload = info.getMTU() - 3;
+
+	NimBLEService* service = server->getServiceByUUID(BLE_MIDI_SERVICE_UUID);
+	if(service == NULL)
+		return NULL;
+	return service->getCharacteristic(BLE_MIDI_CHARACTERISTIC_UUID);
+}
+
+// Take the next message, waiting for one until the interval that started at sinceUs runs out
+static bool bleMidiWaitMessage(MidiOutputRing* ring, MidiOutputMessage* message, uint32_t sinceUs, uint16_t intervalMs)
+{
+	while(!receiveMessage(ring, message))
+	{
+		uint32_t elapsedMs = (micros() - sinceUs) / 1000;
+		if(elapsedMs >= intervalMs)
+			return false;
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(intervalMs - elapsedMs));
+	}
+	return true;
+}
+
+static void bleMidiSendPacket(MidiOutputRing* ring, NimBLECharacteristic* characteristic, uint32_t firstUs)
+{
+	characteristic->setValue(blePacker.buffer, blePacker.length);
+	characteristic->notify();
+	bleLastPacketUs = micros();
+	midiJournal_Record(MidiJournalBlePacket, ring->interface, 0, 0, blePacker.messages, 0);
+
+	uint32_t latency = micros() - firstUs;
+	ring->stats.sent += blePacker.messages;
+	bleMidiOutputStats.packets++;
+	bleMidiOutputStats.messages += blePacker.messages;
+	if(blePacker.messages > bleMidiOutputStats.maxMessages)
+		bleMidiOutputStats.maxMessages = blePacker.messages;
+	bleMidiOutputStats.latencyUsTotal += latency;
+	if(latency > bleMidiOutputStats.latencyUsMax)
+		bleMidiOutputStats.latencyUsMax = latency;
+	if(latency > ring->stats.sendUsMax)
+		ring->stats.sendUsMax = latency;
+}
+
+// Drains the BLE rings into at most one notification per connection interval. A message
+// with no notification sent in the last interval goes out at once, along with anything
+// already queued behind it. The central only picks up one notification per connection event,
+// so what arrives within an interval of the last one is held and goes out together when it ends,
+// each message keeping its own timestamp
+void midiOutput_BleTask(void* parameter)
+{
+	MidiOutputRing* ring = (MidiOutputRing*)parameter;
+	MidiOutputMessage message;
+	while(1)
+	{
+		if(!receiveMessage(ring, &message))
+		{
+			ulTaskNotifyTake(pdTRUE, idleWait(ring));
+			continue;
+		}
+
+		uint16_t intervalMs;
+		uint16_t payload;
+		NimBLECharacteristic* characteristic = bleMidiConnection(&intervalMs, &payload);
+		if(characteristic == NULL)
+		{
+			// Nobody to send to. Drained so nothing stale goes out on the next connection,
+			// and not counted as sent
+			while(receiveMessage(ring, &message));
+			continue;
+		}
+
+		uint32_t firstUs = micros();
+		bleMidiPacker_Begin(&blePacker, payload);
+		do
+		{
+			if(message.type == midi::SystemExclusive)
+			{
+				uint8_t bytes[2] = {message.data1, message.data2};
+				if(!bleMidiPacker_AddSysex(&blePacker, millis(), bytes, message.channel))
+				{
+					bleMidiSendPacket(ring, characteristic, firstUs);
+					firstUs = micros();
+					bleMidiPacker_Begin(&blePacker, payload);
+					bleMidiPacker_AddSysex(&blePacker, millis(), bytes, message.channel);
+				}
+				continue;
+			}
+
+			uint8_t status = bleMidiPacker_Status(message.type, message.channel);
+			if(!bleMidiPacker_Add(&blePacker, millis(), status, message.data1, message.data2))
+			{
+				// Packet full, send it and start the next one with this message
+				bleMidiSendPacket(ring, characteristic, firstUs);
+				firstUs = micros();
+				bleMidiPacker_Begin(&blePacker, payload);
+				bleMidiPacker_Add(&blePacker, millis(), status, message.data1, message.data2);
+			}
+			midiJournal_Record(MidiJournalSent, ring->interface, 0, status, message.data1, message.data2);
+			recordSent(ring, &message, status);
+		} while(bleMidiWaitMessage(ring, &message, bleLastPacketUs, intervalMs));
+		bleMidiSendPacket(ring, characteristic, firstUs);
+	}
+}
+#endif
+
+// Add bytes to the current one second wire time window, rolling it over when a new second starts
+static void serialMidiCount(uint8_t bytes)
+{
+	uint32_t second = millis() / 1000;
+	if(second != serialWindowSecond)
+	{
+		// A window with nothing sent after it counts as an idle second
+		uint32_t lastBytes = (second == serialWindowSecond + 1) ? serialWindowBytes : 0;
+		serialMidiOutputStats.wireUsLastSecond = lastBytes * SERIAL_MIDI_BYTE_US;
+		serialWindowSecond = second;
+		serialWindowBytes = 0;
+	}
+	serialWindowBytes += bytes;
+	serialMidiOutputStats.bytes += bytes;
+	if(serialWindowBytes * SERIAL_MIDI_BYTE_US > serialMidiOutputStats.wireUsPeak)
+		serialMidiOutputStats.wireUsPeak = serialWindowBytes * SERIAL_MIDI_BYTE_US;
+}
+
+// Sources the MIDI handler passes through to Serial1 itself, with its own status bytes.
+// Filtered routes are forwarded through the output ring and don't count
+static uint8_t serialMidiThruSources()
+{
+	uint8_t sources = 0;
+	for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+	{
+		if(midiRouting_GetThruMask(source) & (1 << MidiSerial1))
+			sources |= (1 << source);
+	}
+	return sources;
+}
+
+#ifdef USE_SERIAL1_MIDI
+// Running status is only safe while nothing else writes to the port, and the MIDI handler's
+// thru can't be made to take serialMidiMutex. Logged when it changes, as the factory thru
+// defaults keep it off
+static bool serialMidiRunningStatusAllowed()
+{
+	uint8_t blockers = serialMidiThruSources();
+	bool allowed = blockers == 0;
+	if(allowed != (bool)serialMidiOutputStats.runningStatusActive)
+	{
+		ESP_LOGI(MIDI_OUTPUT_TAG, "Serial1 running status %s (thru sources 0x%02x)", allowed ? "on" : "off", blockers);
+	}
+	serialMidiOutputStats.runningStatusActive = allowed;
+	serialMidiOutputStats.runningStatusBlockers = blockers;
+	return allowed;
+}
+
+// Let the FIFO drain to a few bytes before the next write, so a realtime byte queued
+// meanwhile waits behind at most SERIAL_MIDI_TX_AHEAD bytes
+static void serialMidiWaitFifo()
+{
+	while(SERIAL_MIDI_UART_FIFO - TRS_SERIAL_PORT.availableForWrite() >= SERIAL_MIDI_TX_AHEAD)
+		vTaskDelay(1);
+}
+
+// Take any realtime bytes waiting, to go out ahead of the next byte of a message
+static uint8_t serialMidiTakeRealtime(MidiOutputRing* ring, uint8_t* bytes, uint8_t space)
+{
+	uint8_t length = 0;
+	MidiOutputMessage realtime;
+	while(length < space && xQueueReceive(ring->realtime, &realtime, 0) == pdTRUE)
+	{
+		bytes[length++] = realtime.type;
+		midiJournal_Record(MidiJournalSent, ring->interface, 0, realtime.type, 0, 0);
+		ring->stats.sent++;
+	}
+	return length;
+}
+
+// Drains the Serial1 rings a message at a time. Every write the firmware makes to the port
+// holds serialMidiMutex for the whole message.
+// The MIDI handler's thru writes to the port directly and can't take the lock. While any
+// of it reaches Serial1 the port is shared: running status is off and each message, with
+// the realtime bytes waiting ahead of it, goes to the UART in a single call. The UART
+// driver holds its own TX lock for a whole call, so thru never lands inside one of our messages.
+// With no thru on the port it is ours alone: running status is used, and the FIFO is
+// kept short byte by byte so a realtime byte can go out between the bytes of a message
+void midiOutput_SerialTask(void* parameter)
+{
+	MidiOutputRing* ring = (MidiOutputRing*)parameter;
+	MidiOutputMessage message;
+	// Realtime bytes that have built up plus the longest message
+	uint8_t bytes[MIDI_OUTPUT_REALTIME_LENGTH + SERIAL_MIDI_MAX_BYTES];
+	uint8_t encoded[SERIAL_MIDI_MAX_BYTES];
+	serialMidiEncoder_Reset(&serialEncoder);
+	while(1)
+	{
+		if(!receiveMessage(ring, &message))
+		{
+			ulTaskNotifyTake(pdTRUE, idleWait(ring));
+			continue;
+		}
+
+		uint32_t start = micros();
+		uint8_t length = 0;
+		serialMidiWaitFifo();
+		if(message.type == midi::SystemExclusive)
+		{
+			// Fragments go out whole, but in shared use thru can still fall between them.
+			// Running status does not carry across the SysEx
+			bytes[length++] = message.data1;
+			if(message.channel > 1)
+				bytes[length++] = message.data2;
+			xSemaphoreTake(serialMidiMutex, portMAX_DELAY);
+			TRS_SERIAL_PORT.write(bytes, length);
+			xSemaphoreGive(serialMidiMutex);
+			serialMidiCount(length);
+			serialEncoder.runningStatus = 0;
+			continue;
+		}
+
+		uint8_t status = bleMidiPacker_Status(message.type, message.channel);
+		bool exclusive = serialMidiRunningStatusAllowed();
+		uint8_t encodedLength = serialMidiEncoder_Encode(&serialEncoder, status, message.data1, message.data2,
+																		exclusive, encoded);
+		xSemaphoreTake(serialMidiMutex, portMAX_DELAY);
+		if(exclusive)
+		{
+			for(uint8_t i=0; i<encodedLength; i++)
+			{
+				if(i > 0)
+					serialMidiWaitFifo();
+				length = serialMidiTakeRealtime(ring, bytes, MIDI_OUTPUT_REALTIME_LENGTH);
+				if(i > 0)
+					serialMidiOutputStats.realtimeInserted += length;
+				bytes[length++] = encoded[i];
+				TRS_SERIAL_PORT.write(bytes, length);
+				serialMidiCount(length);
+			}
+		}
+		else
+		{
+			length = serialMidiTakeRealtime(ring, bytes, MIDI_OUTPUT_REALTIME_LENGTH);
+			memcpy(&bytes[length], encoded, encodedLength);
+			length += encodedLength;
+			TRS_SERIAL_PORT.write(bytes, length);
+			serialMidiCount(length);
+		}
+		xSemaphoreGive(serialMidiMutex);
+		midiJournal_Record(MidiJournalSent, ring->interface, 0, status, message.data1, message.data2);
+		recordSent(ring, &message, status);
+		serialMidiOutputStats.statusBytesSaved = serialEncoder.statusBytesSaved;
+
+		uint32_t elapsed = micros() - start;
+		ring->stats.sent++;
+		if(elapsed > ring->stats.sendUsMax)
+			ring->stats.sendUsMax = elapsed;
+	}
+}
+#endif
+
+// Queue a message for one interface without waiting. Safe to call from any task
+// Returns false if the message was dropped
+static bool queueMessage(uint8_t interface, midi::MidiType type, uint8_t channel, uint8_t data1, uint8_t data2, bool thru)
+{
+	if(interface >= NUM_MIDI_OUTPUTS)
+		return false;
+
+	MidiOutputRing* ring = &midiOutputRings[interface];
+	// Before the sender tasks exist, send inline
+	if(ring->task == NULL)
+	{
+#ifdef USE_SERIAL1_MIDI
+		if(interface == MidiSerial1 && serialMidiMutex != NULL)
+		{
+			xSemaphoreTake(serialMidiMutex, portMAX_DELAY);
+			midi_SendMessage(MidiSerial1, type, channel, data1, data2);
+			serialEncoder.runningStatus = 0;
+			xSemaphoreGive(serialMidiMutex);
+			return true;
+		}
+#endif
+		midi_SendMessage((MidiInterfaceType)interface, type, channel, data1, data2);
+		return true;
+	}
+
+	MidiOutputMessage message = {(uint8_t)type, channel, data1, data2, thru};
+	bool realtime = (uint8_t)type >= midi::Clock;
+	QueueHandle_t queue = realtime ? ring->realtime : ring->messages;
+	uint8_t status = bleMidiPacker_Status(type, channel);
+	if(xQueueSend(queue, &message, 0) != pdTRUE)
+	{
+		midiJournal_Record(MidiJournalDropped, interface, 0, status, data1, data2);
+		if(realtime)
+			ring->stats.realtimeOverflows++;
+		else
+			ring->stats.overflows++;
+		return false;
+	}
+
+	if(!realtime)
+	{
+		portENTER_CRITICAL(&midiOutputOrderMux);
+		ring->messagesQueued++;
+		portEXIT_CRITICAL(&midiOutputOrderMux);
+	}
+
+	uint8_t waiting = uxQueueMessagesWaiting(queue);
+	midiJournal_Record(MidiJournalQueued, interface, waiting, status, data1, data2);
+	if(realtime && waiting > ring->stats.realtimeHighWater)
+		ring->stats.realtimeHighWater = waiting;
+	else if(!realtime && waiting > ring->stats.highWater)
+		ring->stats.highWater = waiting;
+
+	xTaskNotifyGive(ring->task);
+	return true;
+}
+
+bool midiOutput_Send(uint8_t interface, midi::MidiType type, uint8_t channel, uint8_t data1, uint8_t data2)
+{
+	return queueMessage(interface, type, channel, data1, data2, false);
+}
+
+// Queue a message forwarded from another interface by a filtered route
+bool midiOutput_SendThru(uint8_t interface, midi::MidiType type, uint8_t channel, uint8_t data1, uint8_t data2)
+{
+	return queueMessage(interface, type, channel, data1, data2, true);
+}
+
+// Queue a compiled stack for one interface as a single write. Safe to call from any task
+// Returns false if the stack was dropped
+bool midiOutput_SendStack(uint8_t interface, const MidiOutputStack* stack)
+{
+	if(interface >= NUM_MIDI_OUTPUTS || stack->length == 0)
+		return false;
+
+	MidiOutputRing* ring = &midiOutputRings[interface];
+	if(ring->task == NULL)
+		return false;
+
+	// Goes out after every single message already queued, and before any queued after it
+	QueuedStack queued;
+	portENTER_CRITICAL(&midiOutputOrderMux);
+	queued.sequence = ring->messagesQueued;
+	portEXIT_CRITICAL(&midiOutputOrderMux);
+	memcpy(&queued.stack, stack, sizeof(MidiOutputStack));
+	if(xQueueSend(ring->stacks, &queued, 0) != pdTRUE)
+	{
+		midiJournal_Record(MidiJournalDropped, interface, 0, 0, stack->length, 0);
+		ring->stats.overflows++;
+		return false;
+	}
+	midiJournal_Record(MidiJournalStackQueued, interface, uxQueueMessagesWaiting(ring->stacks), 0, stack->length, 0);
+	xTaskNotifyGive(ring->task);
+	return true;
+}
+
+// Queue a chunk of a SysEx being passed through. Safe to call from any task
+// Returns false if the destination has fallen too far behind to take it
+bool midiOutput_SendSysexChunk(uint8_t interface, const MidiOutputSysexChunk* chunk)
+{
+	if(interface >= NUM_MIDI_OUTPUTS || chunk->length == 0)
+		return false;
+
+	MidiOutputRing* ring = &midiOutputRings[interface];
+	if(ring->task == NULL)
+		return false;
+
+	if(xQueueSend(ring->sysex, chunk, 0) != pdTRUE)
+	{
+		ring->stats.sysexOverflows++;
+		return false;
+	}
+	xTaskNotifyGive(ring->task);
+	return true;
+}
+
+// Coalesce CCs to one interface over windowMs, 0 to send every CC. Held CCs are only
+// ever replaced by newer values for the same channel and number, nothing else is dropped
+// Covers everything queued here: the device's own CCs and those forwarded over filtered routes.
+// Unfiltered thru is written by the MIDI handler itself and never reaches the rings, so it is
+// not coalesced. The Device API reports which sources bypass each output's window this way
+void midiOutput_SetCoalesceWindow(uint8_t interface, uint16_t windowMs)
+{
+	if(interface < NUM_MIDI_OUTPUTS)
+		midiOutputRings[interface].coalesceWindowMs = windowMs;
+}
+
+void midiOutput_SaveCoalesceWindows()
+{
+	uint16_t coalesceWindows[NUM_MIDI_OUTPUTS];
+	for(uint8_t i=0; i<NUM_MIDI_OUTPUTS; i++)
+		coalesceWindows[i] = midiOutputRings[i].coalesceWindowMs;
+	esp32Settings_SaveFile(MIDI_OUTPUT_COALESCE_FILE, coalesceWindows, sizeof(coalesceWindows));
+}
+
+uint16_t midiOutput_GetCoalesceWindow(uint8_t interface)
+{
+	if(interface >= NUM_MIDI_OUTPUTS)
+		return 0;
+	return midiOutputRings[interface].coalesceWindowMs;
+}
+
+// Pass-through SysEx waiting on one interface
+uint16_t midiOutput_GetSysexQueuedBytes(uint8_t interface)
+{
+	if(interface >= NUM_MIDI_OUTPUTS || midiOutputRings[interface].sysex == NULL)
+		return 0;
+	return uxQueueMessagesWaiting(midiOutputRings[interface].sysex) * sizeof(MidiOutputSysexChunk);
+}
+
+const MidiOutputStats* midiOutput_GetStats(uint8_t interface)
+{
+	if(interface >= NUM_MIDI_OUTPUTS)
+		return NULL;
+	return &midiOutputRings[interface].stats;
+}
+
+const BleMidiOutputStats* midiOutput_GetBleStats()
+{
+	return &bleMidiOutputStats;
+}
+
+const SerialMidiOutputStats* midiOutput_GetSerialStats()
+{
+	// Roll the window over so an idle port reads as idle
+	serialMidiCount(0);
+	// Reflect the routing now, not as of the last message sent
+	serialMidiOutputStats.runningStatusBlockers = serialMidiThruSources();
+#ifdef USE_SERIAL1_MIDI
+	serialMidiOutputStats.runningStatusActive = serialMidiOutputStats.runningStatusBlockers == 0;
+#endif
+	return &serialMidiOutputStats;
+}
@@ -0,0 +1,362 @@
+#include "Arduino.h"
+#include "esp32-hal-tinyusb.h" // tud_mounted()
+#include "freertos/timers.h"
+#include "midi_routing.h"
+#include "midi_clock.h"
+#include "midi_output.h"
+#include "midi_loop.h"
+#include "main.h"
+#include "esp32_settings.h"
+
+static const char* MIDI_ROUTING_TAG = "MIDI ROUTING";
+
+// Everything the send and forward paths read, rebuilt by midiRouting_Compile() from the
+// settings and link state so sending never has to look at either
+typedef struct
+{
+	uint8_t thruHandles[NUM_MIDI_INTERFACES][NUM_MIDI_INTERFACES];	// Layout the MIDI handler reads
+	uint8_t thruMasks[NUM_MIDI_INTERFACES];
+	// Routes with a filter are taken away from the MIDI handler's thru and forwarded here instead
+	MidiFilter filters[NUM_MIDI_INTERFACES][NUM_MIDI_INTERFACES];
+	uint8_t filteredMasks[NUM_MIDI_INTERFACES];
+	uint8_t classMasks[NUM_MIDI_ROUTE_CLASSES];
+} MidiRouteTables;
+
+// Compiled into whichever copy is not in use, then published by switching the index,
+// so readers on other cores never see a half built table
+MidiRouteTables routeTables[2];
+volatile uint8_t activeRouteTables = 0;
+// Serialises compiling along with the link state it reads. Only tasks wait for it, the timer
+// side takes it without waiting and leaves the compile pending for the next poll if it is held
+SemaphoreHandle_t routeCompileMutex = NULL;
+volatile bool routeCompilePending = false;
+
+// Serial1 has no way of knowing if a cable is plugged in, so it is always treated as up
+uint8_t routeLinkMask = (1 << MidiSerial1);
+MidiRoutingStats midiRoutingStats;
+MidiFilterSettings thruFilters[NUM_MIDI_INTERFACES][NUM_MIDI_INTERFACES];
+
+// Sources with thru suspended, and when each suspension ends. Set from the MIDI input
+// callbacks, so kept under a spinlock of its own rather than the compile mutex
+uint8_t routeSuspendMask = 0;
+uint32_t routeSuspendUntil[NUM_MIDI_INTERFACES];
+portMUX_TYPE routeSuspendMux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t handlesToMask(const uint8_t* handles)
+{
+	uint8_t mask = 0;
+	for(uint8_t i=0; i<NUM_MIDI_INTERFACES; i++)
+	{
+		if(handles[i])
+			mask |= (1 << i);
+	}
+	return mask;
+}
+
+static uint8_t readLinks()
+{
+	uint8_t links = (1 << MidiSerial1);
+	if(tud_mounted())
+		links |= (1 << MidiUSBD);
+	if(bleConnected)
+		links |= (1 << MidiBLE);
+	return links;
+}
+
+// True if a route can do what the filter says: pass everything through the MIDI handler's
+// thru, or pass only types the firmware is handed and can forward itself
+static bool filterCarriable(const MidiFilterSettings* settings)
+{
+	MidiFilter filter;
+	midiFilter_Compile(&filter, settings);
+	return filter.passAll || (settings->types & MIDI_FILTER_ALL_TYPES & ~MIDI_ROUTING_FILTERABLE_TYPES) == 0;
+}
+
+// Read the filters, or pass everything if the file is missing (a new or reset device) or from
+// a build with a different filter layout. Saved filters a route can't carry are cleared
+static void loadFilters()
+{
+	if(esp32Settings_ReadFile(MIDI_ROUTING_FILTERS_FILE, thruFilters, sizeof(thruFilters)))
+	{
+		for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+		{
+			for(uint8_t destination=0; destination<NUM_MIDI_INTERFACES; destination++)
+			{
+				if(!filterCarriable(&thruFilters[source][destination]))
+					midiFilter_Default(&thruFilters[source][destination]);
+			}
+		}
+		return;
+	}
+
+	for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+	{
+		for(uint8_t destination=0; destination<NUM_MIDI_INTERFACES; destination++)
+			midiFilter_Default(&thruFilters[source][destination]);
+	}
+	midiRouting_SaveFilters();
+}
+
+// Call after the settings boot check has mounted the file system
+void midiRouting_Init()
+{
+	loadFilters();
+	memset(&midiRoutingStats, 0, sizeof(MidiRoutingStats));
+	memset(routeTables, 0, sizeof(routeTables));
+	routeCompileMutex = xSemaphoreCreateMutex();
+	routeLinkMask = readLinks();
+	midiRouting_Compile();
+}
+
+// Set one route's filter, unless it lets through a type a filtered route can't carry (anything
+// but MIDI_ROUTING_FILTERABLE_TYPES), in which case the route keeps the filter it had
+// Takes effect on the next midiRouting_Compile(). Returns false if refused
+bool midiRouting_SetFilter(uint8_t source, uint8_t destination, const MidiFilterSettings* settings)
+{
+	if(source >= NUM_MIDI_INTERFACES || destination >= NUM_MIDI_INTERFACES)
+		return false;
+
+	uint16_t routeBit = 1 << (source * NUM_MIDI_INTERFACES + destination);
+	if(!filterCarriable(settings))
+	{
+		midiRoutingStats.filterRefused++;
+		midiRoutingStats.refusedRoutes |= routeBit;
+		ESP_LOGW(MIDI_ROUTING_TAG, "Filter refused on route %d to %d, types 0x%04x", source, destination, settings->types);
+		return false;
+	}
+	thruFilters[source][destination] = *settings;
+	midiRoutingStats.refusedRoutes &= ~routeBit;
+	return true;
+}
+
+void midiRouting_SaveFilters()
+{
+	esp32Settings_SaveFile(MIDI_ROUTING_FILTERS_FILE, thruFilters, sizeof(thruFilters));
+}
+
+static void lockCompile()
+{
+	if(routeCompileMutex != NULL)
+		xSemaphoreTake(routeCompileMutex, portMAX_DELAY);
+}
+
+static bool tryLockCompile()
+{
+	return routeCompileMutex == NULL || xSemaphoreTake(routeCompileMutex, 0) == pdTRUE;
+}
+
+static void unlockCompile()
+{
+	if(routeCompileMutex != NULL)
+		xSemaphoreGive(routeCompileMutex);
+}
+
+// Build the tables into the spare copy and publish them. Call with the compile mutex held
+static void compileTables()
+{
+	uint8_t links = routeLinkMask;
+	MidiRouteTables* tables = &routeTables[activeRouteTables ^ 1];
+	routeCompilePending = false;
+	portENTER_CRITICAL(&routeSuspendMux);
+	uint8_t suspended = routeSuspendMask;
+	portEXIT_CRITICAL(&routeSuspendMux);
+
+	// Incoming messages, one mask per source interface
+	const uint8_t* thruSettings[NUM_MIDI_INTERFACES];
+	thruSettings[MidiUSBD] = globalSettings.usbdThruHandles;
+	thruSettings[MidiBLE] = globalSettings.bleThruHandles;
+	thruSettings[MidiSerial1] = globalSettings.midi1ThruHandles;
+	for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+	{
+		uint8_t mask = handlesToMask(thruSettings[source]) & links;
+		if(suspended & (1 << source))
+			mask = 0;
+
+		uint8_t filteredMask = 0;
+		for(uint8_t destination=0; destination<NUM_MIDI_INTERFACES; destination++)
+		{
+			midiFilter_Compile(&tables->filters[source][destination], &thruFilters[source][destination]);
+			if(!tables->filters[source][destination].passAll)
+				filteredMask |= (1 << destination);
+		}
+		filteredMask &= mask;
+		mask &= ~filteredMask;
+
+		tables->thruMasks[source] = mask;
+		tables->filteredMasks[source] = filteredMask;
+		for(uint8_t destination=0; destination<NUM_MIDI_INTERFACES; destination++)
+		{
+			tables->thruHandles[source][destination] = (mask >> destination) & 1;
+		}
+	}
+
+	// Messages generated here
+	tables->classMasks[MidiRouteClock] = handlesToMask(globalSettings.midiClockOutHandles) & links;
+
+	// Publish. The MIDI handler reads its thru flags through its own pointers, which move with the index
+	activeRouteTables ^= 1;
+	usbdMidiThruHandlesPtr = tables->thruHandles[MidiUSBD];
+	bleMidiThruHandlesPtr = tables->thruHandles[MidiBLE];
+	serial1MidiThruHandlesPtr = tables->thruHandles[MidiSerial1];
+
+	midiRoutingStats.compiles++;
+	midiRoutingStats.linkMask = links;
+	midiRoutingStats.suspendMask = suspended;
+	ESP_LOGD(MIDI_ROUTING_TAG, "Links 0x%02x, thru 0x%02x 0x%02x 0x%02x, filtered 0x%02x 0x%02x 0x%02x, clock 0x%02x",
+				links, tables->thruMasks[MidiUSBD], tables->thruMasks[MidiBLE], tables->thruMasks[MidiSerial1],
+				tables->filteredMasks[MidiUSBD], tables->filteredMasks[MidiBLE], tables->filteredMasks[MidiSerial1],
+				tables->classMasks[MidiRouteClock]);
+}
+
+// Rebuild every destination mask. Call whenever the thru, filter or clock settings change.
+// Safe to call from any task, compiles are serialised and each one is published in one write
+void midiRouting_Compile()
+{
+	lockCompile();
+	compileTables();
+	unlockCompile();
+}
+
+// Check which transports are up and whether any thru suspension has run out,
+// and recompile if either changed or a compile is pending
+// Called from the indicator link poll timer, so it never waits: if a compile is already
+// running the check is left for the next poll
+void midiRouting_PollLinks()
+{
+	if(!tryLockCompile())
+		return;
+
+	bool changed = routeCompilePending;
+	uint32_t now = millis();
+	portENTER_CRITICAL(&routeSuspendMux);
+	for(uint8_t source=0; source<NUM_MIDI_INTERFACES; source++)
+	{
+		if((routeSuspendMask & (1 << source)) && (int32_t)(now - routeSuspendUntil[source]) >= 0)
+		{
+			routeSuspendMask &= ~(1 << source);
+			changed = true;
+		}
+	}
+	portEXIT_CRITICAL(&routeSuspendMux);
+
+	uint8_t links = readLinks();
+	if(links != routeLinkMask)
+	{
+		routeLinkMask = links;
+		midiRoutingStats.linkChanges++;
+		changed = true;
+	}
+
+	if(changed)
+		compileTables();
+	unlockCompile();
+}
+
+// Run by the timer service task on behalf of midiRouting_SuspendThru()
+static void pendedPoll(void* parameter, uint32_t value)
+{
+	midiRouting_PollLinks();
+}
+
+// Stop passing through anything received on a source for a while, leaving the settings alone
+// Called from the MIDI input callbacks, so the compile is handed to the timer service task
+// rather than run here. Should that queue be full, the next link poll picks it up
+void midiRouting_SuspendThru(uint8_t source, uint32_t durationMs)
+{
+	if(source >= NUM_MIDI_INTERFACES)
+		return;
+
+	portENTER_CRITICAL(&routeSuspendMux);
+	routeSuspendMask |= (1 << source);
+	routeSuspendUntil[source] = millis() + durationMs;
+	portEXIT_CRITICAL(&routeSuspendMux);
+	routeCompilePending = true;
+	xTimerPendFunctionCall(pendedPoll, NULL, 0, 0);
+}
+
+uint8_t midiRouting_GetThruMask(uint8_t source)
+{
+	if(source >= NUM_MIDI_INTERFACES)
+		return 0;
+	return routeTables[activeRouteTables].thruMasks[source];
+}
+
+// Filtered routes from a source that let a status byte through
+uint8_t midiRouting_GetFilteredMask(uint8_t source, uint8_t status)
+{
+	if(source >= NUM_MIDI_INTERFACES)
+		return 0;
+
+	const MidiRouteTables* tables = &routeTables[activeRouteTables];
+	uint8_t passMask = 0;
+	uint8_t mask = tables->filteredMasks[source];
+	while(mask)
+	{
+		uint8_t destination = __builtin_ctz(mask);
+		mask &= mask - 1;
+		uint8_t routed = status;
+		if(midiFilter_Apply(&tables->filters[source][destination], &routed))
+			passMask |= (1 << destination);
+	}
+	return passMask;
+}
+
+// Pass a received message on over the source's filtered routes, remapping its channel per route
+// Routes without a filter are left to the MIDI handler's own thru. Only ever handed CC and PC,
+// which is why filters passing anything else are refused (SysEx is streamed by midi_sysex.cpp)
+void midiRouting_Forward(uint8_t source, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	if(source >= NUM_MIDI_INTERFACES)
+		return;
+
+	const MidiRouteTables* tables = &routeTables[activeRouteTables];
+	uint8_t mask = tables->filteredMasks[source];
+	while(mask)
+	{
+		uint8_t destination = __builtin_ctz(mask);
+		mask &= mask - 1;
+		uint8_t routed = status;
+		if(!midiFilter_Apply(&tables->filters[source][destination], &routed))
+		{
+			midiRoutingStats.filterDropped++;
+			continue;
+		}
+		// Noted for the loop breaker here, after any remap, except on the way back out of the source
+		if(destination != source)
+			midiLoop_Record(1 << destination, midiLoop_Fingerprint(routed, data1, data2));
+		if(routed < midi::SystemExclusive)
+			midiOutput_SendThru(destination, (midi::MidiType)(routed & 0xF0), (routed & 0x0F) + 1, data1, data2);
+		else
+			midiOutput_SendThru(destination, (midi::MidiType)routed, 0, data1, data2);
+		midiRoutingStats.filtered++;
+	}
+}
+
+uint8_t midiRouting_GetClassMask(uint8_t routeClass)
+{
+	if(routeClass >= NUM_MIDI_ROUTE_CLASSES)
+		return 0;
+	return routeTables[activeRouteTables].classMasks[routeClass];
+}
+
+// Drop the interfaces that are down from a message's own destination mask
+uint8_t midiRouting_GetLiveMask(uint8_t mask)
+{
+	return mask & routeLinkMask;
+}
+
+// Queue one message on every interface in the mask
+void midiRouting_Send(uint8_t mask, midi::MidiType type, uint8_t channel, uint8_t data1, uint8_t data2)
+{
+	while(mask)
+	{
+		uint8_t interface = __builtin_ctz(mask);
+		mask &= mask - 1;
+		midiOutput_Send(interface, type, channel, data1, data2);
+	}
+}
+
+const MidiRoutingStats* midiRouting_GetStats()
+{
+	return &midiRoutingStats;
+}
@@ -0,0 +1,176 @@
+#include "Arduino.h"
+#include "midi_stacks.h"
+#include "midi_routing.h"
+#include "ble_midi_packer.h"
+#include "main.h"
+#include "task_Priorities.h"
+
+static const char* MIDI_STACKS_TAG = "MIDI STACKS";
+
+// Each buffer holds complete messages with their status bytes, ready to queue as one
+MidiOutputStack compiledStacks[NUM_MIDI_STACKS][NUM_MIDI_INTERFACES];
+// Interfaces with something to send, per stack
+uint8_t compiledStackMasks[NUM_MIDI_STACKS];
+portMUX_TYPE compiledStacksMux = portMUX_INITIALIZER_UNLOCKED;
+
+MidiStacksStats midiStacksStats;
+
+// Notification bits for the stacks task
+#define MIDI_STACKS_COMPILE			(1 << 0)
+#define MIDI_STACKS_SEND_PRESET		(1 << 1)
+TaskHandle_t midiStacksTask = NULL;
+
+// Append a message stack to the buffers of every interface its messages are set to
+static void appendMessages(MidiOutputStack* buffers, const MidiMessage* messages, uint8_t maxMessages)
+{
+	for(uint8_t i=0; i<maxMessages; i++)
+	{
+		if(messages[i].status == 0)
+			break;
+
+		uint8_t length = 1 + bleMidiPacker_DataLength(messages[i].status);
+		for(uint8_t interface=0; interface<NUM_MIDI_INTERFACES; interface++)
+		{
+			MidiOutputStack* buffer = &buffers[interface];
+			if(!(messages[i].midiInterface & (1 << interface))
+				|| buffer->length + length > MIDI_OUTPUT_STACK_BYTES)
+				continue;
+
+			buffer->bytes[buffer->length] = messages[i].status;
+			buffer->bytes[buffer->length + 1] = messages[i].data1 & 0x7F;
+			buffer->bytes[buffer->length + 2] = messages[i].data2 & 0x7F;
+			buffer->length += length;
+		}
+	}
+}
+
+// Swap a freshly built set of buffers in for one stack
+static void storeStack(uint8_t stack, const MidiOutputStack* buffers)
+{
+	uint8_t mask = 0;
+	for(uint8_t interface=0; interface<NUM_MIDI_INTERFACES; interface++)
+	{
+		if(buffers[interface].length > 0)
+			mask |= (1 << interface);
+		if(buffers[interface].length > midiStacksStats.bytesPeak)
+			midiStacksStats.bytesPeak = buffers[interface].length;
+	}
+
+	portENTER_CRITICAL(&compiledStacksMux);
+	memcpy(compiledStacks[stack], buffers, sizeof(compiledStacks[stack]));
+	compiledStackMasks[stack] = mask;
+	portEXIT_CRITICAL(&compiledStacksMux);
+}
+
+// Rebuild every stack for the current preset. Runs on the stacks task after a preset change
+// or an edit (see midiStacks_QueueCompile()), and directly at boot before the task exists
+void midiStacks_Compile()
+{
+	Preset* preset = &presets[globalSettings.currentPreset];
+	MidiOutputStack buffers[NUM_MIDI_INTERFACES];
+
+	for(uint8_t switchIndex=0; switchIndex<2; switchIndex++)
+	{
+		memset(buffers, 0, sizeof(buffers));
+		appendMessages(buffers, globalSettings.switchPressMessages[switchIndex], NUM_SWITCH_MESSAGES);
+		appendMessages(buffers, preset->switchPressMessages[switchIndex], NUM_SWITCH_MESSAGES);
+		storeStack(MidiStackSwitchPress + switchIndex, buffers);
+
+		memset(buffers, 0, sizeof(buffers));
+		appendMessages(buffers, globalSettings.switchHoldMessages[switchIndex], NUM_SWITCH_MESSAGES);
+		appendMessages(buffers, preset->switchHoldMessages[switchIndex], NUM_SWITCH_MESSAGES);
+		storeStack(MidiStackSwitchHold + switchIndex, buffers);
+	}
+
+	// PC bank outputs use 0 to disable the output, otherwise a 1-indexed channel
+	memset(buffers, 0, sizeof(buffers));
+	for(uint8_t interface=0; interface<NUM_MIDI_INTERFACES; interface++)
+	{
+		uint8_t channel = globalSettings.pcBankOutputs[interface];
+		if(channel == 0 || channel > 16)
+			continue;
+		buffers[interface].bytes[0] = midi::ProgramChange | (channel - 1);
+		buffers[interface].bytes[1] = globalSettings.currentPreset & 0x7F;
+		buffers[interface].length = 2;
+	}
+	appendMessages(buffers, preset->presetMessages, NUM_PRESET_MESSAGES);
+	storeStack(MidiStackPreset, buffers);
+
+	memset(buffers, 0, sizeof(buffers));
+	appendMessages(buffers, globalSettings.customMessages, NUM_CUSTOM_MESSAGES);
+	storeStack(MidiStackGlobalCustom, buffers);
+
+	memset(buffers, 0, sizeof(buffers));
+	appendMessages(buffers, preset->customMessages, NUM_CUSTOM_MESSAGES);
+	storeStack(MidiStackPresetCustom, buffers);
+
+	midiStacksStats.compiles++;
+	ESP_LOGD(MIDI_STACKS_TAG, "Compiled stacks for preset %d", globalSettings.currentPreset);
+}
+
+// Queue a compiled stack on each live interface it has messages for, one write per interface
+void midiStacks_Send(uint8_t stack)
+{
+	if(stack >= NUM_MIDI_STACKS)
+		return;
+
+	uint8_t destinations = midiRouting_GetLiveMask(compiledStackMasks[stack]);
+	while(destinations)
+	{
+		uint8_t interface = __builtin_ctz(destinations);
+		destinations &= destinations - 1;
+
+		MidiOutputStack buffer;
+		portENTER_CRITICAL(&compiledStacksMux);
+		memcpy(&buffer, &compiledStacks[stack][interface], sizeof(MidiOutputStack));
+		portEXIT_CRITICAL(&compiledStacksMux);
+		midiOutput_SendStack(interface, &buffer);
+	}
+	midiStacksStats.sends++;
+}
+
+// Compiles in the background, so a preset change from a MIDI callback never compiles on the input path
+static void midiStacks_Task(void* parameter)
+{
+	uint32_t notification;
+	while(1)
+	{
+		xTaskNotifyWait(0, UINT32_MAX, &notification, portMAX_DELAY);
+		// Requests that arrive while compiling are merged and compiled for the preset they leave current
+		midiStacks_Compile();
+		if(notification & MIDI_STACKS_SEND_PRESET)
+			midiStacks_Send(MidiStackPreset);
+	}
+}
+
+void midiStacks_Init()
+{
+	BaseType_t taskResult = xTaskCreatePinnedToCore(
+		midiStacks_Task, // Task function. 
+		"MIDI Stacks", // name of task. 
+		4096, // Stack size of task 
+		NULL, // parameter of the task 
+		MIDI_STACKS_TASK_PRIORITY, // priority of the task 
+		&midiStacksTask, // Task handle to keep track of created task 
+		1); // pin task to core 1 
+	ESP_LOGI(MIDI_STACKS_TAG, "MIDI stacks task created: %d", taskResult);
+}
+
+// Have the current preset's stacks rebuilt on the stacks task, then, after a preset change,
+// its preset stack sent. Safe to call from any task, including the MIDI callbacks
+void midiStacks_QueueCompile(bool sendPreset)
+{
+	if(midiStacksTask == NULL)
+	{
+		midiStacks_Compile();
+		if(sendPreset)
+			midiStacks_Send(MidiStackPreset);
+		return;
+	}
+	xTaskNotify(midiStacksTask, MIDI_STACKS_COMPILE | (sendPreset ? MIDI_STACKS_SEND_PRESET : 0), eSetBits);
+}
+
+const MidiStacksStats* midiStacks_GetStats()
+{
+	return &midiStacksStats;
+}
@@ -0,0 +1,290 @@
+#include "Arduino.h"
+#include "midi_sysex.h"
+#include "main.h"
+#include "device_api.h"
+#include "midi_routing.h"
+#include "midi_output.h"
+
+static const char* MIDI_SYSEX_TAG = "MIDI SYSEX";
+
+typedef enum
+{
+	SysexIdle,
+	SysexHeader,					// Matching the manufacturer ID
+	SysexCollecting,
+	SysexIgnoring					// Not ours, or dropped, until the next F0
+} SysexState;
+
+// A frame being assembled, or waiting to be parsed
+typedef struct
+{
+	uint8_t state;
+	uint8_t headerPosition;
+	uint8_t firstBlock;
+	uint8_t numBlocks;
+	uint16_t length;
+} SysexFrame;
+
+static const uint8_t manufacturerId[SYSEX_MANUFACTURER_ID_LENGTH] = SYSEX_MANUFACTURER_ID;
+
+uint8_t sysexPool[SYSEX_POOL_BLOCKS * SYSEX_BLOCK_SIZE];
+bool sysexBlockUsed[SYSEX_POOL_BLOCKS];
+portMUX_TYPE sysexPoolMux = portMUX_INITIALIZER_UNLOCKED;
+
+// One frame in progress per interface
+SysexFrame sysexFrames[NUM_MIDI_INTERFACES];
+
+// SysEx passed through from each source to its filtered routes, forwarded a chunk at a time as it arrives
+typedef struct
+{
+	MidiOutputSysexChunk chunk;		// Bytes not yet handed to the destinations
+	uint8_t destinations;				// Thru destinations still keeping up with this stream
+} SysexStream;
+
+SysexStream sysexStreams[NUM_MIDI_INTERFACES];
+QueueHandle_t sysexFrameQueue;
+
+MidiSysexStats midiSysexStats;
+
+void midiSysex_Init()
+{
+	memset(sysexBlockUsed, 0, sizeof(sysexBlockUsed));
+	memset(sysexFrames, 0, sizeof(sysexFrames));
+	memset(sysexStreams, 0, sizeof(sysexStreams));
+	memset(&midiSysexStats, 0, sizeof(MidiSysexStats));
+	sysexFrameQueue = xQueueCreate(SYSEX_FRAME_QUEUE_LENGTH, sizeof(SysexFrame));
+}
+
+static uint8_t countUsedBlocks()
+{
+	uint8_t used = 0;
+	for(uint8_t i=0; i<SYSEX_POOL_BLOCKS; i++)
+		used += sysexBlockUsed[i];
+	return used;
+}
+
+// Claim the free block with the longest free run after it, leaving the frame the most room to grow
+static bool claimFirstBlock(SysexFrame* frame)
+{
+	uint8_t bestBlock = 0;
+	uint8_t bestRun = 0;
+	portENTER_CRITICAL(&sysexPoolMux);
+	for(uint8_t i=0; i<SYSEX_POOL_BLOCKS; i++)
+	{
+		uint8_t run = 0;
+		while(i + run < SYSEX_POOL_BLOCKS && !sysexBlockUsed[i + run])
+			run++;
+		if(run > bestRun)
+		{
+			bestBlock = i;
+			bestRun = run;
+		}
+		i += run;
+	}
+	if(bestRun > 0)
+		sysexBlockUsed[bestBlock] = true;
+	portEXIT_CRITICAL(&sysexPoolMux);
+
+	if(bestRun == 0)
+		return false;
+	frame->firstBlock = bestBlock;
+	frame->numBlocks = 1;
+	uint8_t used = countUsedBlocks();
+	if(used > midiSysexStats.blocksPeak)
+		midiSysexStats.blocksPeak = used;
+	return true;
+}
+
+// Frames must stay in one piece for the parser, so they can only grow into the next block
+static bool claimNextBlock(SysexFrame* frame)
+{
+	uint8_t next = frame->firstBlock + frame->numBlocks;
+	bool claimed = false;
+	portENTER_CRITICAL(&sysexPoolMux);
+	if(next < SYSEX_POOL_BLOCKS && !sysexBlockUsed[next])
+	{
+		sysexBlockUsed[next] = true;
+		claimed = true;
+	}
+	portEXIT_CRITICAL(&sysexPoolMux);
+
+	if(!claimed)
+		return false;
+	frame->numBlocks++;
+	uint8_t used = countUsedBlocks();
+	if(used > midiSysexStats.blocksPeak)
+		midiSysexStats.blocksPeak = used;
+	return true;
+}
+
+static void releaseBlocks(const SysexFrame* frame)
+{
+	portENTER_CRITICAL(&sysexPoolMux);
+	for(uint8_t i=0; i<frame->numBlocks; i++)
+		sysexBlockUsed[frame->firstBlock + i] = false;
+	portEXIT_CRITICAL(&sysexPoolMux);
+}
+
+static void dropFrame(SysexFrame* frame)
+{
+	releaseBlocks(frame);
+	frame->numBlocks = 0;
+	frame->state = SysexIgnoring;
+	midiSysexStats.dropped++;
+}
+
+static void completeFrame(SysexFrame* frame)
+{
+	// The parser takes a C string
+	sysexPool[frame->firstBlock * SYSEX_BLOCK_SIZE + frame->length] = '\0';
+	if(xQueueSend(sysexFrameQueue, frame, 0) != pdTRUE)
+	{
+		dropFrame(frame);
+		return;
+	}
+	midiSysexStats.frames++;
+	midiSysexStats.bytes += frame->length;
+	frame->numBlocks = 0;
+	frame->state = SysexIdle;
+}
+
+// Hand a source's pending bytes to every destination still in its stream. A destination
+// with no room left is dropped from the stream rather than holding up the source or the others,
+// its sender closes the SysEx once it has caught up
+static void flushStream(uint8_t source)
+{
+	SysexStream* stream = &sysexStreams[source];
+	if(stream->chunk.length == 0)
+		return;
+
+	uint32_t streamBytes = sizeof(SysexStream);
+	uint8_t destinations = stream->destinations;
+	while(destinations)
+	{
+		uint8_t destination = __builtin_ctz(destinations);
+		destinations &= destinations - 1;
+		if(!midiOutput_SendSysexChunk(destination, &stream->chunk))
+		{
+			stream->destinations &= ~(1 << destination);
+			midiSysexStats.streamCutoffs++;
+		}
+		streamBytes += midiOutput_GetSysexQueuedBytes(destination);
+	}
+	stream->chunk.length = 0;
+	midiSysexStats.streamChunks++;
+	if(streamBytes > midiSysexStats.streamBytesPeak)
+		midiSysexStats.streamBytesPeak = streamBytes;
+}
+
+static void streamByte(uint8_t source, uint8_t byte)
+{
+	SysexStream* stream = &sysexStreams[source];
+	if(byte == midi::SystemExclusiveStart)
+	{
+		// A new F0 cuts short whatever was in flight, its destinations time out and close it.
+		// Unfiltered routes get SysEx from the MIDI handler's own thru, so only the filtered
+		// routes that pass it are streamed
+		stream->chunk.length = 0;
+		stream->destinations = midiRouting_GetFilteredMask(source, midi::SystemExclusiveStart);
+		if(stream->destinations)
+			midiSysexStats.streams++;
+	}
+	if(stream->destinations == 0)
+		return;
+
+	stream->chunk.bytes[stream->chunk.length++] = byte;
+	if(byte == midi::SystemExclusiveEnd)
+	{
+		flushStream(source);
+		stream->destinations = 0;
+	}
+	else if(stream->chunk.length == MIDI_OUTPUT_SYSEX_CHUNK_BYTES)
+	{
+		flushStream(source);
+	}
+}
+
+// Feed SysEx as it arrives from an interface, whole or in chunks
+// A chunk starting with F0 begins a frame and one ending with F7 finishes it
+void midiSysex_Receive(uint8_t interface, const uint8_t* data, unsigned length)
+{
+	if(interface >= NUM_MIDI_INTERFACES || sysexFrameQueue == NULL)
+		return;
+
+	SysexFrame* frame = &sysexFrames[interface];
+	for(unsigned i=0; i<length; i++)
+	{
+		uint8_t byte = data[i];
+		streamByte(interface, byte);
+		if(byte == midi::SystemExclusiveStart)
+		{
+			if(frame->state == SysexCollecting)
+			{
+				releaseBlocks(frame);
+				midiSysexStats.abandoned++;
+			}
+			frame->numBlocks = 0;
+			frame->length = 0;
+			frame->headerPosition = 0;
+			frame->state = SysexHeader;
+		}
+		else if(byte == midi::SystemExclusiveEnd)
+		{
+			if(frame->state == SysexCollecting)
+				completeFrame(frame);
+			frame->state = SysexIdle;
+		}
+		else if(frame->state == SysexHeader)
+		{
+			if(byte != manufacturerId[frame->headerPosition++])
+			{
+				frame->state = SysexIgnoring;
+				midiSysexStats.foreign++;
+			}
+			else if(frame->headerPosition == SYSEX_MANUFACTURER_ID_LENGTH)
+			{
+				// Our own Device API frames are not passed on. Nothing is flushed until
+				// the ID has been checked, so none of it has gone out yet
+				if(sysexStreams[interface].destinations)
+					midiSysexStats.streams--;
+				sysexStreams[interface].chunk.length = 0;
+				sysexStreams[interface].destinations = 0;
+				frame->state = SysexCollecting;
+				if(!claimFirstBlock(frame))
+					dropFrame(frame);
+			}
+		}
+		else if(frame->state == SysexCollecting)
+		{
+			// Keep a byte spare for the terminator
+			if(frame->length + 1 >= frame->numBlocks * SYSEX_BLOCK_SIZE && !claimNextBlock(frame))
+			{
+				dropFrame(frame);
+				continue;
+			}
+			sysexPool[frame->firstBlock * SYSEX_BLOCK_SIZE + frame->length] = byte;
+			frame->length++;
+		}
+	}
+	// Pass on what has arrived rather than waiting for a full chunk, once it is known not to be ours
+	if(frame->state != SysexHeader)
+		flushStream(interface);
+}
+
+// Hand completed frames to the Device API parser straight from the pool
+// Called from the main loop, so a slow settings save never holds up MIDI input
+void midiSysex_Process()
+{
+	SysexFrame frame;
+	while(sysexFrameQueue != NULL && xQueueReceive(sysexFrameQueue, &frame, 0) == pdTRUE)
+	{
+		ESP_LOGD(MIDI_SYSEX_TAG, "Device API frame of %d bytes in %d blocks", frame.length, frame.numBlocks);
+		deviceApi_Handler((char*)&sysexPool[frame.firstBlock * SYSEX_BLOCK_SIZE], MIDI_TRANSPORT);
+		releaseBlocks(&frame);
+	}
+}
+
+const MidiSysexStats* midiSysex_GetStats()
+{
+	return &midiSysexStats;
+}
@@ -0,0 +1,157 @@
+#include "Arduino.h"
+#include "display.h"
+#include "text_render.h"
+#include "numeric_field.h"
+
+static const char* NUMERIC_FIELD_TAG = "NUMERIC FIELD";
+
+void numericField_Init(	NumericField* field, int16_t x, int16_t y, int16_t w, int16_t h,
+								int16_t cursorX, int16_t cursorY, const GFXfont* font)
+{
+	memset(field, 0, sizeof(NumericField));
+	field->x = x;
+	field->y = y;
+	field->w = w;
+	field->h = h;
+	field->cursorX = cursorX;
+	field->cursorY = cursorY;
+	field->font = font;
+
+	for(uint8_t c='0'; c<='9'; c++)
+	{
+		if(c >= font->first && c <= font->last)
+			field->digitAdvance = max(field->digitAdvance, font->glyph[c - font->first].xAdvance);
+	}
+}
+
+// Call whenever the field's area has been drawn over, so the next draw repaints all of it
+void numericField_Invalidate(NumericField* field)
+{
+	field->valid = 0;
+}
+
+// Digits are centred in cells of the widest digit's advance, anything else
+// keeps its own advance. Characters missing from the font take no space
+static uint8_t layoutCells(const NumericField* field, const char* text, NumericCell* cells)
+{
+	const GFXfont* font = field->font;
+	int16_t x = field->cursorX;
+	uint8_t numCells = 0;
+	for(; text != NULL && *text != 0 && numCells < NUMERIC_FIELD_MAX_CHARS; text++)
+	{
+		uint8_t c = *text;
+		if(c < font->first || c > font->last)
+			continue;
+
+		const GFXglyph* glyph = &font->glyph[c - font->first];
+		NumericCell* cell = &cells[numCells++];
+		cell->c = c;
+		cell->x = x;
+		cell->w = glyph->xAdvance;
+		cell->cursorX = x;
+		if(c >= '0' && c <= '9')
+		{
+			cell->w = field->digitAdvance;
+			cell->cursorX = x + (field->digitAdvance - glyph->xAdvance) / 2;
+		}
+		cell->inkX1 = cell->cursorX + glyph->xOffset;
+		cell->inkX2 = cell->inkX1 + glyph->width;
+		cell->inkY1 = field->cursorY + glyph->yOffset;
+		cell->inkY2 = cell->inkY1 + glyph->height;
+		if(glyph->width == 0 || glyph->height == 0)
+		{
+			cell->inkX2 = cell->inkX1;
+			cell->inkY2 = cell->inkY1;
+		}
+		x += cell->w;
+	}
+	return numCells;
+}
+
+// Draw text into the field. Only cells whose character changed are repainted,
+// unless the layout, colours or field contents have changed in some other way
+// Returns the number of cells repainted
+uint8_t numericField_Draw(NumericField* field, const char* text, uint16_t colour, uint16_t background)
+{
+	NumericCell cells[NUMERIC_FIELD_MAX_CHARS];
+	uint8_t numCells = layoutCells(field, text, cells);
+
+	// One single character line per cell, so each glyph sits at its cell's position
+	char strings[NUMERIC_FIELD_MAX_CHARS][2];
+	TextLine lines[NUMERIC_FIELD_MAX_CHARS];
+	for(uint8_t i=0; i<numCells; i++)
+	{
+		strings[i][0] = cells[i].c;
+		strings[i][1] = 0;
+		lines[i] = {strings[i], field->font, cells[i].cursorX, field->cursorY, colour};
+	}
+
+	bool sameLayout = field->valid && numCells == field->numCells
+							&& colour == field->colour && background == field->background;
+	for(uint8_t i=0; sameLayout && i<numCells; i++)
+	{
+		if(cells[i].x != field->cells[i].x || cells[i].w != field->cells[i].w)
+			sameLayout = false;
+	}
+
+	uint8_t repainted = 0;
+	if(sameLayout)
+	{
+		for(uint8_t i=0; i<numCells; i++)
+		{
+			const NumericCell* now = &cells[i];
+			const NumericCell* old = &field->cells[i];
+			if(now->c == old->c)
+				continue;
+
+			// The cell plus wherever either glyph inks outside it, over the rows either covers
+			int16_t x1 = min(now->x, min(now->inkX1, old->inkX1));
+			int16_t x2 = max((int16_t)(now->x + now->w), max(now->inkX2, old->inkX2));
+			int16_t y1 = min(now->inkY1, old->inkY1);
+			int16_t y2 = max(now->inkY2, old->inkY2);
+			if(y1 < y2)
+				textRender_Strip(x1, y1, x2 - x1, y2 - y1, background, lines, numCells);
+			repainted++;
+		}
+		field->cellRepaints += repainted;
+	}
+	else
+	{
+		// Cover the field and any ink, old or new, hanging out of it
+		int16_t x1 = field->x;
+		int16_t x2 = field->x + field->w;
+		int16_t y1 = field->y;
+		int16_t y2 = field->y + field->h;
+		for(uint8_t i=0; i<numCells; i++)
+		{
+			x1 = min(x1, cells[i].inkX1);
+			x2 = max(x2, cells[i].inkX2);
+			if(cells[i].inkY1 < cells[i].inkY2)
+			{
+				y1 = min(y1, cells[i].inkY1);
+				y2 = max(y2, cells[i].inkY2);
+			}
+		}
+		for(uint8_t i=0; field->valid && i<field->numCells; i++)
+		{
+			x1 = min(x1, field->cells[i].inkX1);
+			x2 = max(x2, field->cells[i].inkX2);
+			if(field->cells[i].inkY1 < field->cells[i].inkY2)
+			{
+				y1 = min(y1, field->cells[i].inkY1);
+				y2 = max(y2, field->cells[i].inkY2);
+			}
+		}
+		textRender_Strip(x1, y1, x2 - x1, y2 - y1, background, lines, numCells);
+		repainted = numCells;
+		field->fullRepaints++;
+		ESP_LOGV(NUMERIC_FIELD_TAG, "Full repaint of \"%s\"", text);
+	}
+
+	memcpy(field->cells, cells, sizeof(NumericCell) * numCells);
+	field->numCells = numCells;
+	field->colour = colour;
+	field->background = background;
+	field->valid = 1;
+	return repainted;
+}
@@ -0,0 +1,208 @@
+#include "Arduino.h"
+#include "display.h"
+#include "framebuffer.h"
+#include "text_render.h"
+#include "preset_cache.h"
+#include "main.h"
+
+static const char* PRESET_CACHE_TAG = "PRESET CACHE";
+
+// Each run is a colour index in the top bits and a length in the bottom bits
+// Runs never cross a row, so a length always fits in LCD_WIDTH
+#define RUN_LENGTH_BITS		9
+#define RUN_LENGTH_MASK		((1 << RUN_LENGTH_BITS) - 1)
+
+// The cached region is the full width main area, so its rows are contiguous in the framebuffer
+#define CACHE_AREA_Y			(LCD_HEIGHT-MAIN_FILL_HEIGHT)
+
+typedef struct
+{
+	uint32_t generation;			// Cache generation it was rendered in, 0 if empty
+	uint16_t presetIndex;
+	uint8_t usable;				// 0 if the preset was tried but could not be cached
+	uint8_t numColours;
+	uint16_t numRuns;
+	uint16_t palette[PRESET_CACHE_COLOURS];
+	uint16_t runs[PRESET_CACHE_RUNS];
+} CachedFrame;
+
+CachedFrame cachedFrames[PRESET_CACHE_SLOTS];
+
+// Bumped by presetCache_Invalidate(). Frames from older generations are stale
+uint32_t cacheGeneration = 1;
+// The preset on screen. The cache is kept filled around it
+uint16_t cacheCentre = 0;
+PresetCacheStats presetCacheStats;
+
+void presetCache_Init()
+{
+	memset(cachedFrames, 0, sizeof(cachedFrames));
+	memset(&presetCacheStats, 0, sizeof(PresetCacheStats));
+}
+
+// Drop every cached frame. Call whenever anything drawn in the main area changes:
+// preset text or colours, the main or text colour, or the light mode
+// Safe to call from any task
+void presetCache_Invalidate()
+{
+	cacheGeneration++;
+	presetCacheStats.invalidations++;
+}
+
+static CachedFrame* findFrame(uint16_t presetIndex, uint32_t generation)
+{
+	for(uint8_t i=0; i<PRESET_CACHE_SLOTS; i++)
+	{
+		if(cachedFrames[i].generation == generation && cachedFrames[i].presetIndex == presetIndex)
+			return &cachedFrames[i];
+	}
+	return NULL;
+}
+
+// Draw a preset's main area straight from the cache
+// Returns false on a miss, in which case the caller has to draw it
+bool presetCache_Blit(uint16_t presetIndex)
+{
+	cacheCentre = presetIndex;
+	CachedFrame* frame = findFrame(presetIndex, cacheGeneration);
+	uint16_t* out = framebuffer.getBuffer();
+	if(frame == NULL || !frame->usable || out == NULL)
+	{
+		presetCacheStats.misses++;
+		ESP_LOGD(PRESET_CACHE_TAG, "Miss on preset %d", presetIndex);
+		return false;
+	}
+
+	out += CACHE_AREA_Y * LCD_WIDTH;
+	for(uint16_t i=0; i<frame->numRuns; i++)
+	{
+		uint16_t colour = frame->palette[frame->runs[i] >> RUN_LENGTH_BITS];
+		uint16_t length = frame->runs[i] & RUN_LENGTH_MASK;
+		for(uint16_t p=0; p<length; p++)
+		{
+			*out++ = colour;
+		}
+	}
+	framebuffer_MarkDirty(0, CACHE_AREA_Y, LCD_WIDTH, MAIN_FILL_HEIGHT);
+	presetCacheStats.hits++;
+	ESP_LOGD(PRESET_CACHE_TAG, "Hit on preset %d", presetIndex);
+	return true;
+}
+
+// Append one rendered row to a frame. Clears usable if the frame runs out of room
+static void encodeRow(int16_t row, const uint16_t* pixels, int16_t w, void* context)
+{
+	CachedFrame* frame = (CachedFrame*)context;
+	int16_t x = 0;
+	while(x < w && frame->usable)
+	{
+		uint16_t colour = pixels[x];
+		int16_t length = 1;
+		while(x + length < w && pixels[x + length] == colour)
+			length++;
+
+		uint8_t index = 0;
+		while(index < frame->numColours && frame->palette[index] != colour)
+			index++;
+		if(index == frame->numColours)
+		{
+			if(index == PRESET_CACHE_COLOURS)
+			{
+				frame->usable = 0;
+				return;
+			}
+			frame->palette[frame->numColours++] = colour;
+		}
+
+		if(frame->numRuns == PRESET_CACHE_RUNS)
+		{
+			frame->usable = 0;
+			return;
+		}
+		frame->runs[frame->numRuns++] = (index << RUN_LENGTH_BITS) | length;
+		x += length;
+	}
+}
+
+// Render one missing neighbour of the current preset into the cache
+// Meant to be called when the display has nothing else to do. Returns false once
+// the current preset and both its neighbours are cached
+bool presetCache_Work()
+{
+	uint32_t generation = cacheGeneration;
+	uint16_t centre = cacheCentre;
+	uint16_t wanted[PRESET_CACHE_SLOTS] =
+	{
+		centre,
+		(uint16_t)((centre + 1) % NUM_PRESETS),
+		(uint16_t)((centre + NUM_PRESETS - 1) % NUM_PRESETS)
+	};
+
+	for(uint8_t w=0; w<PRESET_CACHE_SLOTS; w++)
+	{
+		if(findFrame(wanted[w], generation) != NULL)
+			continue;
+
+		// Reuse a slot that is stale or holds a preset no longer wanted
+		CachedFrame* frame = NULL;
+		for(uint8_t i=0; i<PRESET_CACHE_SLOTS && frame==NULL; i++)
+		{
+			bool keep = cachedFrames[i].generation == generation;
+			if(keep)
+			{
+				keep = false;
+				for(uint8_t j=0; j<PRESET_CACHE_SLOTS; j++)
+				{
+					if(cachedFrames[i].presetIndex == wanted[j])
+						keep = true;
+				}
+			}
+			if(!keep)
+				frame = &cachedFrames[i];
+		}
+		if(frame == NULL)
+			return false;
+
+		uint32_t start = micros();
+		TextLine lines[2];
+		uint16_t background;
+		uint8_t numLines = display_GetPresetText(wanted[w], lines, &background);
+
+		frame->generation = 0;
+		frame->presetIndex = wanted[w];
+		frame->usable = 1;
+		frame->numColours = 0;
+		frame->numRuns = 0;
+		if(!textRender_Rows(0, CACHE_AREA_Y, LCD_WIDTH, MAIN_FILL_HEIGHT, background,
+									lines, numLines, encodeRow, frame))
+		{
+			frame->usable = 0;
+		}
+		// Tagged with the generation it started in, so an invalidation during the render discards it
+		frame->generation = generation;
+
+		if(frame->usable)
+		{
+			presetCacheStats.renders++;
+			if(frame->numRuns > presetCacheStats.runsPeak)
+				presetCacheStats.runsPeak = frame->numRuns;
+		}
+		else
+		{
+			presetCacheStats.rejected++;
+			ESP_LOGD(PRESET_CACHE_TAG, "Preset %d cannot be cached", wanted[w]);
+		}
+		presetCacheStats.renderUsLast = micros() - start;
+		if(presetCacheStats.renderUsLast > presetCacheStats.renderUsMax)
+			presetCacheStats.renderUsMax = presetCacheStats.renderUsLast;
+		ESP_LOGV(PRESET_CACHE_TAG, "Cached preset %d: %d runs in %dus",
+					wanted[w], frame->numRuns, presetCacheStats.renderUsLast);
+		return true;
+	}
+	return false;
+}
+
+const PresetCacheStats* presetCache_GetStats()
+{
+	return &presetCacheStats;
+}
@@ -0,0 +1,91 @@
+#include "Arduino.h"
+#include "render_profiler.h"
+#include "framebuffer.h"
+
+static const char* RENDER_PROFILER_TAG = "RENDER PROFILER";
+
+// Short names keep the Device API report small
+const char* profilePointNames[NUM_PROFILE_POINTS] = {	"main",
+																		"num",
+																		"text",
+																		"mainText",
+																		"bpm",
+																		"beat",
+																		"midi",
+																		"wireless",
+																		"flush",
+																		"marquee"};
+
+const char* profileContextNames[NUM_PROFILE_CONTEXTS] = {	"other",
+																				"preset",
+																				"clock",
+																				"indicator"};
+
+ProfileEntry profileEntries[NUM_PROFILE_CONTEXTS][NUM_PROFILE_POINTS];
+uint8_t profileContext = ProfileCtxOther;
+
+// Entries are plain counters read while drawing carries on, so a report can be
+// one call behind but never blocks the render task
+void renderProfiler_Reset()
+{
+	memset(profileEntries, 0, sizeof(profileEntries));
+	ESP_LOGD(RENDER_PROFILER_TAG, "Render profile cleared");
+}
+
+void renderProfiler_SetContext(uint8_t context)
+{
+	if(context < NUM_PROFILE_CONTEXTS)
+		profileContext = context;
+}
+
+ProfileMark renderProfiler_Begin()
+{
+	ProfileMark mark;
+	mark.startUs = micros();
+	mark.startPixels = framebuffer_GetStats()->pixelsMarked;
+	return mark;
+}
+
+// Charge the time and dirty pixels since renderProfiler_Begin() to the current context
+void renderProfiler_End(uint8_t point, const ProfileMark* mark)
+{
+	renderProfiler_Record(	point,
+									micros() - mark->startUs,
+									framebuffer_GetStats()->pixelsMarked - mark->startPixels);
+}
+
+void renderProfiler_Record(uint8_t point, uint32_t elapsedUs, uint32_t pixels)
+{
+	if(point >= NUM_PROFILE_POINTS)
+		return;
+
+	ProfileEntry* entry = &profileEntries[profileContext][point];
+	entry->calls++;
+	entry->totalUs += elapsedUs;
+	entry->pixels += pixels;
+	if(elapsedUs > entry->maxUs)
+		entry->maxUs = elapsedUs;
+	if(pixels > entry->maxPixels)
+		entry->maxPixels = pixels;
+}
+
+const ProfileEntry* renderProfiler_GetEntry(uint8_t context, uint8_t point)
+{
+	if(context >= NUM_PROFILE_CONTEXTS || point >= NUM_PROFILE_POINTS)
+		return NULL;
+	return &profileEntries[context][point];
+}
+
+const char* renderProfiler_GetPointName(uint8_t point)
+{
+	if(point >= NUM_PROFILE_POINTS)
+		return "";
+	return profilePointNames[point];
+}
+
+const char* renderProfiler_GetContextName(uint8_t context)
+{
+	if(context >= NUM_PROFILE_CONTEXTS)
+		return "";
+	return profileContextNames[context];
+}
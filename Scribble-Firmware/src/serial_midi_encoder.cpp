@@ -0,0 +1,38 @@
+#include "serial_midi_encoder.h"
+#include "ble_midi_packer.h"
+
+void serialMidiEncoder_Reset(SerialMidiEncoder* encoder)
+{
+	encoder->runningStatus = 0;
+	encoder->statusBytesSaved = 0;
+}
+
+// Write a message's wire bytes and return how many there are
+// With useRunningStatus set, a channel message repeating the last status leaves it out
+uint8_t serialMidiEncoder_Encode(SerialMidiEncoder* encoder, uint8_t status, uint8_t data1, uint8_t data2,
+											bool useRunningStatus, uint8_t* bytes)
+{
+	uint8_t length = 0;
+	// Realtime bytes may appear anywhere, even between a message's data bytes,
+	// and leave running status alone
+	if(status >= 0xF8)
+	{
+		bytes[length++] = status;
+		return length;
+	}
+
+	if(useRunningStatus && status == encoder->runningStatus)
+		encoder->statusBytesSaved++;
+	else
+		bytes[length++] = status;
+
+	uint8_t dataLength = bleMidiPacker_DataLength(status);
+	if(dataLength > 0)
+		bytes[length++] = data1 & 0x7F;
+	if(dataLength > 1)
+		bytes[length++] = data2 & 0x7F;
+
+	// System common messages cancel running status
+	encoder->runningStatus = (useRunningStatus && status < 0xF0) ? status : 0;
+	return length;
+}
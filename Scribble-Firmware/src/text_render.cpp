@@ -0,0 +1,259 @@
+#include "Arduino.h"
+#include "display.h"
+#include "framebuffer.h"
+#include "text_render.h"
+
+static const char* TEXT_RENDER_TAG = "TEXT RENDER";
+
+#define ROW_MASK_WORDS		((LCD_WIDTH + 31) / 32)
+
+// A glyph at its final position, with its top-left pixel at (x, y)
+typedef struct
+{
+	const uint8_t* bitmap;
+	int16_t x;
+	int16_t y;
+	uint8_t w;
+	uint8_t h;
+	uint16_t colour;
+} PlacedGlyph;
+
+PlacedGlyph placedGlyphs[TEXT_RENDER_MAX_GLYPHS];
+
+// One bit per pixel of the current row, set where text has been drawn
+uint32_t rowMask[ROW_MASK_WORDS];
+// Row being built by textRender_Rows()
+uint16_t scratchRow[LCD_WIDTH];
+
+static inline void fillSpan(uint16_t* row, int16_t start, int16_t end, uint16_t colour)
+{
+	for(int16_t i=start; i<end; i++)
+	{
+		row[i] = colour;
+	}
+}
+
+// Position every glyph the way Adafruit_GFX::write() would, including its
+// wrapping at the right edge when wrap is set, so output matches print() pixel for pixel
+static uint8_t placeGlyphs(const TextLine* lines, uint8_t numLines, bool wrap)
+{
+	uint8_t count = 0;
+	for(uint8_t l=0; l<numLines; l++)
+	{
+		const GFXfont* font = lines[l].font;
+		const char* c = lines[l].text;
+		if(font == NULL || c == NULL)
+			continue;
+
+		int16_t cursorX = lines[l].cursorX;
+		int16_t cursorY = lines[l].cursorY;
+		for(; *c != 0; c++)
+		{
+			uint8_t ch = *c;
+			if(ch == '\n')
+			{
+				cursorX = 0;
+				cursorY += font->yAdvance;
+				continue;
+			}
+			if(ch == '\r' || ch < font->first || ch > font->last)
+				continue;
+
+			const GFXglyph* glyph = &font->glyph[ch - font->first];
+			if(glyph->width > 0 && glyph->height > 0)
+			{
+				if(wrap && cursorX + glyph->xOffset + glyph->width > LCD_WIDTH)
+				{
+					cursorX = 0;
+					cursorY += font->yAdvance;
+				}
+				if(count == TEXT_RENDER_MAX_GLYPHS)
+				{
+					ESP_LOGW(TEXT_RENDER_TAG, "Glyph limit reached, text truncated");
+					return count;
+				}
+				PlacedGlyph* placed = &placedGlyphs[count++];
+				placed->bitmap = &font->bitmap[glyph->bitmapOffset];
+				placed->x = cursorX + glyph->xOffset;
+				placed->y = cursorY + glyph->yOffset;
+				placed->w = glyph->width;
+				placed->h = glyph->height;
+				placed->colour = lines[l].colour;
+			}
+			cursorX += glyph->xAdvance;
+		}
+	}
+	return count;
+}
+
+static void maskSpan(int16_t start, int16_t end)
+{
+	for(int16_t i=start; i<end; i++)
+	{
+		rowMask[i >> 5] |= 1UL << (i & 31);
+	}
+}
+
+// First pixel at or after x whose mask bit equals set, or end if there is none
+static int16_t nextMasked(int16_t x, int16_t end, bool set)
+{
+	while(x < end)
+	{
+		uint32_t word = rowMask[x >> 5];
+		if(!set)
+			word = ~word;
+		word >>= (x & 31);
+		if(word)
+			return min((int16_t)(x + __builtin_ctz(word)), end);
+		x = (x | 31) + 1;
+	}
+	return end;
+}
+
+// Draw one row of a glyph as runs of set bits, clipped to [clipX1, clipX2)
+// Glyph bitmaps are packed with no padding between rows
+static void drawGlyphRow(uint16_t* row, const PlacedGlyph* glyph, int16_t glyphRow, int16_t clipX1, int16_t clipX2)
+{
+	uint32_t bit = (uint32_t)glyphRow * glyph->w;
+	int16_t runStart = -1;
+	for(uint16_t i=0; i<=glyph->w; i++, bit++)
+	{
+		bool set = (i < glyph->w) && (glyph->bitmap[bit >> 3] & (0x80 >> (bit & 7)));
+		if(set && runStart < 0)
+		{
+			runStart = i;
+		}
+		else if(!set && runStart >= 0)
+		{
+			int16_t start = max((int16_t)(glyph->x + runStart), clipX1);
+			int16_t end = min((int16_t)(glyph->x + i), clipX2);
+			if(start < end)
+			{
+				fillSpan(row, start, end, glyph->colour);
+				maskSpan(start, end);
+			}
+			runStart = -1;
+		}
+	}
+}
+
+// Draw the text crossing one row within [clipX1, clipX2), then write the background
+// into the gaps within [areaX1, areaX2). Every pixel in the region is written once
+static void renderRow(	uint16_t* row, int16_t rowY, uint8_t numGlyphs, int16_t clipX1, int16_t clipX2,
+								int16_t areaX1, int16_t areaX2, uint16_t background)
+{
+	memset(rowMask, 0, sizeof(rowMask));
+
+	// Text first, in the same order print() would draw it
+	for(uint8_t g=0; g<numGlyphs; g++)
+	{
+		const PlacedGlyph* glyph = &placedGlyphs[g];
+		if(rowY >= glyph->y && rowY < glyph->y + glyph->h)
+			drawGlyphRow(row, glyph, rowY - glyph->y, clipX1, clipX2);
+	}
+
+	int16_t gapStart = nextMasked(areaX1, areaX2, false);
+	while(gapStart < areaX2)
+	{
+		int16_t gapEnd = nextMasked(gapStart, areaX2, true);
+		fillSpan(row, gapStart, gapEnd, background);
+		gapStart = nextMasked(gapEnd, areaX2, false);
+	}
+}
+
+// Fill a region with a background colour and draw text over it in a single
+// pass over the framebuffer. Each row gets the runs of every glyph crossing
+// it, then the background is written only into the gaps between them.
+// Text that overhangs the region is still drawn and marked dirty
+void textRender_Fill(	int16_t x, int16_t y, int16_t w, int16_t h, uint16_t background,
+							const TextLine* lines, uint8_t numLines)
+{
+	uint16_t* buffer = framebuffer.getBuffer();
+	if(buffer == NULL)
+		return;
+
+	uint8_t numGlyphs = placeGlyphs(lines, numLines, true);
+
+	// Clip the background region to the panel
+	int16_t areaX1 = max(x, (int16_t)0);
+	int16_t areaX2 = min((int16_t)(x + w), (int16_t)LCD_WIDTH);
+	int16_t areaY1 = max(y, (int16_t)0);
+	int16_t areaY2 = min((int16_t)(y + h), (int16_t)LCD_HEIGHT);
+
+	// Rows to visit cover the region and any glyph hanging out of it
+	int16_t rowStart = areaY1;
+	int16_t rowEnd = areaY2;
+	int16_t inkX1 = LCD_WIDTH, inkX2 = 0;
+	for(uint8_t g=0; g<numGlyphs; g++)
+	{
+		rowStart = min(rowStart, placedGlyphs[g].y);
+		rowEnd = max(rowEnd, (int16_t)(placedGlyphs[g].y + placedGlyphs[g].h));
+		inkX1 = min(inkX1, placedGlyphs[g].x);
+		inkX2 = max(inkX2, (int16_t)(placedGlyphs[g].x + placedGlyphs[g].w));
+	}
+	rowStart = max(rowStart, (int16_t)0);
+	rowEnd = min(rowEnd, (int16_t)LCD_HEIGHT);
+
+	for(int16_t rowY=rowStart; rowY<rowEnd; rowY++)
+	{
+		// Rows outside the region only get the overhanging text
+		if(rowY < areaY1 || rowY >= areaY2)
+			renderRow(&buffer[rowY * LCD_WIDTH], rowY, numGlyphs, 0, LCD_WIDTH, 0, 0, background);
+		else
+			renderRow(&buffer[rowY * LCD_WIDTH], rowY, numGlyphs, 0, LCD_WIDTH, areaX1, areaX2, background);
+	}
+
+	framebuffer_MarkDirty(x, y, w, h);
+	if(numGlyphs > 0 && (inkX1 < areaX1 || inkX2 > areaX2 || rowStart < areaY1 || rowEnd > areaY2))
+		framebuffer_MarkDirty(inkX1, rowStart, inkX2 - inkX1, rowEnd - rowStart);
+}
+
+// Render a region the same way as textRender_Fill() but hand each finished
+// row to a handler instead of writing the framebuffer
+// Returns false, without calling the handler, if any text would fall outside the region
+bool textRender_Rows(	int16_t x, int16_t y, int16_t w, int16_t h, uint16_t background,
+							const TextLine* lines, uint8_t numLines, TextRowHandler handler, void* context)
+{
+	if(x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > LCD_WIDTH || y + h > LCD_HEIGHT)
+		return false;
+
+	uint8_t numGlyphs = placeGlyphs(lines, numLines, true);
+	for(uint8_t g=0; g<numGlyphs; g++)
+	{
+		const PlacedGlyph* glyph = &placedGlyphs[g];
+		if(glyph->x < x || glyph->y < y || glyph->x + glyph->w > x + w || glyph->y + glyph->h > y + h)
+			return false;
+	}
+
+	for(int16_t rowY=y; rowY<y+h; rowY++)
+	{
+		renderRow(scratchRow, rowY, numGlyphs, x, x + w, x, x + w, background);
+		handler(rowY - y, &scratchRow[x], w, context);
+	}
+	return true;
+}
+
+// Fill a region and draw text over it like textRender_Fill(), except that text
+// runs on past the right edge instead of wrapping and is clipped to the region
+// Used to draw slices of text wider than the panel
+void textRender_Strip(	int16_t x, int16_t y, int16_t w, int16_t h, uint16_t background,
+							const TextLine* lines, uint8_t numLines)
+{
+	uint16_t* buffer = framebuffer.getBuffer();
+	if(buffer == NULL)
+		return;
+
+	int16_t areaX1 = max(x, (int16_t)0);
+	int16_t areaX2 = min((int16_t)(x + w), (int16_t)LCD_WIDTH);
+	int16_t areaY1 = max(y, (int16_t)0);
+	int16_t areaY2 = min((int16_t)(y + h), (int16_t)LCD_HEIGHT);
+	if(areaX1 >= areaX2 || areaY1 >= areaY2)
+		return;
+
+	uint8_t numGlyphs = placeGlyphs(lines, numLines, false);
+	for(int16_t rowY=areaY1; rowY<areaY2; rowY++)
+	{
+		renderRow(&buffer[rowY * LCD_WIDTH], rowY, numGlyphs, areaX1, areaX2, areaX1, areaX2, background);
+	}
+	framebuffer_MarkDirty(areaX1, areaY1, areaX2 - areaX1, areaY2 - areaY1);
+}